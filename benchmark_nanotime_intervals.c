@@ -0,0 +1,226 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Benchmarks the batch interval functions against the equivalent loop of
+// nanotime_interval calls and scalar statistics, on an array of synthetic
+// timestamps that wrap around, checking that both give the same results.
+//
+// Exits with failure status if the results differ.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+
+#define NUM_BUCKETS 64
+
+#define REPEATS 5
+
+static uint64_t random_state = UINT64_C(0x9E3779B97F4A7C15);
+
+static uint64_t random_next() {
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return random_state;
+}
+
+static void scalar_stats(const uint64_t* const intervals, const size_t count, nanotime_interval_stats* const stats) {
+	stats->count = count;
+	stats->min = UINT64_MAX;
+	stats->max = 0;
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		if (intervals[i] < stats->min) {
+			stats->min = intervals[i];
+		}
+		if (intervals[i] > stats->max) {
+			stats->max = intervals[i];
+		}
+		sum += (double)intervals[i];
+	}
+	stats->mean = sum / count;
+	double squares = 0.0;
+	for (size_t i = 0; i < count; i++) {
+		const double difference = (double)intervals[i] - stats->mean;
+		squares += difference * difference;
+	}
+	stats->variance = squares / count;
+}
+
+static bool close_enough(const double a, const double b) {
+	return fabs(a - b) <= 1e-9 * fabs(b);
+}
+
+// Returns the fastest of several runs of the scalar or batch analysis, in
+// nanoseconds per timestamp, leaving the results in intervals, stats and
+// buckets.
+static double run(const bool batch, const uint64_t* const timestamps, const size_t count, const uint64_t max, const uint64_t bucket_width, uint64_t* const intervals, nanotime_interval_stats* const stats, uint64_t* const buckets) {
+	uint64_t fastest = UINT64_MAX;
+	for (int repeat = 0; repeat < REPEATS; repeat++) {
+		memset(buckets, 0, NUM_BUCKETS * sizeof(uint64_t));
+		const uint64_t start = nanotime_now();
+		if (batch) {
+			nanotime_intervals(timestamps, count, max, intervals);
+			nanotime_intervals_stats(intervals, count - 1, stats);
+			nanotime_intervals_histogram(intervals, count - 1, bucket_width, buckets, NUM_BUCKETS);
+		}
+		else {
+			for (size_t i = 0; i + 1 < count; i++) {
+				intervals[i] = nanotime_interval(timestamps[i], timestamps[i + 1], max);
+			}
+			scalar_stats(intervals, count - 1, stats);
+			for (size_t i = 0; i + 1 < count; i++) {
+				const uint64_t bucket = intervals[i] / bucket_width;
+				buckets[bucket < NUM_BUCKETS - 1 ? bucket : NUM_BUCKETS - 1]++;
+			}
+		}
+		const uint64_t duration = nanotime_interval(start, nanotime_now(), nanotime_now_max());
+		if (duration < fastest) {
+			fastest = duration;
+		}
+	}
+	return (double)fastest / count;
+}
+
+// Compares the scalar and batch analyses of count timestamps wrapping around
+// at max, with the given bucket width.
+static bool compare(const uint64_t* const timestamps, const size_t count, const uint64_t max, const uint64_t bucket_width, uint64_t* const scalar_intervals, uint64_t* const batch_intervals) {
+	nanotime_interval_stats scalar, batch;
+	uint64_t scalar_buckets[NUM_BUCKETS], batch_buckets[NUM_BUCKETS];
+	const double scalar_duration = run(false, timestamps, count, max, bucket_width, scalar_intervals, &scalar, scalar_buckets);
+	const double batch_duration = run(true, timestamps, count, max, bucket_width, batch_intervals, &batch, batch_buckets);
+
+	const bool same =
+		memcmp(scalar_intervals, batch_intervals, (count - 1) * sizeof(uint64_t)) == 0 &&
+		scalar.count == batch.count &&
+		scalar.min == batch.min &&
+		scalar.max == batch.max &&
+		close_enough(batch.mean, scalar.mean) &&
+		close_enough(batch.variance, scalar.variance) &&
+		memcmp(scalar_buckets, batch_buckets, sizeof(scalar_buckets)) == 0;
+	printf(
+		"%-20" PRIu64 " | %12" PRIu64 " | %10.3f %10.3f %8.2fx | %s\n",
+		max,
+		bucket_width,
+		scalar_duration,
+		batch_duration,
+		scalar_duration / batch_duration,
+		same ? "same" : "DIFFERENT"
+	);
+	return same;
+}
+
+int main(int argc, char** argv) {
+	uint64_t count_arg = 10000000;
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "%" SCNu64, &count_arg) != 1 || count_arg < 2))) {
+		fprintf(stderr, "Usage: benchmark_nanotime_intervals [timestamps]\n");
+		fprintf(stderr, "[timestamps] is the number of timestamps to analyse, and must be at least 2; the default is 10000000.\n");
+		return EXIT_FAILURE;
+	}
+	const size_t count = (size_t)count_arg;
+
+	uint64_t* const timestamps = (uint64_t*)malloc(count * sizeof(uint64_t));
+	uint64_t* const scalar_intervals = (uint64_t*)malloc((count - 1) * sizeof(uint64_t));
+	uint64_t* const batch_intervals = (uint64_t*)malloc((count - 1) * sizeof(uint64_t));
+	if (!timestamps || !scalar_intervals || !batch_intervals) {
+		fprintf(stderr, "Failed to allocate memory\n");
+		free(timestamps);
+		free(scalar_intervals);
+		free(batch_intervals);
+		return EXIT_FAILURE;
+	}
+
+	#if defined(NANOTIME_SIMD_AVX2)
+	const char* const kernels = "AVX2";
+	#elif defined(NANOTIME_SIMD_NEON)
+	const char* const kernels = "NEON";
+	#else
+	const char* const kernels = "portable";
+	#endif
+	printf("%" PRIu64 " timestamps, %s batch kernels, ns per timestamp\n", (uint64_t)count, kernels);
+	printf("%-20s | %12s | %10s %10s %9s | %s\n", "max", "bucket width", "scalar", "batch", "speedup", "results");
+
+	// Timestamps of events 1 us to 1 ms apart, on a 64-bit clock and on a
+	// 32-bit clock that wraps around about every 4.3 seconds.
+	static const uint64_t maxes[] = { UINT64_MAX, UINT64_C(0xFFFFFFFF) };
+	bool same = true;
+	for (size_t i = 0; i < sizeof(maxes) / sizeof(maxes[0]); i++) {
+		uint64_t timestamp = random_next() % maxes[i];
+		for (size_t j = 0; j < count; j++) {
+			timestamps[j] = timestamp;
+			timestamp = nanotime_interval(0, timestamp, maxes[i]) + 1000 + random_next() % 999000;
+			if (maxes[i] != UINT64_MAX && timestamp > maxes[i]) {
+				timestamp -= maxes[i] + 1;
+			}
+		}
+		same = compare(timestamps, count, maxes[i], 16384, scalar_intervals, batch_intervals) && same;
+		same = compare(timestamps, count, maxes[i], 16000, scalar_intervals, batch_intervals) && same;
+	}
+
+	free(timestamps);
+	free(scalar_intervals);
+	free(batch_intervals);
+	if (!same) {
+		printf("The batch results differ from the scalar results\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
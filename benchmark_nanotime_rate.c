@@ -0,0 +1,268 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Benchmarks the rate limiter: the throughput of acquiring tokens from one
+// limiter on a growing number of threads at once, where the threads contend
+// on its compare-and-swap, then the accuracy of pacing events at 10k to 1M
+// events per second with nanotime_rate_acquire_or_wait, on one thread and on
+// several threads sharing one limiter.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+#include "SDL.h"
+
+#define MAX_THREADS 64
+
+#define PACING_THREADS 4
+
+typedef struct thread_data {
+	nanotime_rate_limiter* limiter;
+	uint64_t acquired;
+	uint64_t denied;
+	uint64_t* latenesses;
+	uint64_t max_events;
+	uint64_t num_events;
+} thread_data;
+
+static SDL_atomic_t start_now;
+static SDL_atomic_t quit_now;
+
+static int SDLCALL contention_thread_function(void* data) {
+	thread_data* const thread = (thread_data*)data;
+
+	while (!SDL_AtomicGet(&start_now));
+	while (!SDL_AtomicGet(&quit_now)) {
+		for (int i = 0; i < 256; i++) {
+			if (nanotime_rate_try_acquire(thread->limiter, 1, nanotime_now(), NULL)) {
+				thread->acquired++;
+			}
+			else {
+				thread->denied++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int SDLCALL pacing_thread_function(void* data) {
+	thread_data* const thread = (thread_data*)data;
+
+	// The stepper is only used for its sleep calibration.
+	nanotime_step_data stepper;
+	nanotime_step_init(&stepper, NANOTIME_NSEC_PER_SEC / 60, nanotime_now_max(), nanotime_now, nanotime_sleep);
+	while (!SDL_AtomicGet(&start_now));
+	while (!SDL_AtomicGet(&quit_now) && thread->num_events < thread->max_events) {
+		thread->latenesses[thread->num_events++] = nanotime_rate_acquire_or_wait(thread->limiter, 1, &stepper);
+	}
+
+	return 0;
+}
+
+static int compare_uint64(const void* a, const void* b) {
+	const uint64_t value_a = *(const uint64_t*)a;
+	const uint64_t value_b = *(const uint64_t*)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+// Runs the threads for the duration, returning the actual duration, or zero if
+// the threads couldn't be run.
+static uint64_t run_threads(SDL_ThreadFunction function, thread_data* const threads, const int num_threads, const double seconds) {
+	SDL_Thread* handles[MAX_THREADS];
+	SDL_AtomicSet(&start_now, 0);
+	SDL_AtomicSet(&quit_now, 0);
+	int num_started = 0;
+	for (; num_started < num_threads; num_started++) {
+		if (!(handles[num_started] = SDL_CreateThread(function, "rate_thread", &threads[num_started]))) {
+			break;
+		}
+	}
+	const uint64_t start = nanotime_now();
+	SDL_AtomicSet(&start_now, 1);
+	if (num_started == num_threads) {
+		nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+	}
+	SDL_AtomicSet(&quit_now, 1);
+	for (int i = 0; i < num_started; i++) {
+		SDL_WaitThread(handles[i], NULL);
+	}
+	const uint64_t duration = nanotime_interval(start, nanotime_now(), nanotime_now_max());
+	return num_started == num_threads ? duration : 0;
+}
+
+// Token acquisition throughput, from a limiter allowing a token per
+// nanosecond, so the threads contend on it rather than being denied tokens.
+static bool contention(const int num_threads, const double seconds) {
+	static thread_data threads[MAX_THREADS];
+	nanotime_rate_limiter limiter;
+	nanotime_rate_limiter_init(&limiter, 1, NANOTIME_NSEC_PER_SEC, nanotime_now(), nanotime_now_max());
+	for (int i = 0; i < num_threads; i++) {
+		threads[i].limiter = &limiter;
+		threads[i].acquired = 0;
+		threads[i].denied = 0;
+	}
+	const uint64_t duration = run_threads(contention_thread_function, threads, num_threads, seconds);
+	if (duration == 0) {
+		return false;
+	}
+
+	uint64_t acquired = 0;
+	uint64_t denied = 0;
+	for (int i = 0; i < num_threads; i++) {
+		acquired += threads[i].acquired;
+		denied += threads[i].denied;
+	}
+	const double per_second = (double)acquired * NANOTIME_NSEC_PER_SEC / duration;
+	printf("%7d | %14.3e %14.3e | %10" PRIu64 "\n", num_threads, per_second, per_second / num_threads, denied);
+	return true;
+}
+
+// Pacing accuracy of events at the rate, shared by the threads.
+static bool pacing(const double rate, const int num_threads, const double seconds) {
+	static thread_data threads[MAX_THREADS];
+	nanotime_rate_limiter limiter;
+	nanotime_rate_limiter_init(&limiter, (uint64_t)(NANOTIME_NSEC_PER_SEC / rate), 1, nanotime_now(), nanotime_now_max());
+	const uint64_t max_events = (uint64_t)(rate * seconds) + 2;
+	for (int i = 0; i < num_threads; i++) {
+		threads[i].limiter = &limiter;
+		threads[i].latenesses = (uint64_t*)malloc(max_events * sizeof(uint64_t));
+		threads[i].max_events = max_events;
+		threads[i].num_events = 0;
+		if (!threads[i].latenesses) {
+			for (int j = 0; j < i; j++) {
+				free(threads[j].latenesses);
+			}
+			return false;
+		}
+	}
+	const uint64_t duration = run_threads(pacing_thread_function, threads, num_threads, seconds);
+
+	uint64_t num_events = 0;
+	for (int i = 0; i < num_threads; i++) {
+		num_events += threads[i].num_events;
+	}
+	uint64_t* const latenesses = (uint64_t*)malloc((num_events > 0 ? num_events : 1) * sizeof(uint64_t));
+	uint64_t num_latenesses = 0;
+	for (int i = 0; i < num_threads; i++) {
+		for (uint64_t j = 0; latenesses && j < threads[i].num_events; j++) {
+			latenesses[num_latenesses++] = threads[i].latenesses[j];
+		}
+		free(threads[i].latenesses);
+	}
+	if (duration == 0 || !latenesses || num_latenesses == 0) {
+		free(latenesses);
+		return false;
+	}
+	qsort(latenesses, num_latenesses, sizeof(uint64_t), compare_uint64);
+
+	const double achieved = (double)num_latenesses * NANOTIME_NSEC_PER_SEC / duration;
+	printf(
+		"%10.0f %7d | %12.1f %+8.3f%% | %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		rate,
+		num_threads,
+		achieved,
+		(achieved - rate) / rate * 100.0,
+		latenesses[(num_latenesses - 1) / 2],
+		latenesses[(num_latenesses - 1) * 99 / 100],
+		latenesses[num_latenesses - 1]
+	);
+	free(latenesses);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 2.0;
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "%lf", &seconds) != 1 || seconds <= 0.0))) {
+		fprintf(stderr, "Usage: benchmark_nanotime_rate [seconds]\n");
+		fprintf(stderr, "[seconds] is the duration of each run, and must be greater than 0.0; the default is 2.0.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (SDL_Init(0) < 0) {
+		fprintf(stderr, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	int max_threads = SDL_GetCPUCount() * 2;
+	if (max_threads > MAX_THREADS) {
+		max_threads = MAX_THREADS;
+	}
+	bool success = true;
+
+	printf("Token acquisition under contention, %.3f seconds per run\n", seconds);
+	printf("%7s | %14s %14s | %10s\n", "threads", "acquires/s", "per thread/s", "denied");
+	for (int num_threads = 1; success && num_threads <= max_threads; num_threads *= 2) {
+		success = contention(num_threads, seconds);
+	}
+
+	printf("\nPacing accuracy, %.3f seconds per run\n", seconds);
+	printf("%10s %7s | %12s %9s | %10s %10s %10s\n", "rate", "threads", "achieved/s", "error", "p50 late", "p99 late", "max late");
+	static const double rates[] = { 10000.0, 100000.0, 1000000.0 };
+	for (size_t i = 0; success && i < sizeof(rates) / sizeof(rates[0]); i++) {
+		success = pacing(rates[i], 1, seconds) && pacing(rates[i], PACING_THREADS, seconds);
+	}
+
+	SDL_Quit();
+	if (!success) {
+		fprintf(stderr, "Failed to run the benchmark\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
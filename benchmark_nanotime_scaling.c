@@ -0,0 +1,430 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Benchmarks how nanotime_step scales with the number of steppers running at
+// once, such as many steppers on a many-core host, where timer interrupts, run
+// queue contention and clock reads are all shared between the steppers. Two
+// threading models are compared: one thread per stepper, and one thread
+// multiplexing all the tickers on a single stepper, by stepping to whichever
+// ticker's deadline is next. The deadline error of each ticker and of all the
+// tickers together is reported, along with skipped steps and the CPU time the
+// process used. The steppers are registered, and the registry is queried while
+// they run, as a metrics exporter would, showing what it reports.
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+#include "SDL.h"
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define MAX_THREADS 1024
+
+#define MAX_RATES 16
+
+typedef struct ticker_data {
+	uint64_t period;
+	uint64_t* deviations;
+	uint64_t max_steps;
+	uint64_t num_steps;
+	uint64_t skips;
+} ticker_data;
+
+typedef struct stepper_thread_data {
+	ticker_data* tickers;
+	int num_tickers;
+	int index;
+	int cpu;
+	uint64_t resets;
+} stepper_thread_data;
+
+static SDL_atomic_t quit_now;
+
+static bool pin_thread(const int cpu) {
+	#if defined(_WIN32)
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+	#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+	#else
+	// Other platforms, such as macOS, don't support pinning threads to
+	// cores.
+	(void)cpu;
+	return false;
+	#endif
+}
+
+// The CPU time used by all the process's threads so far, in seconds.
+static double process_cpu_seconds() {
+	#if defined(_WIN32)
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time)) {
+		return 0.0;
+	}
+	const uint64_t kernel = ((uint64_t)kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime;
+	const uint64_t user = ((uint64_t)user_time.dwHighDateTime << 32) | user_time.dwLowDateTime;
+	return (double)(kernel + user) / 1.0e7;
+	#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0.0;
+	}
+	return
+		(double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1.0e6 +
+		(double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1.0e6;
+	#endif
+}
+
+// Steps through the deadlines of all the thread's tickers in order, on one
+// stepper, by setting the stepper's sleep_duration to the time to the next
+// deadline before every step; with one ticker, that's just a regular stepper.
+// Tickers with the same deadline share the step.
+static int SDLCALL stepper_thread_function(void* data) {
+	stepper_thread_data* const thread_data = (stepper_thread_data*)data;
+	ticker_data* const tickers = thread_data->tickers;
+
+	if (thread_data->cpu >= 0) {
+		pin_thread(thread_data->cpu);
+	}
+
+	uint64_t* const deadlines = (uint64_t*)malloc(thread_data->num_tickers * sizeof(uint64_t));
+	if (!deadlines) {
+		return 1;
+	}
+	uint64_t timeline = 0;
+	uint64_t next = UINT64_MAX;
+	for (int i = 0; i < thread_data->num_tickers; i++) {
+		deadlines[i] = tickers[i].period;
+		if (deadlines[i] < next) {
+			next = deadlines[i];
+		}
+	}
+
+	nanotime_step_data stepper;
+	nanotime_step_init(&stepper, next, nanotime_now_max(), nanotime_now, nanotime_sleep);
+	char name[NANOTIME_STEP_NAME_SIZE];
+	if (thread_data->num_tickers > 1) {
+		snprintf(name, sizeof(name), "multiplexed");
+	}
+	else {
+		snprintf(name, sizeof(name), "ticker %d", thread_data->index);
+	}
+	nanotime_step_register(&stepper, name);
+	while (!SDL_AtomicGet(&quit_now)) {
+		stepper.sleep_duration = next - timeline;
+		const bool slept = nanotime_step(&stepper);
+		timeline = next;
+		next = UINT64_MAX;
+		for (int i = 0; i < thread_data->num_tickers; i++) {
+			if (deadlines[i] == timeline) {
+				if (!slept) {
+					tickers[i].skips++;
+				}
+				else if (tickers[i].num_steps < tickers[i].max_steps) {
+					tickers[i].deviations[tickers[i].num_steps++] = stepper.stats.deviation;
+				}
+				deadlines[i] += tickers[i].period;
+			}
+			if (deadlines[i] < next) {
+				next = deadlines[i];
+			}
+		}
+	}
+	thread_data->resets = stepper.stats.resets;
+	nanotime_step_unregister(&stepper);
+
+	free(deadlines);
+	return 0;
+}
+
+static int compare_uint64(const void* a, const void* b) {
+	const uint64_t value_a = *(const uint64_t*)a;
+	const uint64_t value_b = *(const uint64_t*)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+// Sorts the deviations, then prints their statistics.
+static void print_deviations(const char* const name, const double rate, uint64_t* const deviations, const uint64_t num_deviations, const uint64_t skips) {
+	if (num_deviations == 0) {
+		printf("%-8s | %8.1f | %8d | %8" PRIu64 " |\n", name, rate, 0, skips);
+		return;
+	}
+	qsort(deviations, num_deviations, sizeof(uint64_t), compare_uint64);
+	uint64_t total_deviation = 0;
+	for (uint64_t i = 0; i < num_deviations; i++) {
+		total_deviation += deviations[i];
+	}
+	printf(
+		"%-8s | %8.1f | %8" PRIu64 " | %8" PRIu64 " | %10.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		name,
+		rate,
+		num_deviations,
+		skips,
+		(double)total_deviation / num_deviations,
+		deviations[(num_deviations - 1) / 2],
+		deviations[(num_deviations - 1) * 99 / 100],
+		deviations[num_deviations - 1]
+	);
+}
+
+// Runs num_tickers tickers, each at one of the rates in turn, either on one
+// thread each, or all multiplexed on one thread.
+static bool run(const bool multiplexed, const int num_tickers, const double* const rates, const int num_rates, const double seconds, const bool pin) {
+	static ticker_data tickers[MAX_THREADS];
+	static stepper_thread_data thread_data[MAX_THREADS];
+	SDL_Thread* threads[MAX_THREADS];
+
+	const int num_threads = multiplexed ? 1 : num_tickers;
+	const int num_cpus = SDL_GetCPUCount();
+	for (int i = 0; i < num_tickers; i++) {
+		const double rate = rates[i % num_rates];
+		tickers[i].period = (uint64_t)(NANOTIME_NSEC_PER_SEC / rate);
+		tickers[i].max_steps = (uint64_t)(seconds * rate) + 2;
+		tickers[i].deviations = (uint64_t*)malloc(tickers[i].max_steps * sizeof(uint64_t));
+		tickers[i].num_steps = 0;
+		tickers[i].skips = 0;
+		if (!tickers[i].deviations) {
+			for (int j = 0; j < i; j++) {
+				free(tickers[j].deviations);
+			}
+			return false;
+		}
+	}
+	for (int i = 0; i < num_threads; i++) {
+		thread_data[i].tickers = multiplexed ? tickers : &tickers[i];
+		thread_data[i].num_tickers = multiplexed ? num_tickers : 1;
+		thread_data[i].index = i;
+		thread_data[i].cpu = pin ? i % num_cpus : -1;
+		thread_data[i].resets = 0;
+	}
+
+	SDL_AtomicSet(&quit_now, 0);
+	const double start_cpu_seconds = process_cpu_seconds();
+	int num_started = 0;
+	for (; num_started < num_threads; num_started++) {
+		threads[num_started] = SDL_CreateThread(stepper_thread_function, "stepper_thread", &thread_data[num_started]);
+		if (!threads[num_started]) {
+			break;
+		}
+	}
+	static nanotime_step_report reports[NANOTIME_STEP_REGISTRY_SIZE];
+	size_t num_reports = 0;
+	uint64_t query_duration = 0;
+	if (num_started == num_threads) {
+		nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+		const uint64_t query_start = nanotime_now();
+		num_reports = nanotime_step_registry_query(reports, NANOTIME_STEP_REGISTRY_SIZE);
+		query_duration = nanotime_interval(query_start, nanotime_now(), nanotime_now_max());
+	}
+	SDL_AtomicSet(&quit_now, 1);
+	bool success = num_started == num_threads;
+	for (int i = 0; i < num_started; i++) {
+		int status;
+		SDL_WaitThread(threads[i], &status);
+		if (status != 0) {
+			success = false;
+		}
+	}
+	const double cpu_seconds = process_cpu_seconds() - start_cpu_seconds;
+	if (!success) {
+		for (int i = 0; i < num_tickers; i++) {
+			free(tickers[i].deviations);
+		}
+		return false;
+	}
+
+	printf("%s: %d tickers on %d threads%s\n", multiplexed ? "Multiplexed" : "Threaded", num_tickers, num_threads, pin ? ", pinned" : "");
+	printf("%-8s | %8s | %8s | %8s | %10s %10s %10s %10s\n", "ticker", "rate", "steps", "skips", "mean ns", "p50 ns", "p99 ns", "max ns");
+
+	// The tickers' deviations are printed individually, then pooled, for
+	// percentiles across all tickers.
+	uint64_t total_steps = 0;
+	uint64_t total_skips = 0;
+	uint64_t total_resets = 0;
+	for (int i = 0; i < num_tickers; i++) {
+		char name[16];
+		snprintf(name, sizeof(name), "%d", i);
+		print_deviations(name, NANOTIME_NSEC_PER_SEC / (double)tickers[i].period, tickers[i].deviations, tickers[i].num_steps, tickers[i].skips);
+		total_steps += tickers[i].num_steps;
+		total_skips += tickers[i].skips;
+	}
+	for (int i = 0; i < num_threads; i++) {
+		total_resets += thread_data[i].resets;
+	}
+	uint64_t* const deviations = (uint64_t*)malloc((total_steps > 0 ? total_steps : 1) * sizeof(uint64_t));
+	if (deviations) {
+		uint64_t num_deviations = 0;
+		for (int i = 0; i < num_tickers; i++) {
+			memcpy(deviations + num_deviations, tickers[i].deviations, tickers[i].num_steps * sizeof(uint64_t));
+			num_deviations += tickers[i].num_steps;
+		}
+		print_deviations("all", 0.0, deviations, num_deviations, total_skips);
+		free(deviations);
+	}
+	for (int i = 0; i < num_tickers; i++) {
+		free(tickers[i].deviations);
+	}
+	printf(
+		"%" PRIu64 " resets, %.3f CPU seconds, %.1f%% of one core, %.1f us CPU per step\n\n",
+		total_resets,
+		cpu_seconds,
+		cpu_seconds / seconds * 100.0,
+		total_steps + total_skips > 0 ? cpu_seconds * 1.0e6 / (double)(total_steps + total_skips) : 0.0
+	);
+
+	printf("Registry: %d of %d steppers reported, queried in %.1f us while stepping\n", (int)num_reports, num_threads, (double)query_duration / 1000.0);
+	printf("%-12s | %8s | %8s | %8s | %8s | %10s %10s %10s | %10s\n", "stepper", "rate", "steps", "skips", "resets", "last ns", "p99 ns", "max ns", "spin ms");
+	for (size_t i = 0; i < num_reports; i++) {
+		printf(
+			"%-12s | %8.1f | %8" PRIu64 " | %8" PRIu64 " | %8" PRIu64 " | %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " | %10.3f\n",
+			reports[i].name,
+			reports[i].rate,
+			reports[i].steps,
+			reports[i].skips,
+			reports[i].resets,
+			reports[i].deviation,
+			reports[i].p99_deviation,
+			reports[i].max_deviation,
+			(double)reports[i].spin_duration / 1.0e6
+		);
+	}
+	printf("\n");
+	return deviations != NULL;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage: benchmark_nanotime_scaling [threads] [rates] [seconds] [pin]\n");
+	fprintf(stderr, "[threads] is the number of tickers, each run on its own thread, then all on one thread; the default is twice the number of cores, and the maximum is %d.\n", MAX_THREADS);
+	fprintf(stderr, "[rates] is a comma-separated list of step rates in Hz, assigned to the tickers in turn; the default is 60,120,240.\n");
+	fprintf(stderr, "[seconds] is the duration to run each threading model for, and must be greater than 0.0; the default is 5.0.\n");
+	fprintf(stderr, "[pin] is \"pin\" to pin the threads to cores, in turn, where supported, or \"nopin\", the default.\n");
+}
+
+int main(int argc, char** argv) {
+	if (SDL_Init(0) < 0) {
+		fprintf(stderr, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	int num_tickers = SDL_GetCPUCount() * 2;
+	double rates[MAX_RATES] = { 60.0, 120.0, 240.0 };
+	int num_rates = 3;
+	double seconds = 5.0;
+	bool pin = false;
+	bool valid = argc <= 5;
+	if (valid && argc > 1) {
+		valid = sscanf(argv[1], "%d", &num_tickers) == 1 && num_tickers > 0 && num_tickers <= MAX_THREADS;
+	}
+	if (valid && argc > 2) {
+		const char* rate = argv[2];
+		num_rates = 0;
+		while (valid && num_rates < MAX_RATES) {
+			char* end;
+			rates[num_rates] = strtod(rate, &end);
+			valid = end != rate && rates[num_rates] > 0.0 && NANOTIME_NSEC_PER_SEC / rates[num_rates] >= 1.0 && rates[num_rates] >= 1.0;
+			num_rates++;
+			if (*end != ',') {
+				valid = valid && *end == '\0';
+				break;
+			}
+			rate = end + 1;
+		}
+		valid = valid && num_rates <= MAX_RATES;
+	}
+	if (valid && argc > 3) {
+		valid = sscanf(argv[3], "%lf", &seconds) == 1 && seconds > 0.0;
+	}
+	if (valid && argc > 4) {
+		pin = strcmp(argv[4], "pin") == 0;
+		valid = pin || strcmp(argv[4], "nopin") == 0;
+	}
+	if (!valid) {
+		usage();
+		SDL_Quit();
+		return EXIT_FAILURE;
+	}
+	if (num_tickers > MAX_THREADS) {
+		num_tickers = MAX_THREADS;
+	}
+
+	printf("%d tickers, %d cores, %.3f seconds per threading model\n\n", num_tickers, SDL_GetCPUCount(), seconds);
+	if (!run(false, num_tickers, rates, num_rates, seconds, pin) || !run(true, num_tickers, rates, num_rates, seconds, pin)) {
+		fprintf(stderr, "Failed to run the benchmark\n");
+		SDL_Quit();
+		return EXIT_FAILURE;
+	}
+
+	SDL_Quit();
+	return EXIT_SUCCESS;
+}
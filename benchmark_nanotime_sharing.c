@@ -0,0 +1,273 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Benchmarks the cost of false sharing between a logic thread publishing its
+// states and a reader thread taking snapshots of them, as a render thread
+// would. The logic thread steps at a fixed rate, updating its working state
+// then publishing it each tick, while the reader polls for snapshots at the
+// render rate, then as fast as it can, for the worst case. Both run with the
+// states packed next to each other, as plain arrays of small states are, then
+// with the states aligned to cache lines with NANOTIME_CACHE_ALIGNED, where the
+// reader's copies never pull in the lines the logic thread is writing.
+//
+// False sharing needs the threads on separate cores, so the differences only
+// show on multicore machines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+#include "SDL.h"
+
+#define LOGIC_RATE 1000
+
+// The number of writes to the working state per tick, standing in for a tick's
+// logic.
+#define WRITES_PER_TICK 256
+
+// A state smaller than a cache line, so packed states share lines.
+typedef struct sim_state {
+	uint64_t tick;
+	double position[4];
+	double velocity;
+} sim_state;
+
+typedef struct NANOTIME_CACHE_ALIGNED aligned_state {
+	sim_state state;
+} aligned_state;
+
+// The working state is next to the published states, as when they're all
+// globals of the logic code.
+typedef struct packed_layout {
+	sim_state working;
+	sim_state states[3];
+	nanotime_step_publisher publisher;
+} packed_layout;
+
+typedef struct aligned_layout {
+	aligned_state working;
+	aligned_state states[3];
+	nanotime_step_publisher publisher;
+} aligned_layout;
+
+static packed_layout packed;
+static aligned_layout aligned;
+
+typedef struct run_data {
+	sim_state* working;
+	nanotime_step_publisher* publisher;
+	uint64_t render_rate;
+
+	uint64_t ticks;
+	uint64_t tick_duration;
+	uint64_t snapshots;
+	uint64_t snapshot_duration;
+} run_data;
+
+static SDL_atomic_t start_now;
+static SDL_atomic_t quit_now;
+
+static int SDLCALL logic_thread_function(void* data) {
+	run_data* const run = (run_data*)data;
+
+	nanotime_step_data stepper;
+	nanotime_step_init(&stepper, NANOTIME_NSEC_PER_SEC / LOGIC_RATE, nanotime_now_max(), nanotime_now, nanotime_sleep);
+	while (!SDL_AtomicGet(&start_now));
+	while (!SDL_AtomicGet(&quit_now)) {
+		nanotime_step(&stepper);
+		const uint64_t start = nanotime_now();
+		sim_state* const working = run->working;
+		working->tick++;
+		for (int i = 0; i < WRITES_PER_TICK; i++) {
+			working->position[i % 4] += working->velocity;
+			working->velocity = -working->velocity;
+		}
+		nanotime_step_publish(run->publisher, &stepper, working);
+		run->tick_duration += nanotime_interval(start, nanotime_now(), nanotime_now_max());
+		run->ticks++;
+	}
+
+	return 0;
+}
+
+static int SDLCALL reader_thread_function(void* data) {
+	run_data* const run = (run_data*)data;
+
+	nanotime_step_data stepper;
+	if (run->render_rate > 0) {
+		nanotime_step_init(&stepper, NANOTIME_NSEC_PER_SEC / run->render_rate, nanotime_now_max(), nanotime_now, nanotime_sleep);
+	}
+	double sum = 0.0;
+	while (!SDL_AtomicGet(&start_now));
+	while (!SDL_AtomicGet(&quit_now)) {
+		if (run->render_rate > 0) {
+			nanotime_step(&stepper);
+		}
+		// Room for either layout's states.
+		aligned_state previous;
+		aligned_state current;
+		const uint64_t start = nanotime_now();
+		const double alpha = nanotime_step_snapshot(run->publisher, start, &previous, &current);
+		sum += previous.state.position[0] * (1.0 - alpha) + current.state.position[0] * alpha;
+		run->snapshot_duration += nanotime_interval(start, nanotime_now(), nanotime_now_max());
+		run->snapshots++;
+	}
+
+	// The sum is used, so the copies aren't optimized away.
+	return sum != sum;
+}
+
+// Runs the logic and reader threads on a layout's states for the duration,
+// printing the results; returns false if the threads couldn't be run.
+static bool run_layout(const char* const name, sim_state* const working, nanotime_step_publisher* const publisher, void* const states, const size_t state_size, const uint64_t render_rate, const double seconds) {
+	working->tick = 0;
+	for (int i = 0; i < 4; i++) {
+		working->position[i] = 0.0;
+	}
+	working->velocity = 1.0;
+
+	// The publisher only needs the stepper's timeline, which the logic
+	// thread's stepper starts at about the same time.
+	nanotime_step_data timeline;
+	nanotime_step_init(&timeline, NANOTIME_NSEC_PER_SEC / LOGIC_RATE, nanotime_now_max(), nanotime_now, nanotime_sleep);
+	nanotime_step_publisher_init(publisher, &timeline, states, state_size, working);
+
+	run_data run;
+	run.working = working;
+	run.publisher = publisher;
+	run.render_rate = render_rate;
+	run.ticks = 0;
+	run.tick_duration = 0;
+	run.snapshots = 0;
+	run.snapshot_duration = 0;
+
+	SDL_AtomicSet(&start_now, 0);
+	SDL_AtomicSet(&quit_now, 0);
+	SDL_Thread* const logic_thread = SDL_CreateThread(logic_thread_function, "logic", &run);
+	if (logic_thread == NULL) {
+		return false;
+	}
+	SDL_Thread* const reader_thread = SDL_CreateThread(reader_thread_function, "reader", &run);
+	if (reader_thread == NULL) {
+		SDL_AtomicSet(&start_now, 1);
+		SDL_AtomicSet(&quit_now, 1);
+		SDL_WaitThread(logic_thread, NULL);
+		return false;
+	}
+	SDL_AtomicSet(&start_now, 1);
+	nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+	SDL_AtomicSet(&quit_now, 1);
+	SDL_WaitThread(logic_thread, NULL);
+	SDL_WaitThread(reader_thread, NULL);
+
+	char reader[32];
+	if (render_rate > 0) {
+		snprintf(reader, sizeof(reader), "%" PRIu64 " Hz", render_rate);
+	}
+	else {
+		snprintf(reader, sizeof(reader), "continuous");
+	}
+	printf(
+		"%-8s %12s | %8" PRIu64 " %12.1f | %12" PRIu64 " %12.1f\n",
+		name,
+		reader,
+		run.ticks,
+		run.ticks > 0 ? (double)run.tick_duration / (double)run.ticks : 0.0,
+		run.snapshots,
+		run.snapshots > 0 ? (double)run.snapshot_duration / (double)run.snapshots : 0.0
+	);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 2.0;
+	uint64_t render_rate = 240;
+	if (
+		argc > 3 ||
+		(argc >= 2 && (sscanf(argv[1], "%lf", &seconds) != 1 || seconds <= 0.0)) ||
+		(argc >= 3 && (sscanf(argv[2], "%" SCNu64, &render_rate) != 1 || render_rate == 0))
+	) {
+		fprintf(stderr, "Usage: benchmark_nanotime_sharing [seconds] [render rate]\n");
+		fprintf(stderr, "[seconds] is the duration of each run, and must be greater than 0.0; the default is 2.0.\n");
+		fprintf(stderr, "[render rate] is the rate the reader polls at in Hz, and must be greater than 0; the default is 240.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (SDL_Init(0) < 0) {
+		fprintf(stderr, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("Logic at %d Hz, %d writes per tick, %.3f seconds per run, %d-byte cache lines\n", LOGIC_RATE, WRITES_PER_TICK, seconds, NANOTIME_CACHE_LINE_SIZE);
+	printf("States are %d bytes packed, %d bytes aligned\n", (int)sizeof(sim_state), (int)sizeof(aligned_state));
+	printf("%-8s %12s | %8s %12s | %12s %12s\n", "states", "reader", "ticks", "ns/tick", "snapshots", "ns/snapshot");
+	const uint64_t reader_rates[] = { render_rate, 0 };
+	bool success = true;
+	for (size_t i = 0; success && i < sizeof(reader_rates) / sizeof(reader_rates[0]); i++) {
+		success =
+			run_layout("packed", &packed.working, &packed.publisher, packed.states, sizeof(sim_state), reader_rates[i], seconds) &&
+			run_layout("aligned", &aligned.working.state, &aligned.publisher, aligned.states, sizeof(aligned_state), reader_rates[i], seconds);
+	}
+
+	SDL_Quit();
+	if (!success) {
+		fprintf(stderr, "Failed to run the benchmark\n");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
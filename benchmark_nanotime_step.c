@@ -0,0 +1,285 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Benchmarks nanotime_step under CPU oversubscription, comparing a stepper
+// that only spins in its final busyloop with one that yields there, using
+// nanotime_yield, and with one doing its coarse waits on a periodic kernel
+// timer, where supported. One stepper thread and one CPU-hogging thread are run
+// per core, so there are twice as many threads wanting to run as there are
+// cores; the steppers' deadline error, wakeups and system calls per step are
+// reported, along with how much work the hog threads got done, as a measure of
+// how fairly the steppers shared the cores.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+#include "SDL.h"
+
+#define STEP_RATE 240.0
+
+#define MAX_THREADS 256
+
+typedef enum stepper_mode {
+	MODE_SPIN,
+	MODE_YIELD,
+	MODE_TIMER
+} stepper_mode;
+
+static const char* const mode_names[] = { "spin", "yield", "timer" };
+
+typedef struct stepper_thread_data {
+	stepper_mode mode;
+	bool failed;
+	uint64_t* deviations;
+	uint64_t max_steps;
+	uint64_t num_steps;
+	nanotime_step_stats stats;
+	uint64_t syscalls;
+} stepper_thread_data;
+
+static SDL_atomic_t quit_now;
+
+static int SDLCALL stepper_thread_function(void* data) {
+	stepper_thread_data* const thread_data = (stepper_thread_data*)data;
+
+	nanotime_step_data stepper;
+	nanotime_step_init(&stepper, (uint64_t)(NANOTIME_NSEC_PER_SEC / STEP_RATE), nanotime_now_max(), nanotime_now, nanotime_sleep);
+	nanotime_step_timer timer;
+	if (thread_data->mode == MODE_YIELD) {
+		nanotime_step_set_yield(&stepper, nanotime_yield);
+	}
+	else if (thread_data->mode == MODE_TIMER && !nanotime_step_set_timer(&stepper, &timer, NANOTIME_NSEC_PER_SEC / 2000)) {
+		thread_data->failed = true;
+		return 0;
+	}
+	while (!SDL_AtomicGet(&quit_now) && thread_data->num_steps < thread_data->max_steps) {
+		if (nanotime_step(&stepper)) {
+			thread_data->deviations[thread_data->num_steps++] = stepper.stats.deviation;
+		}
+	}
+	thread_data->stats = stepper.stats;
+
+	// Every sleep and yield is a system call; the timer's waits are counted
+	// as wakeups, but their system calls are counted by the timer.
+	thread_data->syscalls = stepper.stats.wakeups + stepper.stats.yields;
+	if (thread_data->mode == MODE_TIMER) {
+		thread_data->syscalls += timer.syscalls - timer.waits;
+		nanotime_step_timer_close(&stepper, &timer);
+	}
+
+	return 0;
+}
+
+static int SDLCALL hog_thread_function(void* data) {
+	uint64_t* const work = (uint64_t*)data;
+
+	uint64_t count = 0;
+	while (!SDL_AtomicGet(&quit_now)) {
+		for (int i = 0; i < 1024; i++) {
+			count++;
+			SDL_CompilerBarrier();
+		}
+	}
+	*work = count;
+
+	return 0;
+}
+
+static int compare_uint64(const void* a, const void* b) {
+	const uint64_t value_a = *(const uint64_t*)a;
+	const uint64_t value_b = *(const uint64_t*)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+static bool run(const stepper_mode mode, const int num_threads, const double seconds) {
+	static stepper_thread_data stepper_data[MAX_THREADS];
+	static uint64_t hog_work[MAX_THREADS];
+	SDL_Thread* stepper_threads[MAX_THREADS];
+	SDL_Thread* hog_threads[MAX_THREADS];
+
+	const uint64_t max_steps = (uint64_t)(seconds * STEP_RATE) + 1;
+	for (int i = 0; i < num_threads; i++) {
+		stepper_data[i].mode = mode;
+		stepper_data[i].failed = false;
+		stepper_data[i].deviations = (uint64_t*)malloc(max_steps * sizeof(uint64_t));
+		stepper_data[i].max_steps = max_steps;
+		stepper_data[i].num_steps = 0;
+		hog_work[i] = 0;
+		if (!stepper_data[i].deviations) {
+			for (int j = 0; j < i; j++) {
+				free(stepper_data[j].deviations);
+			}
+			return false;
+		}
+	}
+
+	SDL_AtomicSet(&quit_now, 0);
+	int num_started = 0;
+	for (; num_started < num_threads; num_started++) {
+		stepper_threads[num_started] = SDL_CreateThread(stepper_thread_function, "stepper_thread", &stepper_data[num_started]);
+		hog_threads[num_started] = SDL_CreateThread(hog_thread_function, "hog_thread", &hog_work[num_started]);
+		if (!stepper_threads[num_started] || !hog_threads[num_started]) {
+			break;
+		}
+	}
+	if (num_started == num_threads) {
+		nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+	}
+	SDL_AtomicSet(&quit_now, 1);
+	for (int i = 0; i <= num_started && i < num_threads; i++) {
+		if (stepper_threads[i]) {
+			SDL_WaitThread(stepper_threads[i], NULL);
+		}
+		if (hog_threads[i]) {
+			SDL_WaitThread(hog_threads[i], NULL);
+		}
+	}
+	if (num_started < num_threads) {
+		for (int i = 0; i < num_threads; i++) {
+			free(stepper_data[i].deviations);
+		}
+		return false;
+	}
+
+	// All the steppers' deviations are pooled, for percentiles across all
+	// steppers.
+	uint64_t total_steps = 0;
+	for (int i = 0; i < num_threads; i++) {
+		total_steps += stepper_data[i].num_steps;
+	}
+	uint64_t* const deviations = (uint64_t*)malloc((total_steps > 0 ? total_steps : 1) * sizeof(uint64_t));
+	uint64_t num_deviations = 0;
+	uint64_t total_deviation = 0;
+	uint64_t total_work = 0;
+	uint64_t total_yields = 0;
+	uint64_t total_spin = 0;
+	uint64_t total_wakeups = 0;
+	uint64_t total_syscalls = 0;
+	bool failed = false;
+	for (int i = 0; i < num_threads; i++) {
+		for (uint64_t j = 0; deviations && j < stepper_data[i].num_steps; j++) {
+			deviations[num_deviations++] = stepper_data[i].deviations[j];
+			total_deviation += stepper_data[i].deviations[j];
+		}
+		total_work += hog_work[i];
+		total_yields += stepper_data[i].stats.yields;
+		total_spin += stepper_data[i].stats.spin_duration;
+		total_wakeups += stepper_data[i].stats.wakeups;
+		total_syscalls += stepper_data[i].syscalls;
+		failed = failed || stepper_data[i].failed;
+		free(stepper_data[i].deviations);
+	}
+	if (failed) {
+		printf("%-5s | not supported on this platform\n", mode_names[mode]);
+		free(deviations);
+		return true;
+	}
+	if (!deviations || num_deviations == 0) {
+		free(deviations);
+		return false;
+	}
+	qsort(deviations, num_deviations, sizeof(uint64_t), compare_uint64);
+
+	printf(
+		"%-5s | %8" PRIu64 " | %10.1f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " | %10.1f %10.1f %10.2f %10.2f | %12.3e\n",
+		mode_names[mode],
+		num_deviations,
+		(double)total_deviation / num_deviations,
+		deviations[(num_deviations - 1) / 2],
+		deviations[(num_deviations - 1) * 99 / 100],
+		deviations[num_deviations - 1],
+		(double)total_spin / num_deviations,
+		(double)total_yields / num_deviations,
+		(double)total_wakeups / num_deviations,
+		(double)total_syscalls / num_deviations,
+		(double)total_work / seconds
+	);
+	free(deviations);
+	return true;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 5.0;
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "%lf", &seconds) != 1 || seconds <= 0.0))) {
+		fprintf(stderr, "Usage: benchmark_nanotime_step [seconds]\n");
+		fprintf(stderr, "[seconds] is the duration to run each mode for, and must be greater than 0.0; the default is 5.0.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (SDL_Init(0) < 0) {
+		fprintf(stderr, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	int num_threads = SDL_GetCPUCount();
+	if (num_threads > MAX_THREADS) {
+		num_threads = MAX_THREADS;
+	}
+	printf("%d stepper threads at %.1f Hz and %d hog threads, %.3f seconds per mode\n", num_threads, STEP_RATE, num_threads, seconds);
+	printf("%-5s | %8s | %10s %10s %10s %10s | %10s %10s %10s %10s | %12s\n", "mode", "steps", "mean ns", "p50 ns", "p99 ns", "max ns", "spin/step", "yield/step", "wake/step", "sys/step", "hog work/s");
+
+	if (!run(MODE_SPIN, num_threads, seconds) || !run(MODE_YIELD, num_threads, seconds) || !run(MODE_TIMER, num_threads, seconds)) {
+		fprintf(stderr, "Failed to run the benchmark\n");
+		SDL_Quit();
+		return EXIT_FAILURE;
+	}
+
+	SDL_Quit();
+	return EXIT_SUCCESS;
+}
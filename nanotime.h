@@ -71,6 +71,14 @@
 	#error "Current C or C++ standard is unknown, the nanotime library requires stdint.h and stdbool.h to be available (C99 or higher, C++11 or higher, Visual Studio 2010 or higher)."
 #endif
 
+/*
+ * Included before extern "C", as liburing's headers define C++ templates when
+ * compiled as C++.
+ */
+#ifdef NANOTIME_IO_URING
+#include <liburing.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -86,10 +94,41 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <assert.h>
 
 #define NANOTIME_NSEC_PER_SEC UINT64_C(1000000000)
 
+/*
+ * The size of the caches' lines, that data written by different threads is
+ * kept apart by to avoid false sharing; can be defined before including
+ * nanotime.h to override it. Apple's ARM64 processors have 128-byte lines.
+ */
+#ifndef NANOTIME_CACHE_LINE_SIZE
+#if defined(__APPLE__) && (defined(__aarch64__) || defined(__arm64__))
+#define NANOTIME_CACHE_LINE_SIZE 128
+#else
+#define NANOTIME_CACHE_LINE_SIZE 64
+#endif
+#endif
+
+/*
+ * Aligns a type to the cache line size, padding its size to a multiple of it,
+ * so arrays and neighbors of it never share a cache line with it; place it
+ * between struct and the type's name. Has no effect with compilers lacking
+ * alignment support. Objects of aligned types must be allocated with aligned
+ * allocation functions, as malloc doesn't align to the cache line size.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define NANOTIME_CACHE_ALIGNED __attribute__((aligned(NANOTIME_CACHE_LINE_SIZE)))
+#elif defined(_MSC_VER)
+#define NANOTIME_CACHE_ALIGNED __declspec(align(NANOTIME_CACHE_LINE_SIZE))
+#elif defined(__cplusplus) && (__cplusplus >= 201103L)
+#define NANOTIME_CACHE_ALIGNED alignas(NANOTIME_CACHE_LINE_SIZE)
+#else
+#define NANOTIME_CACHE_ALIGNED
+#endif
+
 #ifndef NANOTIME_ONLY_STEP
 
 /*
@@ -111,18 +150,213 @@ uint64_t nanotime_now();
  */
 uint64_t nanotime_now_max();
 
+/*
+ * Returns the current time like nanotime_now, but guarded against the clock
+ * going backwards, by clamping to a process-wide high-water mark of the
+ * timestamps returned. Some virtual machines' clocks can go slightly backwards
+ * when threads migrate between cores, which nanotime_interval would otherwise
+ * see as a wraparound, producing a giant interval. Pass it to
+ * nanotime_step_init in place of nanotime_now to guard a stepper.
+ *
+ * Costs one atomic load and, when the time has advanced, as it nearly always
+ * has, one compare-and-swap over nanotime_now. Called from one thread, that's
+ * about 10 nanoseconds more than nanotime_now on x86-64 Linux. But the mark is
+ * shared by the whole process, so when threads on several cores call it at
+ * once, each call also moves the mark's cache line between the cores, and
+ * compare-and-swaps losing to other cores retry; that cost grows with the
+ * count of calling cores, making it a poor fit for timestamping on many
+ * threads at high rates. test_nanotime_monotonic measures both costs on the
+ * host.
+ */
+uint64_t nanotime_now_monotonic();
+
+/*
+ * Returns the count of regressions nanotime_now_monotonic has clamped so far.
+ */
+uint64_t nanotime_now_monotonic_regressions();
+
 /*
  * Sleeps the current thread for the requested count of nanoseconds. The slept
  * duration may be less than, equal to, or greater than the time requested.
  */
 void nanotime_sleep(uint64_t nsec_count);
 
+/*
+ * Releases what nanotime_sleep keeps for the calling thread, which is the
+ * thread's cached high-resolution waitable timer on Windows, and nothing on
+ * other platforms. It's released when the thread exits anyways, so this is
+ * only needed by threads that are done sleeping but keep running. The
+ * thread's next nanotime_sleep creates a new timer.
+ */
+void nanotime_sleep_cleanup();
+
+/*
+ * Releases what nanotime_sleep keeps for every thread, and stops it keeping
+ * anything more, so later sleeps create a timer each. On Windows, the threads'
+ * timers are released at their exits by a callback in the code that
+ * implements nanotime_sleep, so a DLL implementing it must call this before
+ * being unloaded, such as on DLL_PROCESS_DETACH, else threads that slept call
+ * into the unloaded DLL as they exit. No thread may be sleeping in
+ * nanotime_sleep during the call. Does nothing on other platforms.
+ */
+void nanotime_sleep_shutdown();
+
+/*
+ * A cached timer, for sleeping with timers that are costly to create and close,
+ * reusing one timer for every sleep; nanotime_sleep on Windows keeps one per
+ * thread, making each sleep two kernel calls rather than four plus a handle
+ * allocation. The timer operations are function pointers, so the caching can
+ * be tested with fake timers on any platform. create returns a new timer, or
+ * NULL on failure; wait sleeps on the timer for nsec_count nanoseconds,
+ * returning false on failure; and close closes the timer.
+ */
+typedef struct nanotime_timer_cache {
+	void* user;
+	void* (* create)(void* user);
+	bool (* wait)(void* user, void* timer, uint64_t nsec_count);
+	void (* close)(void* user, void* timer);
+
+	void* timer;
+	uint64_t creates;
+} nanotime_timer_cache;
+
+/*
+ * Initializes the cache with no timer, to be created by the first sleep.
+ */
+void nanotime_timer_cache_init(
+	nanotime_timer_cache* const cache,
+	void* const user,
+	void* (* const create)(void* user),
+	bool (* const wait)(void* user, void* timer, uint64_t nsec_count),
+	void (* const close)(void* user, void* timer)
+);
+
+/*
+ * Sleeps for nsec_count nanoseconds on the cached timer, creating it if there
+ * isn't one. A timer that fails to wait, such as one whose handle was closed
+ * from under the cache, is closed and replaced by a new timer once. Returns
+ * false without having slept if no timer could be created or waited on.
+ */
+bool nanotime_timer_cache_sleep(nanotime_timer_cache* const cache, const uint64_t nsec_count);
+
+/*
+ * Closes the cached timer, if there is one.
+ */
+void nanotime_timer_cache_close(nanotime_timer_cache* const cache);
+
 /*
  * Yield the CPU/core that called nanotime_yield to the operating system for a
  * small time slice.
  */
 void nanotime_yield();
 
+/*
+ * Returns a timestamp from a cheaper, lower-resolution clock than the one used
+ * by nanotime_now, where the platform provides one; otherwise, this is the same
+ * as nanotime_now. The timestamps are not necessarily of the same epoch as
+ * nanotime_now's, so they can only be compared with other coarse timestamps,
+ * and the maximum timestamp value is that of nanotime_now_max.
+ *
+ * On Linux, this is CLOCK_MONOTONIC_COARSE, which is updated once per kernel
+ * timer tick, and is typically around ten times cheaper to read than
+ * nanotime_now. Timestamps are behind the true time by up to the resolution
+ * returned by nanotime_now_coarse_resolution, commonly 1 to 4 milliseconds.
+ */
+uint64_t nanotime_now_coarse();
+
+/*
+ * Returns the resolution of nanotime_now_coarse in nanoseconds, the maximum
+ * error of its timestamps.
+ */
+uint64_t nanotime_now_coarse_resolution();
+
+/*
+ * A stamp epoch is for timestamping bursts of events at a fraction of the cost
+ * of nanotime_now, by reading nanotime_now once at the start of each burst,
+ * then only reading the CPU's cycle counter (x86 TSC or ARM64 virtual counter)
+ * per event, converted to nanoseconds with a calibrated scale. Stamps are on the
+ * same timeline as nanotime_now.
+ *
+ * A stamp's error is the sum of:
+ * - The error of reading nanotime_now and the counter together at
+ *   nanotime_stamp_epoch_begin, which is about half the time of one
+ *   nanotime_now call.
+ * - The scale's relative error times the time since
+ *   nanotime_stamp_epoch_begin. The scale is calibrated over the time since
+ *   nanotime_stamp_epoch_init, so its error shrinks as the epoch object ages;
+ *   right after init, it's roughly 1e-4 (100 ns per millisecond of burst), and
+ *   after a second, roughly 1e-7.
+ *
+ * So, calling nanotime_stamp_epoch_begin once per burst, or once every few
+ * milliseconds during continuous stamping, keeps the error close to that of
+ * nanotime_now. Cycle counters are assumed invariant and synchronized across
+ * cores, as they are on current x86 and ARM64 hardware; stamps are clamped to
+ * never precede the epoch's start. On platforms without a supported counter,
+ * nanotime_stamp just calls nanotime_now.
+ */
+typedef struct nanotime_stamp_epoch {
+	uint64_t now_max;
+	uint64_t start;
+	uint64_t start_ticks;
+	uint64_t tick_scale;
+	uint64_t calibration_start;
+	uint64_t calibration_start_ticks;
+} nanotime_stamp_epoch;
+
+/*
+ * Initializes a stamp epoch object, calibrating the counter scale, which
+ * sleeps for about a millisecond; also begins the first burst.
+ */
+void nanotime_stamp_epoch_init(nanotime_stamp_epoch* const epoch);
+
+/*
+ * Begins a burst of stamps, by reading nanotime_now and the counter together;
+ * also refines the counter scale calibration.
+ */
+void nanotime_stamp_epoch_begin(nanotime_stamp_epoch* const epoch);
+
+/*
+ * Returns a timestamp for the current time, interpolated from the epoch's
+ * start with the cycle counter.
+ */
+uint64_t nanotime_stamp(const nanotime_stamp_epoch* const epoch);
+
+/*
+ * A sleep primitive the platform provides, usable as a sleep function for the
+ * stepper. Some primitives, like sched_yield, ignore the requested duration.
+ */
+typedef struct nanotime_sleep_primitive {
+	const char* name;
+	void (* sleep)(uint64_t nsec_count);
+} nanotime_sleep_primitive;
+
+/*
+ * Sets *primitives to the table of sleep primitives available on the current
+ * platform, returning the count of them. nanotime_sleep is always first.
+ */
+size_t nanotime_sleep_primitives(const nanotime_sleep_primitive** const primitives);
+
+/*
+ * The sleep primitives chosen by nanotime_sleep_select for the coarse (1ms
+ * requests) and fine (short and zero-duration requests) phases of stepping,
+ * along with the mean absolute error measured for each in nanoseconds.
+ */
+typedef struct nanotime_sleep_selection {
+	const nanotime_sleep_primitive* coarse;
+	const nanotime_sleep_primitive* fine;
+	uint64_t coarse_error;
+	uint64_t fine_error;
+} nanotime_sleep_selection;
+
+/*
+ * Microbenchmarks the available sleep primitives for about benchmark_duration
+ * nanoseconds, choosing the ones with the lowest mean error for each phase of
+ * stepping. Overshoot profiles differ widely between kernels and kernel
+ * configurations, so it's best to select at runtime on each host. A few tens
+ * of milliseconds is enough to produce a good selection.
+ */
+void nanotime_sleep_select(nanotime_sleep_selection* const selection, const uint64_t benchmark_duration);
+
 #endif
 
 /*
@@ -134,15 +368,269 @@ void nanotime_yield();
  */
 uint64_t nanotime_interval(const uint64_t start, const uint64_t end, const uint64_t max);
 
+/*
+ * An extended timeline turns timestamps that wrap around at some maximum value
+ * into a count of nanoseconds since the timeline's start, that won't wrap
+ * around for over 500 years. Intervals between extended times are just
+ * "end - start", no matter how many times the underlying timestamps wrapped
+ * around in between.
+ *
+ * A timestamp can only be placed on the timeline correctly if it's no more
+ * than max nanoseconds after the previous one extended, as there's no way to
+ * tell apart timestamps a whole wrap period apart. So, extend a timestamp at
+ * least once per wrap period (nanotime_now_max() nanoseconds), such as once per
+ * step in a stepper loop.
+ */
+typedef struct nanotime_timeline {
+	uint64_t max;
+	uint64_t last;
+	uint64_t elapsed;
+	uint64_t wraps;
+} nanotime_timeline;
+
+/*
+ * Initializes the timeline, with start at extended time zero.
+ */
+void nanotime_timeline_init(nanotime_timeline* const timeline, const uint64_t start, const uint64_t max);
+
+/*
+ * Returns the extended time of timestamp, which must be no earlier than the
+ * previous timestamp extended, and no more than max nanoseconds after it.
+ */
+uint64_t nanotime_timeline_extend(nanotime_timeline* const timeline, const uint64_t timestamp);
+
+/*
+ * Batch versions of nanotime_interval, for analysing large arrays of
+ * timestamps, such as logged nanotime_now values. They're vectorized with AVX2
+ * only when compiled with AVX2 enabled, such as with -mavx2 or /arch:AVX2, or
+ * for AArch64 NEON, and use portable code otherwise, including in default x86
+ * builds; define NANOTIME_NO_SIMD to always use the portable code. Measured
+ * against calling nanotime_interval in a loop, the AVX2 code was about 1.3 to
+ * 1.8 times as fast, and the portable code 1.1 to 1.7 times. Unlike
+ * nanotime_interval, the timestamps aren't checked against max.
+ */
+
+/*
+ * Stores the intervals between each pair of adjacent timestamps, wrapping
+ * around past max like nanotime_interval, so intervals[i] is the interval from
+ * timestamps[i] to timestamps[i + 1]; intervals must have room for count - 1
+ * values. Nothing is stored if count is less than two.
+ */
+void nanotime_intervals(const uint64_t* const timestamps, const size_t count, const uint64_t max, uint64_t* const intervals);
+
+/*
+ * Summary statistics of an array of intervals; variance is the population
+ * variance, in square nanoseconds.
+ */
+typedef struct nanotime_interval_stats {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	double mean;
+	double variance;
+} nanotime_interval_stats;
+
+/*
+ * Calculates the statistics of count intervals; with no intervals, all the
+ * statistics are zero.
+ */
+void nanotime_intervals_stats(const uint64_t* const intervals, const size_t count, nanotime_interval_stats* const stats);
+
+/*
+ * Adds count intervals to a histogram of num_buckets buckets of bucket_width
+ * nanoseconds each, starting at zero, with intervals beyond the last bucket
+ * counted in the last bucket. The buckets aren't cleared first, so a histogram
+ * can be built up over several batches. Bucket widths that are powers of two
+ * are fastest.
+ */
+void nanotime_intervals_histogram(const uint64_t* const intervals, const size_t count, const uint64_t bucket_width, uint64_t* const buckets, const size_t num_buckets);
+
+/*
+ * How a stepper catches up when it falls behind, by one or more steps' worth of
+ * time, as happens when an update runs long; see nanotime_step_set_catch_up.
+ */
+typedef enum nanotime_step_catch_up {
+	/*
+	 * Catch up by skipping sleeps, but when behind by the reset threshold
+	 * of sleep_duration + NANOTIME_NSEC_PER_SEC / 10 or more, restart the
+	 * timeline from the current time, dropping the backlog. The default.
+	 */
+	NANOTIME_STEP_CATCH_UP_RESET,
+
+	/*
+	 * Catch up by skipping the sleeps of at most limit consecutive steps,
+	 * dropping any steps owed beyond that.
+	 */
+	NANOTIME_STEP_CATCH_UP_BURST,
+
+	/*
+	 * Catch up by shortening the sleeps of the next limit steps, rather
+	 * than skipping sleeps, dropping any steps owed beyond limit.
+	 */
+	NANOTIME_STEP_CATCH_UP_SPREAD,
+
+	/* Never catch up, dropping all steps owed. */
+	NANOTIME_STEP_CATCH_UP_DROP
+} nanotime_step_catch_up;
+
+/*
+ * Running statistics of a stepper, updated by every nanotime_step call. All
+ * durations are in nanoseconds, and all values are totals since the stepper
+ * was initialized, except where noted otherwise.
+ */
+typedef struct nanotime_step_stats {
+	/* Count of nanotime_step calls. */
+	uint64_t steps;
+
+	/* Count of steps that skipped sleeping, to catch up. */
+	uint64_t skips;
+
+	/* Count of steps that reset the stepper, having fallen too far behind. */
+	uint64_t resets;
+
+	/* Count of sleep requests made, each being a potential thread wakeup. */
+	uint64_t wakeups;
+
+	/* Total time elapsed between step deadlines, i.e., the timeline time. */
+	uint64_t elapsed_duration;
+
+	/* Total time spent in the final busyloop of steps. */
+	uint64_t spin_duration;
+
+	/* Count of yields made in the final busyloop of steps. */
+	uint64_t yields;
+
+	/* How far past its deadline the latest sleeping step ended. */
+	uint64_t deviation;
+
+	/*
+	 * Count of steps given up on by the catch-up policy, that will never be
+	 * run; see nanotime_step_set_catch_up.
+	 */
+	uint64_t dropped_ticks;
+
+	/*
+	 * Count of steps the stepper is currently behind by, as of the latest
+	 * step, that it's yet to catch up on.
+	 */
+	uint64_t owed_ticks;
+
+	/* Count of timestamp function calls, including during initialization. */
+	uint64_t clock_reads;
+
+	/*
+	 * Count of timestamp function calls made by the latest step; a step
+	 * that starts past or very near its deadline only makes one.
+	 */
+	uint64_t step_clock_reads;
+
+	/*
+	 * Count of CPU quota periods the stepper's control group was throttled
+	 * in; see nanotime_step_set_cpu_quota.
+	 */
+	uint64_t throttle_events;
+} nanotime_step_stats;
+
+/*
+ * The stepper's fields are in two parts: the configuration, only written by
+ * initialization and the setters, then the state written while stepping,
+ * including the tuning that steps and their polls adjust. Each
+ * part is kept a cache line apart from the other and from neighboring objects,
+ * even when the stepper isn't aligned, such as when allocated with malloc, so
+ * threads reading a stepper's configuration or neighbors don't have their
+ * cache lines invalidated by its steps.
+ */
 typedef struct nanotime_step_data {
 	uint64_t sleep_duration;
 	uint64_t now_max;
 	uint64_t (* now)();
 	void (* sleep)(uint64_t nsec_count);
+	void (* fine_sleep)(uint64_t nsec_count);
+	void (* yield)();
+
+	/*
+	 * Context-carrying alternatives to the above, that are passed user as
+	 * their first argument, used when the above are NULL; see
+	 * nanotime_step_init_user.
+	 */
+	void* user;
+	uint64_t (* now_user)(void* user);
+	void (* sleep_user)(void* user, uint64_t nsec_count);
+	void (* fine_sleep_user)(void* user, uint64_t nsec_count);
+	void (* yield_user)(void* user);
+
+	/*
+	 * When nonzero, the stepper tunes its accurate-sleep algorithm itself;
+	 * see nanotime_step_set_adaptive.
+	 */
+	uint64_t jitter_target;
+
+	/* The catch-up policy; see nanotime_step_set_catch_up. */
+	nanotime_step_catch_up catch_up;
+	uint64_t catch_up_limit;
+
+	/*
+	 * Called with the stepper every poll_interval nanoseconds of the
+	 * stepper's timeline, if not NULL, to update the stepper's tuning from
+	 * outside state; see nanotime_step_set_cpu_quota.
+	 */
+	void (* poll)(struct nanotime_step_data* stepper);
+	void* poll_user;
+	uint64_t poll_interval;
+
+	/*
+	 * If not NULL, called by steps with more than a coarse sleep's worth of
+	 * time left, with the step's deadline, to do the coarse part of the
+	 * sleep in a single blocking wait, such as on a periodic timer; the
+	 * sleeping phases then finish the step from wherever it returns. See
+	 * nanotime_step_set_timer.
+	 */
+	void (* coarse_wait)(struct nanotime_step_data* stepper, uint64_t deadline);
+	void* coarse_wait_user;
+
+	/*
+	 * The stepper's entry in the registry, if registered; see
+	 * nanotime_step_register.
+	 */
+	struct nanotime_step_registration* registration;
+
+	unsigned char configuration_padding[NANOTIME_CACHE_LINE_SIZE];
 
 	uint64_t zero_sleep_duration;
+	uint64_t yield_duration;
 	uint64_t accumulator;
 	uint64_t sleep_point;
+
+	/*
+	 * Tuning of the accurate-sleep algorithm. nanotime_step_init sets
+	 * these to the defaults, that favor precision; when jitter_target is
+	 * nonzero, the stepper adjusts them itself.
+	 */
+	uint64_t coarse_duration;
+	uint64_t shift;
+	bool zero_sleeps;
+	uint64_t adapt_steps;
+	uint64_t adapt_deviation;
+
+	/*
+	 * The time owed that's yet to be spread over the following steps, in
+	 * slices of spread_slice for NANOTIME_STEP_CATCH_UP_SPREAD.
+	 */
+	uint64_t spread_debt;
+	uint64_t spread_slice;
+
+	/*
+	 * The most time the final busyloop of a step may spin for; beyond it,
+	 * the rest of the step is slept instead. Unlimited by default, and
+	 * lowered by CPU quota polls; see nanotime_step_set_cpu_quota.
+	 */
+	uint64_t spin_budget;
+
+	uint64_t poll_elapsed;
+
+	nanotime_step_stats stats;
+
+	unsigned char state_padding[NANOTIME_CACHE_LINE_SIZE];
 } nanotime_step_data;
 
 /*
@@ -157,6 +645,213 @@ void nanotime_step_init(
 	void (* const sleep)(uint64_t nsec_count)
 );
 
+/*
+ * Initializes the stepper like nanotime_step_init, but with timestamp and sleep
+ * functions that are passed user as their first argument, so simulated or
+ * otherwise stateful clocks don't need global state.
+ */
+void nanotime_step_init_user(
+	nanotime_step_data* const stepper,
+	const uint64_t sleep_duration,
+	const uint64_t now_max,
+	void* const user,
+	uint64_t (* const now)(void* user),
+	void (* const sleep)(void* user, uint64_t nsec_count)
+);
+
+/*
+ * Switches the stepper into adaptive mode, where a step may end up to
+ * jitter_target nanoseconds past its deadline. In exchange, the stepper uses
+ * as few wakeups and as little spinning as it can while staying within that
+ * bound, retuning the coarse sleep duration, the shift divisor, and the use of
+ * zero-duration sleeps from the deviations it observes. Pass zero to return
+ * to the default, precision-first behavior. Call after nanotime_step_init.
+ */
+void nanotime_step_set_adaptive(nanotime_step_data* const stepper, const uint64_t jitter_target);
+
+/*
+ * Sets the stepper's catch-up policy, with limit being the maximum count of
+ * steps caught up on for the burst and spread policies, and ignored otherwise.
+ * Steps given up on are counted in the stepper's stats.dropped_ticks. Call
+ * after nanotime_step_init.
+ */
+void nanotime_step_set_catch_up(nanotime_step_data* const stepper, const nanotime_step_catch_up catch_up, const uint64_t limit);
+
+/*
+ * Sets a yield function, such as nanotime_yield, for the stepper to call in its
+ * final busyloop while more time remains than a yield takes, only spinning
+ * without yielding the rest of the way; the time a yield takes is measured and
+ * tracked like that of zero-duration sleeps. Yielding lets other threads run
+ * on oversubscribed hosts, where spinning would starve them. Pass NULL to
+ * return to the default of only spinning. nanotime_step_set_yield_user is the
+ * same, for steppers initialized with nanotime_step_init_user. Call after
+ * initialization.
+ */
+void nanotime_step_set_yield(nanotime_step_data* const stepper, void (* const yield)());
+void nanotime_step_set_yield_user(nanotime_step_data* const stepper, void (* const yield)(void* user));
+
+/*
+ * Sets the sleep function used for the fine phases of stepping, i.e., the short
+ * and zero-duration sleeps near the deadline, leaving the one passed to
+ * nanotime_step_init for the coarse phase. By default, both are the same.
+ * Call after nanotime_step_init.
+ */
+void nanotime_step_set_fine_sleep(nanotime_step_data* const stepper, void (* const fine_sleep)(uint64_t nsec_count));
+
+#ifndef NANOTIME_ONLY_STEP
+/*
+ * Initializes the stepper like nanotime_step_init with nanotime_now, but with
+ * sleep primitives chosen by nanotime_sleep_select. If selection isn't NULL,
+ * the choice is stored there.
+ */
+void nanotime_step_init_auto(
+	nanotime_step_data* const stepper,
+	const uint64_t sleep_duration,
+	const uint64_t benchmark_duration,
+	nanotime_sleep_selection* const selection
+);
+
+/*
+ * CPU quota and throttling counters of a Linux cgroup v2 control group, read
+ * from its cpu.max and cpu.stat files. Times are in microseconds, as in the
+ * files; quota is zero when the group's CPU usage is unlimited.
+ */
+typedef struct nanotime_cpu_quota {
+	const char* directory;
+	uint64_t quota;
+	uint64_t period;
+	uint64_t usage;
+	uint64_t periods;
+	uint64_t throttled_periods;
+	uint64_t throttled_duration;
+} nanotime_cpu_quota;
+
+/*
+ * Reads the quota and counters of the control group in directory, which must
+ * remain valid while quota is in use; if directory is NULL, the current
+ * process's group mounted at /sys/fs/cgroup, as in containers, is used. Returns
+ * false if the quota couldn't be read, such as on platforms other than Linux.
+ */
+bool nanotime_cpu_quota_read(nanotime_cpu_quota* const quota, const char* const directory);
+
+/*
+ * Makes the stepper aware of the CPU quota of the control group in directory,
+ * rereading it and its throttling counters every poll_interval nanoseconds of
+ * the stepper's timeline. When a quota is set, the stepper's spin_budget is
+ * limited to a share of the quota per step, so the final busyloop doesn't use
+ * up the quota and get the thread throttled for the rest of the quota period,
+ * and sleeps instead of spinning beyond that; when throttling happens anyway,
+ * the budget is halved, and it recovers while no throttling is seen. Throttling
+ * is counted in stats.throttle_events. quota is used as storage by the stepper,
+ * and must remain valid while the stepper is in use. Returns false if the quota
+ * couldn't be read, leaving the stepper unchanged. Call after initialization.
+ */
+bool nanotime_step_set_cpu_quota(
+	nanotime_step_data* const stepper,
+	nanotime_cpu_quota* const quota,
+	const char* const directory,
+	const uint64_t poll_interval
+);
+
+/*
+ * A kernel interval timer for a stepper's coarse waits, armed with the step
+ * period and phase-aligned to the stepper's deadlines, lead nanoseconds early,
+ * so each step's coarse wait is a single blocking system call, rather than a
+ * sleep requested anew per coarse sleep; the stepper's finer sleeping phases
+ * finish each step. Only supported on Linux, with timerfd.
+ */
+typedef struct nanotime_step_timer {
+	int fd;
+	uint64_t lead;
+	uint64_t period;
+	uint64_t first_expiration;
+	uint64_t expirations;
+	bool armed;
+
+	/* Count of coarse waits made, and of system calls they made. */
+	uint64_t waits;
+	uint64_t syscalls;
+} nanotime_step_timer;
+
+/*
+ * Makes the stepper do its coarse waits on the timer; the stepper must use
+ * nanotime_now for its timestamps. The timer is armed on the first step, and
+ * rearmed when the stepper's timeline restarts or its sleep duration changes,
+ * and once a second, to correct any drift between the timer's clock and
+ * nanotime_now's. Returns false, leaving the stepper unchanged, if the timer
+ * couldn't be created, such as on platforms other than Linux.
+ */
+bool nanotime_step_set_timer(nanotime_step_data* const stepper, nanotime_step_timer* const timer, const uint64_t lead);
+
+/*
+ * Stops the stepper using the timer, and frees the timer's resources.
+ */
+void nanotime_step_timer_close(nanotime_step_data* const stepper, nanotime_step_timer* const timer);
+
+#ifdef NANOTIME_IO_URING
+/*
+ * What a nanotime_step_ring_wait returned for: a step finished, having slept or
+ * been skipped, as with nanotime_step's return value, or a completion of other
+ * I/O on the ring arrived before the step's deadline.
+ */
+typedef enum nanotime_step_ring_event {
+	NANOTIME_STEP_RING_TICK,
+	NANOTIME_STEP_RING_SKIP,
+	NANOTIME_STEP_RING_IO
+} nanotime_step_ring_event;
+
+/*
+ * Steps a stepper on the caller's io_uring, for threads that drive their I/O
+ * with the ring, where a blocking sleep would hold up the I/O's completions.
+ * Each step's sleep is submitted as an IORING_OP_TIMEOUT with an absolute
+ * timestamp, lead nanoseconds before the deadline, and the rest of the step is
+ * spun; the timeout completions are tagged with user_data, which must differ
+ * from that of any other submissions to the ring. Only available when
+ * NANOTIME_IO_URING is defined before including nanotime.h, on Linux, with
+ * liburing.
+ */
+typedef struct nanotime_step_ring {
+	struct io_uring* ring;
+	uint64_t user_data;
+	uint64_t lead;
+	struct __kernel_timespec timeout;
+	uint64_t clock_reads;
+	uint64_t start_point;
+	bool stepping;
+	bool pending;
+	bool fallback;
+
+	/* Count of timeouts submitted, and of other completions returned. */
+	uint64_t timeouts;
+	uint64_t completions;
+} nanotime_step_ring;
+
+/*
+ * Initializes the ring stepping object for the io_uring, which must remain
+ * valid while the object is in use.
+ */
+void nanotime_step_ring_init(nanotime_step_ring* const ring, struct io_uring* const io_uring, const uint64_t user_data, const uint64_t lead);
+
+/*
+ * Does one step of sleeping for the stepper, as nanotime_step does, but waiting
+ * on the ring. When a completion for other I/O arrives first, returns
+ * NANOTIME_STEP_RING_IO with it in cqe, to be handled and marked seen by the
+ * caller, which calls again to resume the step where it left off; a step in
+ * progress must be resumed before the stepper or ring is used otherwise. The
+ * stepper must use nanotime_now for its timestamps. Should a timeout be
+ * unavailable, the step sleeps as nanotime_step would.
+ */
+nanotime_step_ring_event nanotime_step_ring_wait(nanotime_step_data* const stepper, nanotime_step_ring* const ring, struct io_uring_cqe** const cqe);
+
+/*
+ * For callers that reap completions of the ring themselves: returns true if
+ * the completion is one of the ring stepping object's timeouts, marking it
+ * complete, otherwise false. The caller still marks it seen.
+ */
+bool nanotime_step_ring_complete(nanotime_step_ring* const ring, const struct io_uring_cqe* const cqe);
+#endif
+#endif
+
 /*
  * Does one step of sleeping for a fixed timestep logic update cycle. It makes
  * a best-attempt at a precise delay per iteration, but might skip a cycle of
@@ -166,52 +861,663 @@ void nanotime_step_init(
  */
 bool nanotime_step(nanotime_step_data* const stepper);
 
-#if !defined(NANOTIME_ONLY_STEP) && defined(NANOTIME_IMPLEMENTATION)
-
 /*
- * Non-portable, platform-specific implementations are first. If none of them
- * match the current platform, the standard C/C++ versions are used as a last
- * resort.
+ * Average sleep requests made per second of the stepper's timeline, from the
+ * stepper's statistics. Useful for estimating the power cost of a stepper.
  */
+double nanotime_step_wakeups_per_second(const nanotime_step_stats* const stats);
 
 /*
- * Checking _WIN32 must be above the UNIX-like implementations, so MinGW is
- * guaranteed to use it.
+ * Average nanoseconds spent busylooping per step, from the stepper's
+ * statistics.
  */
-#ifdef _WIN32
+double nanotime_step_spin_per_step(const nanotime_step_stats* const stats);
 
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#ifndef NOMINMAX
-#define NOMINMAX
+/*
+ * The most steppers that can be registered at once. Define it before including
+ * nanotime.h with NANOTIME_IMPLEMENTATION to change it.
+ */
+#ifndef NANOTIME_STEP_REGISTRY_SIZE
+#define NANOTIME_STEP_REGISTRY_SIZE 64
 #endif
-#include <Windows.h>
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-uint64_t nanotime_now() {
-	static uint64_t scale = UINT64_C(0);
-	static bool multiply;
-	if (scale == 0u) {
-		LARGE_INTEGER frequency;
-		QueryPerformanceFrequency(&frequency);
-		if (frequency.QuadPart < NANOTIME_NSEC_PER_SEC) {
-			scale = NANOTIME_NSEC_PER_SEC / frequency.QuadPart;
-			multiply = true;
-		}
-		else {
-			scale = frequency.QuadPart / NANOTIME_NSEC_PER_SEC;
-			multiply = false;
-		}
+#define NANOTIME_STEP_NAME_SIZE 32
+
+/*
+ * The count of buckets of step deviations in reports; their upper bounds run
+ * 1, 2, 5, 10, 20, 50... microseconds up to one second, then the last bucket
+ * has no bound. See nanotime_step_deviation_bound.
+ */
+#define NANOTIME_STEP_DEVIATION_BUCKETS 20
+
+/*
+ * A registered stepper's timing health, as returned by
+ * nanotime_step_registry_query. Counts and durations are totals since the
+ * stepper was initialized, except the deviation statistics, which are of the
+ * sleeping steps since it was registered. All durations are in nanoseconds.
+ */
+typedef struct nanotime_step_report {
+	char name[NANOTIME_STEP_NAME_SIZE];
+
+	/* The step duration, and the matching rate in steps per second. */
+	uint64_t sleep_duration;
+	double rate;
+
+	/* How far past its deadline the latest sleeping step ended. */
+	uint64_t deviation;
+
+	/*
+	 * The 99th percentile of deviations, estimated by interpolating within
+	 * the histogram's buckets, and the greatest deviation.
+	 */
+	uint64_t p99_deviation;
+	uint64_t max_deviation;
+
+	uint64_t steps;
+	uint64_t skips;
+	uint64_t resets;
+	uint64_t wakeups;
+
+	/* Total time spent busylooping, i.e., the CPU time spent spinning. */
+	uint64_t spin_duration;
+
+	/*
+	 * The time accumulated toward the next step as of the latest step; more
+	 * than the step duration means the stepper is behind.
+	 */
+	uint64_t accumulator;
+
+	/*
+	 * A histogram of deviations, with the count and sum of the deviations;
+	 * deviations[i] counts the deviations greater than the previous
+	 * bucket's bound and at most nanotime_step_deviation_bound(i).
+	 */
+	uint64_t deviation_count;
+	uint64_t deviation_sum;
+	uint64_t deviations[NANOTIME_STEP_DEVIATION_BUCKETS];
+} nanotime_step_report;
+
+/*
+ * Returns the upper bound of the deviation histogram's bucket, in
+ * nanoseconds; the last bucket's is UINT64_MAX.
+ */
+uint64_t nanotime_step_deviation_bound(const size_t bucket);
+
+/*
+ * Registers the stepper under name, which is truncated to fit
+ * NANOTIME_STEP_NAME_SIZE, for nanotime_step_registry_query to report on; its
+ * steps then update its entry. Call it from the stepper's thread, then
+ * nanotime_step_unregister before reinitializing the stepper or letting it go
+ * out of scope. Returns false if the registry is full. Registering is opt-in,
+ * and costs each step a few atomic stores, one fence and a small histogram
+ * update.
+ */
+bool nanotime_step_register(nanotime_step_data* const stepper, const char* const name);
+
+/*
+ * Removes the stepper from the registry, if registered.
+ */
+void nanotime_step_unregister(nanotime_step_data* const stepper);
+
+/*
+ * Copies the reports of up to max_reports registered steppers into reports,
+ * returning the count copied. It can be called from any thread, and never
+ * waits on or stops the steppers: a stepper whose entry changes during every
+ * one of a few attempts at copying it, which needs it to step as many times
+ * during the query, is left out of that query.
+ */
+size_t nanotime_step_registry_query(nanotime_step_report* const reports, const size_t max_reports);
+
+/*
+ * Renders the reports, such as those from nanotime_step_registry_query, in the
+ * OpenMetrics text format for metrics scrapers like Prometheus, with each
+ * stepper's samples labeled stepper="name": a histogram of deviations,
+ * counters of steps, skips, resets, wakeups and time spent spinning, and
+ * gauges of the accumulator and step duration, all durations in seconds.
+ * Writes at most size bytes into buffer, the last being a terminating null
+ * character, without allocating, and returns the length of the whole text; as
+ * with snprintf, a length of size or more means the text was truncated.
+ */
+size_t nanotime_step_openmetrics(const nanotime_step_report* const reports, const size_t count, char* const buffer, const size_t size);
+
+/*
+ * The outcome of a nanotime_wait_until: how late past the deadline the wait
+ * finished, and what it took to get there.
+ */
+typedef struct nanotime_wait_result {
+	uint64_t deviation;
+	uint64_t spin_duration;
+	uint64_t wakeups;
+	uint64_t yields;
+} nanotime_wait_result;
+
+/*
+ * Waits until the deadline, a timestamp of the stepper's clock, with the same
+ * precise sleeping as nanotime_step, but without any effect on the stepper's
+ * timeline, for irregular deadlines. The stepper's sleep calibration is shared
+ * with its steps, and updated by the wait, as are its adaptive tuning and
+ * stats. Returns false without waiting if the deadline has already passed,
+ * with the deviation set to how far past it is; result can be NULL.
+ */
+bool nanotime_wait_until(nanotime_step_data* const stepper, const uint64_t deadline, nanotime_wait_result* const result);
+
+#ifndef NANOTIME_ONLY_STEP
+/*
+ * Sleeps for the duration as precisely as nanotime_step, using a stepper of the
+ * calling thread, initialized on first use, for the sleep calibration; returns
+ * how late past the duration the sleep finished. nanotime_sleep is better for
+ * long, imprecise sleeps, as it doesn't spin.
+ */
+uint64_t nanotime_precise_sleep(const uint64_t nsec_count);
+
+/*
+ * The stepper used by nanotime_precise_sleep on the calling thread, for tuning
+ * it, such as with nanotime_step_set_yield, or reading its stats. Returns NULL
+ * when the compiler has no thread-local storage, where each
+ * nanotime_precise_sleep uses a new stepper instead, so check for NULL before
+ * passing it to the setters.
+ */
+nanotime_step_data* nanotime_precise_sleep_stepper();
+#endif
+
+/*
+ * A measurement of one real sleep, for replaying recorded sleep behavior with
+ * the virtual clock; slept can be less than requested, as some sleep functions
+ * return early.
+ */
+typedef struct nanotime_sleep_sample {
+	uint64_t requested;
+	uint64_t slept;
+} nanotime_sleep_sample;
+
+/*
+ * A deterministic virtual clock, for simulating steppers without waiting on
+ * real time; pass it to nanotime_step_init_user with nanotime_virtual_now and
+ * nanotime_virtual_sleep. Time only advances when the clock is read (by
+ * read_cost, modelling the cost of a real clock read, which also lets
+ * busyloops terminate), when sleeping, and with nanotime_virtual_advance, to
+ * model work done between steps.
+ *
+ * A sleep advances time by the requested duration plus an overshoot. If
+ * samples isn't NULL, the overshoot is that of a sample drawn from those with
+ * the requested duration nearest to the sleep's; otherwise, if overshoots
+ * isn't NULL, it's drawn from the recorded overshoots; otherwise, it's drawn
+ * uniformly from [overshoot_min, overshoot_max]. Without samples, zero-duration
+ * sleeps have their own uniform range, as they're typically much cheaper than
+ * sleeps with nonzero duration. Draws come from a seeded pseudorandom
+ * generator, so simulations are reproducible.
+ *
+ * Time wraps around past now_max, like a real clock would.
+ */
+typedef struct nanotime_virtual_clock {
+	uint64_t now;
+	uint64_t now_max;
+	uint64_t read_cost;
+	uint64_t overshoot_min;
+	uint64_t overshoot_max;
+	uint64_t zero_sleep_min;
+	uint64_t zero_sleep_max;
+	uint64_t yield_cost;
+	const uint64_t* overshoots;
+	size_t overshoots_count;
+
+	/* Must be sorted by requested duration, in ascending order. */
+	const nanotime_sleep_sample* samples;
+	size_t samples_count;
+
+	uint64_t random_state;
+
+	/* Counts of calls, and the total time slept, for modelling CPU usage. */
+	uint64_t reads;
+	uint64_t sleeps;
+	uint64_t yields;
+	uint64_t slept_duration;
+} nanotime_virtual_clock;
+
+/*
+ * Initializes the virtual clock to start at time start, with no read cost or
+ * overshoot; set the model's members after initialization.
+ */
+void nanotime_virtual_clock_init(nanotime_virtual_clock* const clock, const uint64_t start, const uint64_t now_max, const uint64_t seed);
+
+/*
+ * Advances the virtual clock by nsec_count nanoseconds.
+ */
+void nanotime_virtual_advance(nanotime_virtual_clock* const clock, const uint64_t nsec_count);
+
+/*
+ * Timestamp and sleep functions for nanotime_step_init_user, with user being a
+ * nanotime_virtual_clock.
+ */
+uint64_t nanotime_virtual_now(void* user);
+void nanotime_virtual_sleep(void* user, uint64_t nsec_count);
+
+/*
+ * Yield function for nanotime_step_set_yield_user, advancing the virtual clock
+ * by yield_cost.
+ */
+void nanotime_virtual_yield(void* user);
+
+/*
+ * Publishes a stepper's timeline and the latest two of its thread's states to
+ * other threads, such as a logic thread's states to a render thread, without
+ * locks; readers never block the publishing thread. A read overlapping a
+ * publish waits out the publish's few stores, then retries, so the states,
+ * count and sleep point it returns are all of the same publish.
+ *
+ * The states are copied into caller-provided storage of three states, so the
+ * publisher can write the next state while readers copy the current pair,
+ * keeping each publish's window for retries short.
+ */
+typedef struct nanotime_step_publisher {
+	/* Odd while a publish is in progress. */
+	uint64_t sequence;
+	uint64_t count;
+	uint64_t sleep_point;
+	uint64_t sleep_duration;
+	uint64_t now_max;
+	unsigned char* states;
+	size_t state_size;
+
+	unsigned char padding[NANOTIME_CACHE_LINE_SIZE];
+} nanotime_step_publisher;
+
+/*
+ * Initializes the publisher with the stepper's timeline, where states points
+ * to room for three states of state_size bytes each; initial_state is
+ * published as both the previous and current state. The states are written by
+ * the publishing thread while readers copy the others, so for states smaller
+ * than a cache line, a state type aligned with NANOTIME_CACHE_ALIGNED avoids
+ * false sharing between them.
+ */
+void nanotime_step_publisher_init(
+	nanotime_step_publisher* const publisher,
+	const nanotime_step_data* const stepper,
+	void* const states,
+	const size_t state_size,
+	const void* const initial_state
+);
+
+/*
+ * Publishes state as the current state, and the previously-current state as
+ * the previous state, along with the stepper's latest sleep point. Call it
+ * from the stepper's thread after each step's update; only one thread may
+ * publish.
+ */
+void nanotime_step_publish(nanotime_step_publisher* const publisher, const nanotime_step_data* const stepper, const void* const state);
+
+/*
+ * Copies a consistent pair of the latest two published states into previous
+ * and current (either of which can be NULL), and returns the fraction of the
+ * current step elapsed at time now since the current state was published, in
+ * [0.0, 1.0]; render previous * (1.0 - alpha) + current * alpha for smooth
+ * motion at any render rate. Can be called from any number of threads.
+ */
+double nanotime_step_snapshot(nanotime_step_publisher* const publisher, const uint64_t now, void* const previous, void* const current);
+
+/*
+ * Just the interpolation fraction of nanotime_step_snapshot.
+ */
+double nanotime_step_alpha(nanotime_step_publisher* const publisher, const uint64_t now);
+
+/*
+ * A stepper's tick timeline, published by one process for other processes to
+ * align their own steppers to, such as a simulation process's timeline for its
+ * renderer and recorder processes. It contains no pointers, so it can be placed
+ * in shared memory, such as that from nanotime_step_clock_map, and read without
+ * any system calls; the reading processes' steppers must use the same clock as
+ * the publishing process's, such as nanotime_now, which is system-wide on all
+ * the supported platforms.
+ */
+typedef struct nanotime_step_clock {
+	/* NANOTIME_STEP_CLOCK_MAGIC once initialized. */
+	uint64_t magic;
+	/* Odd while a publish is in progress. */
+	uint64_t sequence;
+	uint64_t tick;
+	uint64_t tick_point;
+	uint64_t sleep_duration;
+	uint64_t now_max;
+
+	unsigned char padding[NANOTIME_CACHE_LINE_SIZE];
+} nanotime_step_clock;
+
+#define NANOTIME_STEP_CLOCK_MAGIC UINT64_C(0x314B434F4C43544E)
+
+/*
+ * A consistent copy of a published clock: tick_point is the deadline of tick
+ * number tick, and the following ticks are sleep_duration apart.
+ */
+typedef struct nanotime_step_clock_time {
+	uint64_t tick;
+	uint64_t tick_point;
+	uint64_t sleep_duration;
+	uint64_t now_max;
+} nanotime_step_clock_time;
+
+/*
+ * Initializes the clock with the stepper's timeline, as of tick number zero.
+ */
+void nanotime_step_clock_init(nanotime_step_clock* const clock, const nanotime_step_data* const stepper);
+
+/*
+ * Publishes the stepper's latest tick. Call it from the stepper's thread after
+ * each step, skipped or not; only one thread may publish.
+ */
+void nanotime_step_clock_publish(nanotime_step_clock* const clock, const nanotime_step_data* const stepper);
+
+/*
+ * Copies a consistent state of the clock into time. It never blocks: it gives
+ * up after a few attempts overlapping publishes, returning false, as it does
+ * if the clock hasn't been initialized yet. Can be called from any number of
+ * threads and processes.
+ */
+bool nanotime_step_clock_read(nanotime_step_clock* const clock, nanotime_step_clock_time* const time);
+
+/*
+ * Restarts the stepper's timeline at time now, in phase with the clock time,
+ * so the stepper's deadlines fall on the published ticks; the stepper's own
+ * sleep_duration is kept, so it can step at a multiple or divisor of the
+ * published rate. Returns the number of the latest published tick at or before
+ * now, extrapolated from the time.
+ */
+uint64_t nanotime_step_align(nanotime_step_data* const stepper, const nanotime_step_clock_time* const time, const uint64_t now);
+
+#ifndef NANOTIME_ONLY_STEP
+/*
+ * Maps the named shared memory for a nanotime_step_clock, creating it first if
+ * create is true; the creating process then calls nanotime_step_clock_init on
+ * it, and until then, nanotime_step_clock_read of it fails. Creating a clock
+ * that already exists, such as one left behind by a publisher that crashed,
+ * maps the existing memory. Names are like "/nanotime_clock" on POSIX
+ * systems, and like "Local\\nanotime_clock" on Windows. Returns NULL on
+ * failure, or on platforms without named shared memory.
+ */
+nanotime_step_clock* nanotime_step_clock_map(const char* const name, const bool create);
+
+/*
+ * Unmaps a clock mapped by nanotime_step_clock_map.
+ */
+void nanotime_step_clock_unmap(nanotime_step_clock* const clock);
+
+/*
+ * Removes the named shared memory, once all processes have unmapped it; the
+ * memory of currently mapped clocks remains valid. Windows removes it
+ * automatically when the last process unmaps it, so this does nothing there.
+ */
+void nanotime_step_clock_unlink(const char* const name);
+#endif
+
+/*
+ * The layout version of nanotime_step_state, changed whenever its layout is.
+ */
+#define NANOTIME_STEP_STATE_VERSION UINT64_C(1)
+
+/*
+ * The timeline of a stepper, as plain data, for moving a stepper's phase to
+ * another stepper, such as one on another thread, or saving it. Every field is
+ * a uint64_t, so the layout has no padding and is the same for all compilers of
+ * a platform; the catch-up policy is stored as its enumerator's value. The
+ * timestamps are of the exporting stepper's clock, so a state can only be
+ * imported into steppers with the same clock.
+ */
+typedef struct nanotime_step_state {
+	uint64_t version;
+	uint64_t size;
+	uint64_t now_max;
+	uint64_t sleep_duration;
+	uint64_t sleep_point;
+	uint64_t accumulator;
+	uint64_t catch_up;
+	uint64_t catch_up_limit;
+	uint64_t spread_debt;
+	uint64_t spread_slice;
+} nanotime_step_state;
+
+/*
+ * Exports the stepper's timeline into state, pausing the stepper: it mustn't be
+ * stepped again unless a state is imported into it. The export can be done at
+ * any time between steps.
+ */
+void nanotime_step_export(const nanotime_step_data* const stepper, nanotime_step_state* const state);
+
+/*
+ * Imports the state into the stepper, resuming the exported timeline at the
+ * stepper's next step, which sleeps until the exported stepper's next deadline,
+ * so moving a stepper to another thread between its steps costs it no tick. The
+ * stepper keeps its own sleep functions, sleep calibration, adaptive tuning,
+ * hooks and statistics, so steppers initialized on the thread resuming the
+ * timeline keep that thread's calibration. Returns false, leaving the stepper
+ * unchanged, if the state is of another version or clock, or is invalid.
+ */
+bool nanotime_step_import(nanotime_step_data* const stepper, const nanotime_step_state* const state);
+
+/*
+ * A rate limiter, pacing events to a rate of one token per interval
+ * nanoseconds, with bursts of up to burst tokens allowed after idle time; it's
+ * both a token bucket of burst tokens, refilled at the rate, and a leaky bucket
+ * of burst tokens' capacity, drained at the rate. It's implemented as the
+ * generic cell rate algorithm, where the only state is the theoretical arrival
+ * time of the next token, so any number of threads can acquire tokens at once,
+ * without locks, by compare-and-swap of it. Times are timestamps of a clock
+ * wrapping around past now_max, such as nanotime_now; tokens can't be reserved
+ * more than now_max / 2 nanoseconds ahead.
+ */
+typedef struct nanotime_rate_limiter {
+	uint64_t arrival_time;
+	uint64_t interval;
+	uint64_t burst;
+	uint64_t now_max;
+
+	unsigned char padding[NANOTIME_CACHE_LINE_SIZE];
+} nanotime_rate_limiter;
+
+/*
+ * Initializes the limiter with a full bucket, as of time now.
+ */
+void nanotime_rate_limiter_init(nanotime_rate_limiter* const limiter, const uint64_t interval, const uint64_t burst, const uint64_t now, const uint64_t now_max);
+
+/*
+ * Takes tokens if they're available at time now, returning true; otherwise,
+ * returns false, and, if wait isn't NULL, sets it to how long until they will
+ * be available, if no other thread takes them first.
+ */
+bool nanotime_rate_try_acquire(nanotime_rate_limiter* const limiter, const uint64_t tokens, const uint64_t now, uint64_t* const wait);
+
+/*
+ * Reserves tokens, then waits until they're available, with the precise
+ * sleeping of the stepper, which must use the same clock as the limiter and is
+ * only used for its calibration and stats, so it can be a thread's own stepper
+ * used for nothing else. Reservations are taken in order, so waiting threads
+ * are paced at the limiter's rate between them. Returns how late past the
+ * reserved time the wait finished, in nanoseconds.
+ */
+uint64_t nanotime_rate_acquire_or_wait(nanotime_rate_limiter* const limiter, const uint64_t tokens, nanotime_step_data* const stepper);
+
+#ifdef NANOTIME_IMPLEMENTATION
+
+#include <string.h>
+
+/*
+ * Atomic operations on uint64_t objects, for the lock-free parts of the
+ * library. Loads are acquire, stores are release, and read-modify-write
+ * operations are acquire-release; NANOTIME_ATOMIC_CAS updates *expected with
+ * the current value on failure, like C11's atomic_compare_exchange_strong.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define NANOTIME_ATOMIC_LOAD(object) __atomic_load_n((object), __ATOMIC_ACQUIRE)
+#define NANOTIME_ATOMIC_STORE(object, desired) __atomic_store_n((object), (desired), __ATOMIC_RELEASE)
+#define NANOTIME_ATOMIC_CAS(object, expected, desired) __atomic_compare_exchange_n((object), (expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define NANOTIME_ATOMIC_ADD(object, operand) __atomic_fetch_add((object), (operand), __ATOMIC_ACQ_REL)
+#define NANOTIME_ATOMIC_FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#elif defined(_MSC_VER)
+/*
+ * Only the 64-bit compare-exchange intrinsic is available on all of x86, x64,
+ * and ARM, so everything is built on it. The interlocked intrinsics are full
+ * barriers.
+ */
+#include <intrin.h>
+static uint64_t nanotime_atomic_load(volatile uint64_t* const object) {
+	return (uint64_t)_InterlockedCompareExchange64((volatile __int64*)object, 0, 0);
+}
+static bool nanotime_atomic_cas(volatile uint64_t* const object, uint64_t* const expected, const uint64_t desired) {
+	const uint64_t previous = (uint64_t)_InterlockedCompareExchange64((volatile __int64*)object, (__int64)desired, (__int64)*expected);
+	if (previous == *expected) {
+		return true;
 	}
-	LARGE_INTEGER performanceCount;
-	QueryPerformanceCounter(&performanceCount);
-	if (multiply) {
-		return performanceCount.QuadPart * scale;
+	*expected = previous;
+	return false;
+}
+static void nanotime_atomic_store(volatile uint64_t* const object, const uint64_t desired) {
+	uint64_t expected = nanotime_atomic_load(object);
+	while (!nanotime_atomic_cas(object, &expected, desired));
+}
+static uint64_t nanotime_atomic_add(volatile uint64_t* const object, const uint64_t operand) {
+	uint64_t expected = nanotime_atomic_load(object);
+	while (!nanotime_atomic_cas(object, &expected, expected + operand));
+	return expected;
+}
+static void nanotime_atomic_fence() {
+	static volatile long fence_object = 0L;
+	(void)_InterlockedExchange(&fence_object, 0L);
+}
+#define NANOTIME_ATOMIC_LOAD(object) nanotime_atomic_load((object))
+#define NANOTIME_ATOMIC_STORE(object, desired) nanotime_atomic_store((object), (desired))
+#define NANOTIME_ATOMIC_CAS(object, expected, desired) nanotime_atomic_cas((object), (expected), (desired))
+#define NANOTIME_ATOMIC_ADD(object, operand) nanotime_atomic_add((object), (operand))
+#define NANOTIME_ATOMIC_FENCE() nanotime_atomic_fence()
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define NANOTIME_ATOMIC_LOAD(object) atomic_load_explicit((_Atomic uint64_t*)(object), memory_order_acquire)
+#define NANOTIME_ATOMIC_STORE(object, desired) atomic_store_explicit((_Atomic uint64_t*)(object), (desired), memory_order_release)
+#define NANOTIME_ATOMIC_CAS(object, expected, desired) atomic_compare_exchange_strong_explicit((_Atomic uint64_t*)(object), (expected), (desired), memory_order_acq_rel, memory_order_acquire)
+#define NANOTIME_ATOMIC_ADD(object, operand) atomic_fetch_add_explicit((_Atomic uint64_t*)(object), (operand), memory_order_acq_rel)
+#define NANOTIME_ATOMIC_FENCE() atomic_thread_fence(memory_order_seq_cst)
+#else
+#error "Failed to implement atomic operations (try using GCC, Clang, Visual Studio, or C11 with atomics support)."
+#endif
+
+#endif
+
+#if !defined(NANOTIME_ONLY_STEP) && defined(NANOTIME_IMPLEMENTATION)
+
+/*
+ * Non-portable, platform-specific implementations are first. If none of them
+ * match the current platform, the standard C/C++ versions are used as a last
+ * resort.
+ */
+
+#if defined(_WIN32) || defined(__APPLE__) || defined(__MACH__)
+/*
+ * Returns floor(a * b / c), modulo 2^64 like a 64-bit product would be, but
+ * without losing the high bits of the intermediate product. Requires that
+ * (c - 1) * b fits in 64 bits, which holds for all the clock frequencies and
+ * timebase ratios it's used for.
+ */
+static uint64_t nanotime_mul_div(const uint64_t a, const uint64_t b, const uint64_t c) {
+	assert(c > UINT64_C(0));
+	return (a / c) * b + (a % c) * b / c;
+}
+
+/*
+ * Returns floor(a * b / c), saturated to UINT64_MAX, with the same
+ * requirement as nanotime_mul_div. Used to find the maximum timestamp of a
+ * scaled counter, which is UINT64_MAX when the scaled timestamps wrap around
+ * at 2^64 before the counter itself wraps around.
+ */
+static uint64_t nanotime_mul_div_saturated(const uint64_t a, const uint64_t b, const uint64_t c) {
+	assert(c > UINT64_C(0));
+	const uint64_t whole = a / c;
+	if (b > UINT64_C(0) && whole > UINT64_MAX / b) {
+		return UINT64_MAX;
 	}
-	else {
-		return performanceCount.QuadPart / scale;
+	const uint64_t whole_product = whole * b;
+	const uint64_t part_product = (a % c) * b / c;
+	if (part_product > UINT64_MAX - whole_product) {
+		return UINT64_MAX;
+	}
+	return whole_product + part_product;
+}
+#endif
+
+void nanotime_timer_cache_init(
+	nanotime_timer_cache* const cache,
+	void* const user,
+	void* (* const create)(void* user),
+	bool (* const wait)(void* user, void* timer, uint64_t nsec_count),
+	void (* const close)(void* user, void* timer)
+) {
+	assert(cache != NULL);
+	assert(create != NULL);
+	assert(wait != NULL);
+	assert(close != NULL);
+
+	cache->user = user;
+	cache->create = create;
+	cache->wait = wait;
+	cache->close = close;
+	cache->timer = NULL;
+	cache->creates = UINT64_C(0);
+}
+
+bool nanotime_timer_cache_sleep(nanotime_timer_cache* const cache, const uint64_t nsec_count) {
+	assert(cache != NULL);
+
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (cache->timer == NULL) {
+			if ((cache->timer = cache->create(cache->user)) == NULL) {
+				return false;
+			}
+			cache->creates++;
+		}
+		if (cache->wait(cache->user, cache->timer, nsec_count)) {
+			return true;
+		}
+		nanotime_timer_cache_close(cache);
+	}
+	return false;
+}
+
+void nanotime_timer_cache_close(nanotime_timer_cache* const cache) {
+	assert(cache != NULL);
+
+	if (cache->timer != NULL) {
+		cache->close(cache->user, cache->timer);
+		cache->timer = NULL;
+	}
+}
+
+/*
+ * Checking _WIN32 must be above the UNIX-like implementations, so MinGW is
+ * guaranteed to use it.
+ */
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+uint64_t nanotime_now() {
+	static uint64_t frequency = UINT64_C(0);
+	if (frequency == UINT64_C(0)) {
+		LARGE_INTEGER performanceFrequency;
+		QueryPerformanceFrequency(&performanceFrequency);
+		frequency = (uint64_t)performanceFrequency.QuadPart;
 	}
+	LARGE_INTEGER performanceCount;
+	QueryPerformanceCounter(&performanceCount);
+
+	/*
+	 * Scaling by the exact ratio, rather than an integer approximation of
+	 * it, keeps timestamps correct for frequencies that don't evenly divide
+	 * or aren't evenly divided by a billion, and doesn't overflow.
+	 */
+	return nanotime_mul_div((uint64_t)performanceCount.QuadPart, NANOTIME_NSEC_PER_SEC, frequency);
 }
 #define NANOTIME_NOW_IMPLEMENTED
 #endif
@@ -222,632 +1528,3306 @@ uint64_t nanotime_now_max() {
 	if (now_max == UINT64_C(0)) {
 		LARGE_INTEGER frequency;
 		QueryPerformanceFrequency(&frequency);
-		if (frequency.QuadPart < NANOTIME_NSEC_PER_SEC) {
-			now_max = UINT64_MAX * (NANOTIME_NSEC_PER_SEC / frequency.QuadPart);
-		}
-		else {
-			now_max = UINT64_MAX / (frequency.QuadPart / NANOTIME_NSEC_PER_SEC);
+		now_max = nanotime_mul_div_saturated((uint64_t)INT64_MAX, NANOTIME_NSEC_PER_SEC, (uint64_t)frequency.QuadPart);
+	}
+	return now_max;
+}
+#define NANOTIME_NOW_MAX_IMPLEMENTED
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+static void* nanotime_waitable_timer_create(void* user) {
+	(void)user;
+
+	HANDLE timer = NULL;
+	if (
+		#ifdef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+		/*
+		 * Requesting a high resolution timer can make quite the
+		 * difference, so always request high resolution if available. It's
+		 * available in Windows 10 1803 and above. This arrangement of
+		 * building it if the build system supports it will allow the
+		 * executable to use high resolution if available on a user's
+		 * system, but revert to low resolution if the user's system
+		 * doesn't support high resolution.
+		 */
+		(timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS)) == NULL &&
+		#endif
+		(timer = CreateWaitableTimer(NULL, TRUE, NULL)) == NULL
+	) {
+		return NULL;
+	}
+	return timer;
+}
+
+static bool nanotime_waitable_timer_wait(void* user, void* timer, uint64_t nsec_count) {
+	(void)user;
+
+	LARGE_INTEGER dueTime;
+	dueTime.QuadPart = -(LONGLONG)(nsec_count / UINT64_C(100));
+	return
+		SetWaitableTimer((HANDLE)timer, &dueTime, 0L, NULL, NULL, FALSE) &&
+		WaitForSingleObject((HANDLE)timer, INFINITE) == WAIT_OBJECT_0;
+}
+
+static void nanotime_waitable_timer_close(void* user, void* timer) {
+	(void)user;
+
+	CloseHandle((HANDLE)timer);
+}
+
+/*
+ * Each thread's timer cache is in fiber-local storage, rather than
+ * thread-local storage, as only fiber-local storage calls a destructor at
+ * thread exit, which closes the timer.
+ */
+static DWORD nanotime_sleep_fls_index = FLS_OUT_OF_INDEXES;
+static INIT_ONCE nanotime_sleep_fls_once = INIT_ONCE_STATIC_INIT;
+
+static void WINAPI nanotime_sleep_fls_destroy(PVOID data) {
+	nanotime_timer_cache* const cache = (nanotime_timer_cache*)data;
+	if (cache != NULL) {
+		nanotime_timer_cache_close(cache);
+		HeapFree(GetProcessHeap(), 0UL, cache);
+	}
+}
+
+static BOOL CALLBACK nanotime_sleep_fls_init(PINIT_ONCE once, PVOID parameter, PVOID* context) {
+	(void)once;
+	(void)parameter;
+	(void)context;
+
+	nanotime_sleep_fls_index = FlsAlloc(nanotime_sleep_fls_destroy);
+	return TRUE;
+}
+
+/*
+ * Returns the calling thread's timer cache, creating it if create is true and
+ * there isn't one yet. Returns NULL if there's no cache.
+ */
+static nanotime_timer_cache* nanotime_sleep_cache(const bool create) {
+	InitOnceExecuteOnce(&nanotime_sleep_fls_once, nanotime_sleep_fls_init, NULL, NULL);
+	if (nanotime_sleep_fls_index == FLS_OUT_OF_INDEXES) {
+		return NULL;
+	}
+
+	nanotime_timer_cache* cache = (nanotime_timer_cache*)FlsGetValue(nanotime_sleep_fls_index);
+	if (cache == NULL && create) {
+		if ((cache = (nanotime_timer_cache*)HeapAlloc(GetProcessHeap(), 0UL, sizeof(nanotime_timer_cache))) == NULL) {
+			return NULL;
+		}
+		nanotime_timer_cache_init(cache, NULL, nanotime_waitable_timer_create, nanotime_waitable_timer_wait, nanotime_waitable_timer_close);
+		if (!FlsSetValue(nanotime_sleep_fls_index, cache)) {
+			HeapFree(GetProcessHeap(), 0UL, cache);
+			return NULL;
+		}
+	}
+	return cache;
+}
+
+void nanotime_sleep(uint64_t nsec_count) {
+	if (nsec_count < UINT64_C(100)) {
+		/*
+		 * Allows the OS to schedule another process for a single time
+		 * slice. Better than a delay of 0, which immediately returns
+		 * with no actual non-CPU-hogging delay. The time-slice-yield
+		 * behavior is specified in Microsoft's Windows documentation.
+		 */
+		SleepEx(0UL, FALSE);
+		return;
+	}
+
+	nanotime_timer_cache* const cache = nanotime_sleep_cache(true);
+	if (cache != NULL) {
+		nanotime_timer_cache_sleep(cache, nsec_count);
+	}
+	else {
+		/* Without a cache, each sleep has a timer of its own. */
+		nanotime_timer_cache uncached;
+		nanotime_timer_cache_init(&uncached, NULL, nanotime_waitable_timer_create, nanotime_waitable_timer_wait, nanotime_waitable_timer_close);
+		nanotime_timer_cache_sleep(&uncached, nsec_count);
+		nanotime_timer_cache_close(&uncached);
+	}
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+
+void nanotime_sleep_cleanup() {
+	nanotime_timer_cache* const cache = nanotime_sleep_cache(false);
+	if (cache != NULL) {
+		FlsSetValue(nanotime_sleep_fls_index, NULL);
+		nanotime_sleep_fls_destroy(cache);
+	}
+}
+
+void nanotime_sleep_shutdown() {
+	/*
+	 * Running the one-time initialization here, if it hasn't been run yet,
+	 * keeps later sleeps from allocating a new index. Freeing the index
+	 * calls the destructor on every thread's cache.
+	 */
+	InitOnceExecuteOnce(&nanotime_sleep_fls_once, nanotime_sleep_fls_init, NULL, NULL);
+	const DWORD index = nanotime_sleep_fls_index;
+	if (index != FLS_OUT_OF_INDEXES) {
+		nanotime_sleep_fls_index = FLS_OUT_OF_INDEXES;
+		FlsFree(index);
+	}
+}
+#define NANOTIME_SLEEP_CLEANUP_IMPLEMENTED
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+void nanotime_yield() {
+	YieldProcessor();
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#endif
+
+#endif
+
+/*
+ * To avoid using standard UNIX APIs on UNIX-like platforms, the
+ * platform-specific implementations must be first. That way, the
+ * lower-overhead kernel APIs can be used, that aren't UNIX-like.
+ */
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#if defined(__APPLE__) || defined(__MACH__)
+/*
+ * The current platform is some Apple operating system, or at least uses some
+ * Mach kernel. The POSIX implementation below using clock_gettime works on at
+ * least Apple platforms, though this version using Mach functions has lower
+ * overhead.
+ */
+#include <mach/mach_time.h>
+uint64_t nanotime_now() {
+	static mach_timebase_info_data_t info = { 0 };
+	if (info.denom == UINT32_C(0)) {
+		const kern_return_t status = mach_timebase_info(&info);
+		assert(status == KERN_SUCCESS);
+		if (status != KERN_SUCCESS) {
+			return UINT64_C(0);
+		}
+	}
+	return nanotime_mul_div(mach_absolute_time(), info.numer, info.denom);
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_NOW_MAX_IMPLEMENTED
+#if defined(__APPLE__) || defined(__MACH__)
+#include <mach/mach_time.h>
+uint64_t nanotime_now_max() {
+	static uint64_t now_max = UINT64_C(0);
+	if (now_max == UINT64_C(0)) {
+		mach_timebase_info_data_t info;
+		const kern_return_t status = mach_timebase_info(&info);
+		assert(status == KERN_SUCCESS);
+		if (status != KERN_SUCCESS) {
+			return UINT64_C(0);
+		}
+		else {
+			now_max = nanotime_mul_div_saturated(UINT64_MAX, info.numer, info.denom);
+		}
+	}
+	return now_max;
+}
+#define NANOTIME_NOW_MAX_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#if defined(__unix__) && defined(_POSIX_VERSION) && (_POSIX_VERSION >= 199309L) && !defined(NANOTIME_NOW_IMPLEMENTED)
+/*
+ * Current platform is some version of POSIX, that might have clock_gettime.
+ */
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+uint64_t nanotime_now() {
+	struct timespec now;
+	const int status = clock_gettime(
+		#if defined(CLOCK_MONOTONIC_RAW)
+		/*
+		 * Monotonic raw is more precise, but not always available. For
+		 * the sorts of applications this code is intended for, mainly
+		 * soft real time applications such as game programming, the
+		 * subtle inconsistencies of it vs. monotonic aren't an issue.
+		 */
+		CLOCK_MONOTONIC_RAW
+		#elif defined(CLOCK_MONOTONIC)
+		/*
+		 * Monotonic is quite good, and widely available, but not as
+		 * precise as monotonic raw, so it's only used if required.
+		 */
+		CLOCK_MONOTONIC
+		#else
+		/*
+		 * Realtime isn't fully correct, as it's calendar time, but is
+		 * even more widely available than monotonic. Monotonic is only
+		 * unavailable on very old platforms though, so old they're
+		 * likely unused now (as of last editing this, 2023).
+		 */
+		CLOCK_REALTIME
+		#endif
+	, &now);
+	assert(status == 0 || (status == -1 && errno != EOVERFLOW));
+	if (status == 0 || (status == -1 && errno != EOVERFLOW)) {
+		return (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	}
+	else {
+		return UINT64_C(0);
+	}
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__)) || defined(__MINGW32__) || defined(__MINGW64__)
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+void nanotime_sleep(uint64_t nsec_count) {
+	const struct timespec req = {
+		.tv_sec = (time_t)(nsec_count / NANOTIME_NSEC_PER_SEC),
+		.tv_nsec = (long)(nsec_count % NANOTIME_NSEC_PER_SEC)
+	};
+	#ifndef NDEBUG
+	const int status =
+	#endif
+	nanosleep(&req, NULL);
+	assert(status == 0 || (status == -1 && errno != EINVAL));
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#if (defined(__unix__) || defined(__APPLE__)) && defined(_POSIX_VERSION) && (_POSIX_VERSION >= 200112L)
+#include <sched.h>
+void nanotime_yield() {
+	(void)sched_yield();
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#endif
+#endif
+
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#if defined(__vita__)
+#include <psp2/kernel/processmgr.h>
+uint64_t nanotime_now() {
+	return sceKernelGetProcessTimeWide() * UINT64_C(1000);
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#if defined(__vita__)
+#include <psp2/kernel/processmgr.h>
+void nanotime_sleep(uint64_t nsec_count) {
+	sceKernelDelayThreadCB(nsec_count / UINT64_C(1000));
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+/*
+ * NOTE: You *must* have asyncify enabled in the Emscripten build (pass
+ * -sASYNCIFY to the compiler/linker) or sleeping won't work.
+ */
+void nanotime_sleep(uint64_t nsec_count) {
+	emscripten_sleep(nsec_count / UINT64_C(1000000));
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+uint64_t nanotime_now() {
+	/*
+	 * The time is in milliseconds, with a fractional part, so it has to be
+	 * scaled before truncation to keep the sub-millisecond part.
+	 */
+	const double now = emscripten_get_now();
+	return (uint64_t)(now * 1000000.0);
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#ifdef __SWITCH__
+#include <switch.h>
+void nanotime_sleep(uint64_t nsec_count) {
+	if (nsec_count > INT64_MAX) {
+		svcSleepThread(INT64_MAX);
+	}
+	else {
+		svcSleepThread((s64)nsec_count);
+	}
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#ifdef __SWITCH__
+#include <switch.h>
+uint64_t nanotime_now() {
+	return armTicksToNs(armGetSystemTick());
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#if defined(__SWITCH__)
+#include <switch.h>
+void nanotime_yield() {
+	svcSleepThread(YieldType_ToAnyThread);
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#endif
+#endif
+
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#include <time.h>
+uint64_t nanotime_now() {
+	struct timespec now;
+	const int status = timespec_get(&now, TIME_UTC);
+	assert(status == TIME_UTC);
+	if (status == TIME_UTC) {
+		return (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	}
+	else {
+		return UINT64_C(0);
+	}
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#include <threads.h>
+void nanotime_sleep(uint64_t nsec_count) {
+	const struct timespec req = {
+		.tv_sec = (time_t)(nsec_count / NANOTIME_NSEC_PER_SEC),
+		.tv_nsec = (long)(nsec_count % NANOTIME_NSEC_PER_SEC)
+	};
+	const int status = thrd_sleep(&req, NULL);
+	assert(status == 0 || status == -1);
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#include <threads.h>
+void nanotime_yield() {
+	thrd_yield();
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#endif
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+/*
+ * C++ implementations follow here, but defined with C linkage.
+ */
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#ifdef __cplusplus
+#include <cstdint>
+#include <chrono>
+extern "C" uint64_t nanotime_now() {
+	return static_cast<uint64_t>(
+		std::chrono::time_point_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now()
+		).time_since_epoch().count()
+	);
+}
+#define NANOTIME_NOW_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#ifdef __cplusplus
+#include <cstdint>
+#include <thread>
+#include <exception>
+extern "C" void nanotime_sleep(uint64_t nsec_count) {
+	try {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(nsec_count));
+	}
+	catch (std::exception e) {
+	}
+}
+#define NANOTIME_SLEEP_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#ifdef __cplusplus
+#include <thread>
+extern "C" void nanotime_yield() {
+	std::this_thread::yield();
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#endif
+#endif
+
+
+#ifndef NANOTIME_NOW_IMPLEMENTED
+#error "Failed to implement nanotime_now (try using C11 with C11 threads support or C++11)."
+#endif
+
+#ifndef NANOTIME_SLEEP_IMPLEMENTED
+#error "Failed to implement nanotime_sleep (try using C11 with C11 threads support or C++11)."
+#endif
+
+#ifndef NANOTIME_SLEEP_CLEANUP_IMPLEMENTED
+/*
+ * The other implementations of nanotime_sleep keep nothing per thread.
+ */
+void nanotime_sleep_cleanup() {
+}
+
+void nanotime_sleep_shutdown() {
+}
+#define NANOTIME_SLEEP_CLEANUP_IMPLEMENTED
+#endif
+
+#ifndef NANOTIME_YIELD_IMPLEMENTED
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * As a last resort, make a zero-duration sleep request to implement yield.
+ * Such sleep requests often have the desired yielding behavior on many
+ * platforms.
+ */
+void nanotime_yield() {
+	nanotime_sleep(0u);
+}
+#define NANOTIME_YIELD_IMPLEMENTED
+#ifdef __cplusplus
+}
+#endif
+#endif
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef NANOTIME_NOW_MAX_IMPLEMENTED
+/*
+ * Might not be correct on some platforms, but it's the best we can do as a last
+ * resort.
+ */
+uint64_t nanotime_now_max() {
+	return UINT64_MAX;
+}
+#define NANOTIME_NOW_MAX_IMPLEMENTED
+#endif
+
+/*
+ * The high-water mark is written by nearly every call, from every calling
+ * thread, so it's padded onto a cache line of its own, away from the rarely
+ * written regression count and neighboring globals.
+ */
+static struct {
+	unsigned char padding_before[NANOTIME_CACHE_LINE_SIZE];
+	uint64_t high_water_mark;
+	unsigned char padding_after[NANOTIME_CACHE_LINE_SIZE];
+	uint64_t regressions;
+} nanotime_monotonic = { { 0u }, UINT64_C(0), { 0u }, UINT64_C(0) };
+
+uint64_t nanotime_now_monotonic() {
+	const uint64_t now = nanotime_now();
+	const uint64_t now_max = nanotime_now_max();
+	uint64_t high_water_mark = NANOTIME_ATOMIC_LOAD(&nanotime_monotonic.high_water_mark);
+	do {
+		/*
+		 * A timestamp more than half the wrap period behind the mark is
+		 * taken to be past a wraparound, rather than a regression.
+		 */
+		const uint64_t behind = nanotime_interval(now, high_water_mark, now_max);
+		if (behind > UINT64_C(0) && behind <= now_max / UINT64_C(2)) {
+			NANOTIME_ATOMIC_ADD(&nanotime_monotonic.regressions, UINT64_C(1));
+			return high_water_mark;
+		}
+		else if (behind == UINT64_C(0)) {
+			return now;
+		}
+	} while (!NANOTIME_ATOMIC_CAS(&nanotime_monotonic.high_water_mark, &high_water_mark, now));
+	return now;
+}
+
+uint64_t nanotime_now_monotonic_regressions() {
+	return NANOTIME_ATOMIC_LOAD(&nanotime_monotonic.regressions);
+}
+
+#ifndef NANOTIME_NOW_COARSE_IMPLEMENTED
+#ifdef __linux__
+#include <time.h>
+#endif
+#if defined(__linux__) && defined(CLOCK_MONOTONIC_COARSE)
+uint64_t nanotime_now_coarse() {
+	struct timespec now;
+	const int status = clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	assert(status == 0);
+	if (status == 0) {
+		return (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	}
+	else {
+		return nanotime_now();
+	}
+}
+
+uint64_t nanotime_now_coarse_resolution() {
+	struct timespec resolution;
+	if (clock_getres(CLOCK_MONOTONIC_COARSE, &resolution) == 0) {
+		return (uint64_t)resolution.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)resolution.tv_nsec;
+	}
+	else {
+		return NANOTIME_NSEC_PER_SEC / UINT64_C(100);
+	}
+}
+#define NANOTIME_NOW_COARSE_IMPLEMENTED
+#endif
+#endif
+
+#ifndef NANOTIME_NOW_COARSE_IMPLEMENTED
+/*
+ * No cheaper clock is known of for the current platform, so the precise clock
+ * is used, which has effectively no coarseness.
+ */
+uint64_t nanotime_now_coarse() {
+	return nanotime_now();
+}
+
+uint64_t nanotime_now_coarse_resolution() {
+	return UINT64_C(1);
+}
+#define NANOTIME_NOW_COARSE_IMPLEMENTED
+#endif
+
+/*
+ * The cycle counter used by stamp epochs. Only counters that are invariant,
+ * i.e., that tick at a constant rate regardless of CPU frequency scaling, and
+ * readable from user mode on all current hardware, are used.
+ */
+#ifndef NANOTIME_TICKS_IMPLEMENTED
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+static uint64_t nanotime_ticks() {
+	return (uint64_t)__rdtsc();
+}
+#define NANOTIME_TICKS_IMPLEMENTED
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+static uint64_t nanotime_ticks() {
+	uint64_t ticks;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+}
+#define NANOTIME_TICKS_IMPLEMENTED
+#endif
+#endif
+
+#ifdef NANOTIME_TICKS_IMPLEMENTED
+/*
+ * Returns (a * b) >> shift, without overflowing in the intermediate product,
+ * as long as the result itself fits in 64 bits.
+ */
+static uint64_t nanotime_mul_shift(const uint64_t a, const uint64_t b, const unsigned shift) {
+	assert(shift > 0u && shift < 64u);
+
+	#if defined(__SIZEOF_INT128__)
+	return (uint64_t)(((unsigned __int128)a * b) >> shift);
+	#else
+	const uint64_t a_lo = a & UINT32_MAX, a_hi = a >> 32;
+	const uint64_t b_lo = b & UINT32_MAX, b_hi = b >> 32;
+	const uint64_t lo_lo = a_lo * b_lo;
+	const uint64_t hi_lo = a_hi * b_lo;
+	const uint64_t lo_hi = a_lo * b_hi;
+	const uint64_t hi_hi = a_hi * b_hi;
+	const uint64_t middle = (lo_lo >> 32) + (hi_lo & UINT32_MAX) + lo_hi;
+	const uint64_t product_lo = (middle << 32) | (lo_lo & UINT32_MAX);
+	const uint64_t product_hi = hi_hi + (hi_lo >> 32) + (middle >> 32);
+	return (product_hi << (64u - shift)) | (product_lo >> shift);
+	#endif
+}
+#endif
+
+void nanotime_stamp_epoch_begin(nanotime_stamp_epoch* const epoch) {
+	assert(epoch != NULL);
+
+	#ifdef NANOTIME_TICKS_IMPLEMENTED
+	/*
+	 * Reading the counter on both sides of the clock read, and using the
+	 * midpoint, halves the error of pairing up the two.
+	 */
+	const uint64_t ticks_before = nanotime_ticks();
+	epoch->start = nanotime_now();
+	const uint64_t ticks_after = nanotime_ticks();
+	epoch->start_ticks = ticks_before + (ticks_after - ticks_before) / UINT64_C(2);
+
+	/*
+	 * The scale is recalibrated over the whole time since init, so it
+	 * becomes more accurate as the epoch object ages. It's a 32.32
+	 * fixed-point count of nanoseconds per tick.
+	 */
+	const uint64_t span = nanotime_interval(epoch->calibration_start, epoch->start, epoch->now_max);
+	const uint64_t span_ticks = epoch->start_ticks - epoch->calibration_start_ticks;
+	if (span > UINT64_C(0) && span_ticks > UINT64_C(0)) {
+		epoch->tick_scale = (uint64_t)((double)span / (double)span_ticks * 4294967296.0);
+	}
+	#else
+	epoch->start = nanotime_now();
+	epoch->start_ticks = UINT64_C(0);
+	#endif
+}
+
+void nanotime_stamp_epoch_init(nanotime_stamp_epoch* const epoch) {
+	assert(epoch != NULL);
+
+	epoch->now_max = nanotime_now_max();
+	epoch->tick_scale = UINT64_C(0);
+
+	#ifdef NANOTIME_TICKS_IMPLEMENTED
+	epoch->calibration_start_ticks = nanotime_ticks();
+	epoch->calibration_start = nanotime_now();
+	const uint64_t calibration_duration = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	do {
+		nanotime_sleep(calibration_duration);
+	} while (nanotime_interval(epoch->calibration_start, nanotime_now(), epoch->now_max) < calibration_duration);
+	#else
+	epoch->calibration_start_ticks = UINT64_C(0);
+	epoch->calibration_start = nanotime_now();
+	#endif
+
+	nanotime_stamp_epoch_begin(epoch);
+}
+
+uint64_t nanotime_stamp(const nanotime_stamp_epoch* const epoch) {
+	assert(epoch != NULL);
+
+	#ifdef NANOTIME_TICKS_IMPLEMENTED
+	const uint64_t ticks = nanotime_ticks();
+	if ((int64_t)(ticks - epoch->start_ticks) <= INT64_C(0)) {
+		return epoch->start;
+	}
+	const uint64_t offset = nanotime_mul_shift(ticks - epoch->start_ticks, epoch->tick_scale, 32u);
+	if (offset <= epoch->now_max - epoch->start) {
+		return epoch->start + offset;
+	}
+	else {
+		return offset - (epoch->now_max - epoch->start) - UINT64_C(1);
+	}
+	#else
+	return nanotime_now();
+	#endif
+}
+
+/*
+ * Alternative sleep primitives, for nanotime_sleep_select to choose from. Each
+ * has its own overshoot profile, which varies between kernel versions and
+ * configurations.
+ */
+#if defined(__linux__)
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <linux/futex.h>
+#include <sched.h>
+
+static struct timespec nanotime_timespec(const uint64_t nsec_count) {
+	struct timespec ts;
+	ts.tv_sec = (time_t)(nsec_count / NANOTIME_NSEC_PER_SEC);
+	ts.tv_nsec = (long)(nsec_count % NANOTIME_NSEC_PER_SEC);
+	return ts;
+}
+
+static void nanotime_sleep_clock_nanosleep(uint64_t nsec_count) {
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+		return;
+	}
+	const uint64_t deadline = (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec + nsec_count;
+	const struct timespec req = nanotime_timespec(deadline);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL) == EINTR);
+}
+
+static void nanotime_sleep_timerfd(uint64_t nsec_count) {
+	if (nsec_count == UINT64_C(0)) {
+		/* A zero it_value disarms a timer rather than expiring it. */
+		nsec_count = UINT64_C(1);
+	}
+	const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	struct itimerspec spec;
+	spec.it_interval = nanotime_timespec(UINT64_C(0));
+	spec.it_value = nanotime_timespec(nsec_count);
+	if (timerfd_settime(fd, 0, &spec, NULL) == 0) {
+		uint64_t expirations;
+		while (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+	}
+	close(fd);
+}
+
+static void nanotime_sleep_epoll(uint64_t nsec_count) {
+	/*
+	 * A single empty epoll set is shared by all threads, which is safe to
+	 * wait on concurrently. The timeout only has millisecond resolution, so
+	 * it's rounded up. The descriptor is kept in a uint64_t for the atomic
+	 * operations, UINT64_MAX until it's created.
+	 */
+	static uint64_t epoll_fd = UINT64_MAX;
+	int fd;
+	uint64_t shared_fd = NANOTIME_ATOMIC_LOAD(&epoll_fd);
+	if (shared_fd == UINT64_MAX) {
+		fd = epoll_create1(EPOLL_CLOEXEC);
+		if (fd < 0) {
+			return;
+		}
+		if (!NANOTIME_ATOMIC_CAS(&epoll_fd, &shared_fd, (uint64_t)fd)) {
+			close(fd);
+			fd = (int)shared_fd;
+		}
+	}
+	else {
+		fd = (int)shared_fd;
+	}
+	const uint64_t nsec_per_msec = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	const uint64_t msec_count = (nsec_count + nsec_per_msec - UINT64_C(1)) / nsec_per_msec;
+	struct epoll_event event;
+	(void)epoll_wait(fd, &event, 1, msec_count > (uint64_t)INT32_MAX ? INT32_MAX : (int)msec_count);
+}
+
+static void nanotime_sleep_futex(uint64_t nsec_count) {
+	/*
+	 * Nothing ever wakes this futex, so the wait only ends by timing out.
+	 */
+	uint32_t word = UINT32_C(0);
+	const struct timespec timeout = nanotime_timespec(nsec_count);
+	(void)syscall(SYS_futex, &word, FUTEX_WAIT_PRIVATE, 0, &timeout, NULL, 0);
+}
+
+static void nanotime_sleep_sched_yield(uint64_t nsec_count) {
+	(void)nsec_count;
+	(void)sched_yield();
+}
+
+static const nanotime_sleep_primitive nanotime_sleep_primitive_table[] = {
+	{ "nanosleep", nanotime_sleep },
+	{ "clock_nanosleep", nanotime_sleep_clock_nanosleep },
+	{ "timerfd", nanotime_sleep_timerfd },
+	{ "epoll_wait", nanotime_sleep_epoll },
+	{ "futex", nanotime_sleep_futex },
+	{ "sched_yield", nanotime_sleep_sched_yield }
+};
+#define NANOTIME_SLEEP_PRIMITIVES_IMPLEMENTED
+#endif
+
+#ifndef NANOTIME_SLEEP_PRIMITIVES_IMPLEMENTED
+static void nanotime_sleep_yield(uint64_t nsec_count) {
+	(void)nsec_count;
+	nanotime_yield();
+}
+
+static const nanotime_sleep_primitive nanotime_sleep_primitive_table[] = {
+	{ "nanotime_sleep", nanotime_sleep },
+	{ "nanotime_yield", nanotime_sleep_yield }
+};
+#define NANOTIME_SLEEP_PRIMITIVES_IMPLEMENTED
+#endif
+
+#define NANOTIME_SLEEP_PRIMITIVES_COUNT (sizeof(nanotime_sleep_primitive_table) / sizeof(nanotime_sleep_primitive_table[0]))
+
+size_t nanotime_sleep_primitives(const nanotime_sleep_primitive** const primitives) {
+	assert(primitives != NULL);
+
+	*primitives = nanotime_sleep_primitive_table;
+	return NANOTIME_SLEEP_PRIMITIVES_COUNT;
+}
+
+void nanotime_sleep_select(nanotime_sleep_selection* const selection, const uint64_t benchmark_duration) {
+	assert(selection != NULL);
+
+	/*
+	 * The requests mirror what the stepper makes: coarse requests are
+	 * 1ms, and fine requests are short, with a zero-duration request in
+	 * between each. The candidates are sampled round-robin, so changes in
+	 * system load during the benchmark affect them all alike.
+	 */
+	const uint64_t coarse_request = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	const uint64_t fine_request = NANOTIME_NSEC_PER_SEC / UINT64_C(100000);
+	const uint64_t now_max = nanotime_now_max();
+	uint64_t coarse_error[NANOTIME_SLEEP_PRIMITIVES_COUNT] = { 0 };
+	uint64_t fine_error[NANOTIME_SLEEP_PRIMITIVES_COUNT] = { 0 };
+	uint64_t fine_slept[NANOTIME_SLEEP_PRIMITIVES_COUNT] = { 0 };
+	uint64_t coarse_samples = UINT64_C(0);
+	uint64_t fine_samples = UINT64_C(0);
+
+	const uint64_t benchmark_start = nanotime_now();
+	do {
+		for (size_t i = 0u; i < NANOTIME_SLEEP_PRIMITIVES_COUNT; i++) {
+			const uint64_t start = nanotime_now();
+			nanotime_sleep_primitive_table[i].sleep(coarse_request);
+			const uint64_t slept = nanotime_interval(start, nanotime_now(), now_max);
+			coarse_error[i] += slept > coarse_request ? slept - coarse_request : coarse_request - slept;
+		}
+		coarse_samples++;
+
+		/*
+		 * Fine requests are much cheaper, so more of them are taken per
+		 * round, keeping the time split roughly evenly between the two
+		 * phases.
+		 */
+		for (int round = 0; round < 8; round++) {
+			for (size_t i = 0u; i < NANOTIME_SLEEP_PRIMITIVES_COUNT; i++) {
+				const uint64_t request = round % 2 == 0 ? fine_request : UINT64_C(0);
+				const uint64_t start = nanotime_now();
+				nanotime_sleep_primitive_table[i].sleep(request);
+				const uint64_t slept = nanotime_interval(start, nanotime_now(), now_max);
+				fine_error[i] += slept > request ? slept - request : request - slept;
+				if (request > UINT64_C(0)) {
+					fine_slept[i] += slept;
+				}
+			}
+			fine_samples++;
+		}
+	} while (nanotime_interval(benchmark_start, nanotime_now(), now_max) < benchmark_duration);
+
+	/*
+	 * Primitives that return well before the requested time, like
+	 * sched_yield, have low error for short requests, but would turn the
+	 * stepper's fine phase into a CPU-hogging spin of wakeups, so they're
+	 * measured but not chosen. nanotime_sleep, being first, is the
+	 * fallback for both phases.
+	 */
+	size_t coarse = 0u;
+	size_t fine = 0u;
+	for (size_t i = 1u; i < NANOTIME_SLEEP_PRIMITIVES_COUNT; i++) {
+		const bool honors_duration = fine_slept[i] / (fine_samples / UINT64_C(2)) >= fine_request / UINT64_C(2);
+		if (!honors_duration) {
+			continue;
+		}
+		if (coarse_error[i] < coarse_error[coarse]) {
+			coarse = i;
+		}
+		if (fine_error[i] < fine_error[fine]) {
+			fine = i;
+		}
+	}
+	selection->coarse = &nanotime_sleep_primitive_table[coarse];
+	selection->fine = &nanotime_sleep_primitive_table[fine];
+	selection->coarse_error = coarse_error[coarse] / coarse_samples;
+	selection->fine_error = fine_error[fine] / fine_samples;
+}
+
+void nanotime_step_init_auto(
+	nanotime_step_data* const stepper,
+	const uint64_t sleep_duration,
+	const uint64_t benchmark_duration,
+	nanotime_sleep_selection* const selection
+) {
+	assert(stepper != NULL);
+
+	nanotime_sleep_selection current_selection;
+	nanotime_sleep_select(&current_selection, benchmark_duration);
+	if (selection != NULL) {
+		*selection = current_selection;
+	}
+
+	nanotime_step_init(stepper, sleep_duration, nanotime_now_max(), nanotime_now, current_selection.coarse->sleep);
+	nanotime_step_set_fine_sleep(stepper, current_selection.fine->sleep);
+
+	/*
+	 * Restart the timeline, so the time taken measuring the zero-duration
+	 * sleep of the fine primitive isn't counted in the first step.
+	 */
+	stepper->sleep_point = nanotime_now();
+}
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Reads a small file in directory into buffer, null-terminated, returning
+ * false if it couldn't be read.
+ */
+static bool nanotime_cpu_quota_file(const char* const directory, const char* const name, char* const buffer, const size_t size) {
+	char path[512];
+	size_t length = 0u;
+	for (const char* c = directory; *c != '\0'; c++) {
+		if (length + 1u >= sizeof(path)) {
+			return false;
+		}
+		path[length++] = *c;
+	}
+	if (length + 1u >= sizeof(path)) {
+		return false;
+	}
+	path[length++] = '/';
+	for (const char* c = name; *c != '\0'; c++) {
+		if (length + 1u >= sizeof(path)) {
+			return false;
+		}
+		path[length++] = *c;
+	}
+	path[length] = '\0';
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	size_t total = 0u;
+	ssize_t count;
+	while (total + 1u < size && (count = read(fd, buffer + total, size - total - 1u)) > 0) {
+		total += (size_t)count;
+	}
+	close(fd);
+	buffer[total] = '\0';
+	return total > 0u;
+}
+
+static const char* nanotime_cpu_quota_number(const char* text, uint64_t* const number) {
+	while (*text == ' ' || *text == '\t') {
+		text++;
+	}
+	if (*text < '0' || *text > '9') {
+		return NULL;
+	}
+	*number = UINT64_C(0);
+	while (*text >= '0' && *text <= '9') {
+		*number = *number * UINT64_C(10) + (uint64_t)(*text - '0');
+		text++;
+	}
+	return text;
+}
+
+/*
+ * Finds the value of the line of cpu.stat starting with key, leaving number
+ * unchanged if there's no such line.
+ */
+static void nanotime_cpu_quota_stat(const char* text, const char* const key, uint64_t* const number) {
+	while (*text != '\0') {
+		const char* k = key;
+		const char* t = text;
+		while (*k != '\0' && *t == *k) {
+			k++;
+			t++;
+		}
+		if (*k == '\0' && *t == ' ') {
+			nanotime_cpu_quota_number(t, number);
+			return;
+		}
+		while (*text != '\0' && *text != '\n') {
+			text++;
+		}
+		if (*text == '\n') {
+			text++;
+		}
+	}
+}
+
+bool nanotime_cpu_quota_read(nanotime_cpu_quota* const quota, const char* const directory) {
+	assert(quota != NULL);
+
+	quota->directory = directory != NULL ? directory : "/sys/fs/cgroup";
+
+	/* cpu.max is "<quota> <period>", with a quota of "max" for no limit. */
+	char buffer[1024];
+	if (!nanotime_cpu_quota_file(quota->directory, "cpu.max", buffer, sizeof(buffer))) {
+		return false;
+	}
+	const char* text = buffer;
+	if (text[0] == 'm' && text[1] == 'a' && text[2] == 'x') {
+		quota->quota = UINT64_C(0);
+		text += 3;
+	}
+	else if ((text = nanotime_cpu_quota_number(text, &quota->quota)) == NULL) {
+		return false;
+	}
+	if (nanotime_cpu_quota_number(text, &quota->period) == NULL || quota->period == UINT64_C(0)) {
+		return false;
+	}
+
+	/*
+	 * The throttling counters are only present when the cpu controller is
+	 * enabled for the group, so they're left at zero when missing.
+	 */
+	quota->usage = UINT64_C(0);
+	quota->periods = UINT64_C(0);
+	quota->throttled_periods = UINT64_C(0);
+	quota->throttled_duration = UINT64_C(0);
+	if (nanotime_cpu_quota_file(quota->directory, "cpu.stat", buffer, sizeof(buffer))) {
+		nanotime_cpu_quota_stat(buffer, "usage_usec", &quota->usage);
+		nanotime_cpu_quota_stat(buffer, "nr_periods", &quota->periods);
+		nanotime_cpu_quota_stat(buffer, "nr_throttled", &quota->throttled_periods);
+		nanotime_cpu_quota_stat(buffer, "throttled_usec", &quota->throttled_duration);
+	}
+	return true;
+}
+#else
+bool nanotime_cpu_quota_read(nanotime_cpu_quota* const quota, const char* const directory) {
+	assert(quota != NULL);
+
+	(void)directory;
+	return false;
+}
+#endif
+
+/*
+ * The spin budget for a quota, when no throttling has been seen: an eighth of
+ * the CPU time the quota allows per step, leaving the rest for the work done
+ * between steps.
+ */
+static uint64_t nanotime_cpu_quota_spin_budget(const nanotime_cpu_quota* const quota, const uint64_t sleep_duration) {
+	if (quota->quota == UINT64_C(0)) {
+		return UINT64_MAX;
+	}
+	return (uint64_t)((double)sleep_duration * (double)quota->quota / (double)quota->period / 8.0);
+}
+
+static void nanotime_cpu_quota_poll(nanotime_step_data* const stepper) {
+	nanotime_cpu_quota* const quota = (nanotime_cpu_quota*)stepper->poll_user;
+	const uint64_t throttled_periods = quota->throttled_periods;
+	if (!nanotime_cpu_quota_read(quota, quota->directory)) {
+		return;
+	}
+
+	const uint64_t budget = nanotime_cpu_quota_spin_budget(quota, stepper->sleep_duration);
+	if (quota->throttled_periods > throttled_periods) {
+		stepper->stats.throttle_events += quota->throttled_periods - throttled_periods;
+		stepper->spin_budget = (stepper->spin_budget < budget ? stepper->spin_budget : budget) / UINT64_C(2);
+	}
+	else if (budget == UINT64_MAX || stepper->spin_budget >= budget / UINT64_C(2)) {
+		stepper->spin_budget = budget;
+	}
+	else {
+		/* Recover gradually, as throttling might resume. */
+		stepper->spin_budget = stepper->spin_budget > UINT64_C(1000) ? stepper->spin_budget * UINT64_C(2) : UINT64_C(1000);
+		if (stepper->spin_budget > budget) {
+			stepper->spin_budget = budget;
+		}
+	}
+}
+
+bool nanotime_step_set_cpu_quota(
+	nanotime_step_data* const stepper,
+	nanotime_cpu_quota* const quota,
+	const char* const directory,
+	const uint64_t poll_interval
+) {
+	assert(stepper != NULL);
+	assert(quota != NULL);
+	assert(poll_interval > UINT64_C(0));
+
+	if (!nanotime_cpu_quota_read(quota, directory)) {
+		return false;
+	}
+	stepper->spin_budget = nanotime_cpu_quota_spin_budget(quota, stepper->sleep_duration);
+	stepper->poll = nanotime_cpu_quota_poll;
+	stepper->poll_user = quota;
+	stepper->poll_interval = poll_interval;
+	stepper->poll_elapsed = stepper->stats.elapsed_duration;
+	return true;
+}
+
+#if defined(__linux__)
+#include <sys/timerfd.h>
+#include <errno.h>
+
+static void nanotime_step_timer_wait(nanotime_step_data* const stepper, const uint64_t deadline) {
+	nanotime_step_timer* const timer = (nanotime_step_timer*)stepper->coarse_wait_user;
+	const uint64_t now_max = stepper->now_max;
+	const uint64_t expiration = nanotime_interval(timer->lead, deadline, now_max);
+
+	/*
+	 * The timer stays phase-aligned with the deadlines as long as they're
+	 * a whole number of periods after the first expiration; otherwise, as
+	 * after a reset, or when due for drift correction, it's rearmed.
+	 */
+	uint64_t since = nanotime_interval(timer->first_expiration, expiration, now_max);
+	if (
+		!timer->armed ||
+		timer->period != stepper->sleep_duration ||
+		since > now_max / UINT64_C(2) ||
+		since % timer->period != UINT64_C(0) ||
+		since >= NANOTIME_NSEC_PER_SEC
+	) {
+		const uint64_t remaining = nanotime_interval(nanotime_now(), expiration, now_max);
+		if (remaining == UINT64_C(0) || remaining > now_max / UINT64_C(2)) {
+			return;
+		}
+		struct itimerspec spec;
+		spec.it_value.tv_sec = (time_t)(remaining / NANOTIME_NSEC_PER_SEC);
+		spec.it_value.tv_nsec = (long)(remaining % NANOTIME_NSEC_PER_SEC);
+		spec.it_interval.tv_sec = (time_t)(stepper->sleep_duration / NANOTIME_NSEC_PER_SEC);
+		spec.it_interval.tv_nsec = (long)(stepper->sleep_duration % NANOTIME_NSEC_PER_SEC);
+		timer->syscalls++;
+		if (timerfd_settime(timer->fd, 0, &spec, NULL) != 0) {
+			timer->armed = false;
+			return;
+		}
+		timer->armed = true;
+		timer->period = stepper->sleep_duration;
+		timer->first_expiration = expiration;
+		timer->expirations = UINT64_C(0);
+		since = UINT64_C(0);
+	}
+
+	/*
+	 * Expirations of periods the stepper skipped are still pending, so
+	 * they're read through until the expiration for this deadline, which
+	 * returns at once if it's already passed.
+	 */
+	const uint64_t index = since / timer->period;
+	timer->waits++;
+	while (timer->expirations <= index) {
+		uint64_t count;
+		timer->syscalls++;
+		if (read(timer->fd, &count, sizeof(count)) == (ssize_t)sizeof(count)) {
+			timer->expirations += count;
+		}
+		else if (errno != EINTR) {
+			timer->armed = false;
+			return;
+		}
+	}
+}
+
+bool nanotime_step_set_timer(nanotime_step_data* const stepper, nanotime_step_timer* const timer, const uint64_t lead) {
+	assert(stepper != NULL);
+	assert(timer != NULL);
+	assert(lead < stepper->sleep_duration);
+
+	timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer->fd < 0) {
+		return false;
+	}
+	timer->lead = lead;
+	timer->period = UINT64_C(0);
+	timer->first_expiration = UINT64_C(0);
+	timer->expirations = UINT64_C(0);
+	timer->armed = false;
+	timer->waits = UINT64_C(0);
+	timer->syscalls = UINT64_C(0);
+	stepper->coarse_wait = nanotime_step_timer_wait;
+	stepper->coarse_wait_user = timer;
+	return true;
+}
+
+void nanotime_step_timer_close(nanotime_step_data* const stepper, nanotime_step_timer* const timer) {
+	assert(stepper != NULL);
+	assert(timer != NULL);
+
+	if (stepper->coarse_wait_user == timer) {
+		stepper->coarse_wait = NULL;
+		stepper->coarse_wait_user = NULL;
+	}
+	close(timer->fd);
+	timer->fd = -1;
+}
+#else
+bool nanotime_step_set_timer(nanotime_step_data* const stepper, nanotime_step_timer* const timer, const uint64_t lead) {
+	assert(stepper != NULL);
+	assert(timer != NULL);
+
+	(void)lead;
+	return false;
+}
+
+void nanotime_step_timer_close(nanotime_step_data* const stepper, nanotime_step_timer* const timer) {
+	assert(stepper != NULL);
+	assert(timer != NULL);
+}
+#endif
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+
+nanotime_step_clock* nanotime_step_clock_map(const char* const name, const bool create) {
+	assert(name != NULL);
+
+	HANDLE mapping;
+	if (create) {
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)sizeof(nanotime_step_clock), name);
+	}
+	else {
+		mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	}
+	if (mapping == NULL) {
+		return NULL;
+	}
+
+	/* The view keeps the mapping alive, so its handle isn't needed. */
+	void* const view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(nanotime_step_clock));
+	CloseHandle(mapping);
+	return (nanotime_step_clock*)view;
+}
+
+void nanotime_step_clock_unmap(nanotime_step_clock* const clock) {
+	assert(clock != NULL);
+
+	UnmapViewOfFile(clock);
+}
+
+void nanotime_step_clock_unlink(const char* const name) {
+	assert(name != NULL);
+}
+#elif defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+nanotime_step_clock* nanotime_step_clock_map(const char* const name, const bool create) {
+	assert(name != NULL);
+
+	const int fd = shm_open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	/*
+	 * New shared memory is zeroed, so the clock reads as uninitialized. It's
+	 * only sized when it has no size yet, as macOS rejects resizing shared
+	 * memory, such as that left behind by an earlier publisher.
+	 */
+	if (create) {
+		struct stat status;
+		bool sized = fstat(fd, &status) == 0;
+		if (sized && status.st_size == 0) {
+			sized = ftruncate(fd, (off_t)sizeof(nanotime_step_clock)) == 0;
+		}
+		else if (sized) {
+			sized = (uint64_t)status.st_size >= (uint64_t)sizeof(nanotime_step_clock);
+		}
+		if (!sized) {
+			close(fd);
+			return NULL;
+		}
+	}
+	void* const memory = mmap(NULL, sizeof(nanotime_step_clock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return memory != MAP_FAILED ? (nanotime_step_clock*)memory : NULL;
+}
+
+void nanotime_step_clock_unmap(nanotime_step_clock* const clock) {
+	assert(clock != NULL);
+
+	munmap(clock, sizeof(nanotime_step_clock));
+}
+
+void nanotime_step_clock_unlink(const char* const name) {
+	assert(name != NULL);
+
+	shm_unlink(name);
+}
+#else
+nanotime_step_clock* nanotime_step_clock_map(const char* const name, const bool create) {
+	assert(name != NULL);
+
+	(void)create;
+	return NULL;
+}
+
+void nanotime_step_clock_unmap(nanotime_step_clock* const clock) {
+	assert(clock != NULL);
+}
+
+void nanotime_step_clock_unlink(const char* const name) {
+	assert(name != NULL);
+}
+#endif
+
+/*
+ * The steppers of nanotime_precise_sleep are thread-local where the compiler
+ * supports it; otherwise, each sleep calibrates a new stepper.
+ */
+#if defined(__cplusplus) && (__cplusplus >= 201103L)
+#define NANOTIME_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define NANOTIME_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#define NANOTIME_THREAD_LOCAL _Thread_local
+#elif defined(__GNUC__) || defined(__clang__)
+#define NANOTIME_THREAD_LOCAL __thread
+#endif
+
+static uint64_t nanotime_precise_sleep_with(nanotime_step_data* const stepper, const uint64_t nsec_count) {
+	assert(nsec_count <= stepper->now_max / UINT64_C(2));
+
+	const uint64_t now = nanotime_now();
+	const uint64_t max = stepper->now_max;
+	const uint64_t deadline = nsec_count <= max - now ? now + nsec_count : nsec_count - (max - now) - UINT64_C(1);
+	nanotime_wait_result result;
+	nanotime_wait_until(stepper, deadline, &result);
+	return result.deviation;
+}
+
+#ifdef NANOTIME_THREAD_LOCAL
+static NANOTIME_THREAD_LOCAL bool nanotime_precise_sleep_initialized = false;
+static NANOTIME_THREAD_LOCAL nanotime_step_data nanotime_precise_sleep_data;
+
+nanotime_step_data* nanotime_precise_sleep_stepper() {
+	if (!nanotime_precise_sleep_initialized) {
+		nanotime_step_init(&nanotime_precise_sleep_data, NANOTIME_NSEC_PER_SEC / UINT64_C(60), nanotime_now_max(), nanotime_now, nanotime_sleep);
+		nanotime_precise_sleep_initialized = true;
+	}
+	return &nanotime_precise_sleep_data;
+}
+
+uint64_t nanotime_precise_sleep(const uint64_t nsec_count) {
+	return nanotime_precise_sleep_with(nanotime_precise_sleep_stepper(), nsec_count);
+}
+#else
+nanotime_step_data* nanotime_precise_sleep_stepper() {
+	return NULL;
+}
+
+uint64_t nanotime_precise_sleep(const uint64_t nsec_count) {
+	nanotime_step_data stepper;
+	nanotime_step_init(&stepper, NANOTIME_NSEC_PER_SEC / UINT64_C(60), nanotime_now_max(), nanotime_now, nanotime_sleep);
+	return nanotime_precise_sleep_with(&stepper, nsec_count);
+}
+#endif
+
+#endif
+
+
+#ifdef NANOTIME_IMPLEMENTATION
+
+uint64_t nanotime_interval(const uint64_t start, const uint64_t end, const uint64_t max) {
+	assert(max > UINT64_C(0));
+	assert(start <= max);
+	assert(end <= max);
+
+	if (end >= start) {
+		return end - start;
+	}
+	else {
+		return end + (max - start) + UINT64_C(1);
+	}
+}
+
+void nanotime_timeline_init(nanotime_timeline* const timeline, const uint64_t start, const uint64_t max) {
+	assert(timeline != NULL);
+	assert(max > UINT64_C(0));
+	assert(start <= max);
+
+	timeline->max = max;
+	timeline->last = start;
+	timeline->elapsed = UINT64_C(0);
+	timeline->wraps = UINT64_C(0);
+}
+
+uint64_t nanotime_timeline_extend(nanotime_timeline* const timeline, const uint64_t timestamp) {
+	assert(timeline != NULL);
+
+	if (timestamp < timeline->last) {
+		timeline->wraps++;
+	}
+	timeline->elapsed += nanotime_interval(timeline->last, timestamp, timeline->max);
+	timeline->last = timestamp;
+	return timeline->elapsed;
+}
+
+#if !defined(NANOTIME_NO_SIMD) && defined(__AVX2__)
+#define NANOTIME_SIMD_AVX2
+#include <immintrin.h>
+
+/*
+ * AVX2 only has signed 64-bit comparisons, so unsigned comparisons are made by
+ * flipping the sign bits first.
+ */
+static __m256i nanotime_avx2_greater(const __m256i a, const __m256i b) {
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+	return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+}
+
+/*
+ * AVX2 has no 64-bit integer conversion to double, so each half is converted
+ * exactly by placing it in the mantissa of a double of a known exponent, then
+ * the halves are added.
+ */
+static __m256d nanotime_avx2_to_double(const __m256i values) {
+	const __m256i low = _mm256_blend_epi32(values, _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0 /* 2^52 */)), 0xAA);
+	const __m256i high = _mm256_or_si256(_mm256_srli_epi64(values, 32), _mm256_castpd_si256(_mm256_set1_pd(19342813113834066795298816.0 /* 2^84 */)));
+	const __m256d high_value = _mm256_sub_pd(_mm256_castsi256_pd(high), _mm256_set1_pd(19342813118337666422669312.0 /* 2^84 + 2^52 */));
+	return _mm256_add_pd(high_value, _mm256_castsi256_pd(low));
+}
+#elif !defined(NANOTIME_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#define NANOTIME_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+void nanotime_intervals(const uint64_t* const timestamps, const size_t count, const uint64_t max, uint64_t* const intervals) {
+	assert(timestamps != NULL || count == 0u);
+	assert(intervals != NULL || count < 2u);
+	assert(max > UINT64_C(0));
+
+	/*
+	 * Branchlessly, the interval is end - start, plus max + 1 when end
+	 * wrapped around past max; modulo 2^64, that's the same as
+	 * nanotime_interval, and when max is UINT64_MAX, max + 1 is zero.
+	 */
+	const uint64_t period = max + UINT64_C(1);
+	size_t i = 0u;
+	#if defined(NANOTIME_SIMD_AVX2)
+	const __m256i period_vector = _mm256_set1_epi64x((long long)period);
+	for (; i + 4u < count; i += 4u) {
+		const __m256i start = _mm256_loadu_si256((const __m256i*)(timestamps + i));
+		const __m256i end = _mm256_loadu_si256((const __m256i*)(timestamps + i + 1u));
+		const __m256i wrapped = nanotime_avx2_greater(start, end);
+		const __m256i interval = _mm256_add_epi64(_mm256_sub_epi64(end, start), _mm256_and_si256(wrapped, period_vector));
+		_mm256_storeu_si256((__m256i*)(intervals + i), interval);
+	}
+	#elif defined(NANOTIME_SIMD_NEON)
+	const uint64x2_t period_vector = vdupq_n_u64(period);
+	for (; i + 2u < count; i += 2u) {
+		const uint64x2_t start = vld1q_u64(timestamps + i);
+		const uint64x2_t end = vld1q_u64(timestamps + i + 1u);
+		const uint64x2_t wrapped = vcltq_u64(end, start);
+		vst1q_u64(intervals + i, vaddq_u64(vsubq_u64(end, start), vandq_u64(wrapped, period_vector)));
+	}
+	#endif
+	for (; i + 1u < count; i++) {
+		const uint64_t start = timestamps[i];
+		const uint64_t end = timestamps[i + 1u];
+		intervals[i] = end - start + (end < start ? period : UINT64_C(0));
+	}
+}
+
+void nanotime_intervals_stats(const uint64_t* const intervals, const size_t count, nanotime_interval_stats* const stats) {
+	assert(intervals != NULL || count == 0u);
+	assert(stats != NULL);
+
+	stats->count = (uint64_t)count;
+	if (count == 0u) {
+		stats->min = UINT64_C(0);
+		stats->max = UINT64_C(0);
+		stats->mean = 0.0;
+		stats->variance = 0.0;
+		return;
+	}
+
+	/*
+	 * The variance is calculated in a second pass over the intervals, from
+	 * the differences from the mean, as the sum of squares minus the square
+	 * of the sum loses most of its precision to cancellation.
+	 */
+	uint64_t min = UINT64_MAX;
+	uint64_t max = UINT64_C(0);
+	double sum = 0.0;
+	double squares = 0.0;
+	size_t i = 0u;
+	#if defined(NANOTIME_SIMD_AVX2)
+	if (count >= 4u) {
+		__m256i min_vector = _mm256_set1_epi64x(-1);
+		__m256i max_vector = _mm256_setzero_si256();
+		__m256d sum_vector = _mm256_setzero_pd();
+		for (; i + 4u <= count; i += 4u) {
+			const __m256i values = _mm256_loadu_si256((const __m256i*)(intervals + i));
+			min_vector = _mm256_blendv_epi8(min_vector, values, nanotime_avx2_greater(min_vector, values));
+			max_vector = _mm256_blendv_epi8(max_vector, values, nanotime_avx2_greater(values, max_vector));
+			sum_vector = _mm256_add_pd(sum_vector, nanotime_avx2_to_double(values));
+		}
+		uint64_t mins[4], maxes[4];
+		double sums[4];
+		_mm256_storeu_si256((__m256i*)mins, min_vector);
+		_mm256_storeu_si256((__m256i*)maxes, max_vector);
+		_mm256_storeu_pd(sums, sum_vector);
+		for (int lane = 0; lane < 4; lane++) {
+			min = mins[lane] < min ? mins[lane] : min;
+			max = maxes[lane] > max ? maxes[lane] : max;
+		}
+		sum = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	}
+	#elif defined(NANOTIME_SIMD_NEON)
+	if (count >= 2u) {
+		uint64x2_t min_vector = vdupq_n_u64(UINT64_MAX);
+		uint64x2_t max_vector = vdupq_n_u64(UINT64_C(0));
+		float64x2_t sum_vector = vdupq_n_f64(0.0);
+		for (; i + 2u <= count; i += 2u) {
+			const uint64x2_t values = vld1q_u64(intervals + i);
+			min_vector = vbslq_u64(vcltq_u64(values, min_vector), values, min_vector);
+			max_vector = vbslq_u64(vcgtq_u64(values, max_vector), values, max_vector);
+			sum_vector = vaddq_f64(sum_vector, vcvtq_f64_u64(values));
+		}
+		for (int lane = 0; lane < 2; lane++) {
+			const uint64_t lane_min = lane == 0 ? vgetq_lane_u64(min_vector, 0) : vgetq_lane_u64(min_vector, 1);
+			const uint64_t lane_max = lane == 0 ? vgetq_lane_u64(max_vector, 0) : vgetq_lane_u64(max_vector, 1);
+			min = lane_min < min ? lane_min : min;
+			max = lane_max > max ? lane_max : max;
+		}
+		sum = vaddvq_f64(sum_vector);
+	}
+	#endif
+	for (; i < count; i++) {
+		min = intervals[i] < min ? intervals[i] : min;
+		max = intervals[i] > max ? intervals[i] : max;
+		sum += (double)intervals[i];
+	}
+	const double mean = sum / (double)count;
+
+	i = 0u;
+	#if defined(NANOTIME_SIMD_AVX2)
+	if (count >= 4u) {
+		const __m256d mean_vector = _mm256_set1_pd(mean);
+		__m256d squares_vector = _mm256_setzero_pd();
+		for (; i + 4u <= count; i += 4u) {
+			const __m256d difference = _mm256_sub_pd(nanotime_avx2_to_double(_mm256_loadu_si256((const __m256i*)(intervals + i))), mean_vector);
+			squares_vector = _mm256_add_pd(squares_vector, _mm256_mul_pd(difference, difference));
+		}
+		double lanes[4];
+		_mm256_storeu_pd(lanes, squares_vector);
+		squares = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	}
+	#elif defined(NANOTIME_SIMD_NEON)
+	if (count >= 2u) {
+		const float64x2_t mean_vector = vdupq_n_f64(mean);
+		float64x2_t squares_vector = vdupq_n_f64(0.0);
+		for (; i + 2u <= count; i += 2u) {
+			const float64x2_t difference = vsubq_f64(vcvtq_f64_u64(vld1q_u64(intervals + i)), mean_vector);
+			squares_vector = vfmaq_f64(squares_vector, difference, difference);
+		}
+		squares = vaddvq_f64(squares_vector);
+	}
+	#endif
+	for (; i < count; i++) {
+		const double difference = (double)intervals[i] - mean;
+		squares += difference * difference;
+	}
+
+	stats->min = min;
+	stats->max = max;
+	stats->mean = mean;
+	stats->variance = squares / (double)count;
+}
+
+void nanotime_intervals_histogram(const uint64_t* const intervals, const size_t count, const uint64_t bucket_width, uint64_t* const buckets, const size_t num_buckets) {
+	assert(intervals != NULL || count == 0u);
+	assert(bucket_width > UINT64_C(0));
+	assert(buckets != NULL);
+	assert(num_buckets > 0u);
+
+	/*
+	 * Neither AVX2 nor NEON can scatter increments, so the counting is
+	 * scalar, but with power-of-two widths, a shift replaces the division
+	 * per interval, which is the slowest part otherwise.
+	 */
+	const uint64_t last = (uint64_t)(num_buckets - 1u);
+	if ((bucket_width & (bucket_width - UINT64_C(1))) == UINT64_C(0)) {
+		int shift = 0;
+		while ((UINT64_C(1) << shift) < bucket_width) {
+			shift++;
+		}
+		for (size_t i = 0u; i < count; i++) {
+			const uint64_t bucket = intervals[i] >> shift;
+			buckets[bucket < last ? bucket : last]++;
+		}
+	}
+	else {
+		for (size_t i = 0u; i < count; i++) {
+			const uint64_t bucket = intervals[i] / bucket_width;
+			buckets[bucket < last ? bucket : last]++;
+		}
+	}
+}
+
+/*
+ * The stepper's clock and sleep functions are called through these, to handle
+ * both the plain and context-carrying kinds.
+ */
+static uint64_t nanotime_step_now(nanotime_step_data* const stepper) {
+	stepper->stats.clock_reads++;
+	return stepper->now != NULL ? stepper->now() : stepper->now_user(stepper->user);
+}
+
+static void nanotime_step_sleep(const nanotime_step_data* const stepper, const uint64_t nsec_count) {
+	if (stepper->sleep != NULL) {
+		stepper->sleep(nsec_count);
+	}
+	else {
+		stepper->sleep_user(stepper->user, nsec_count);
+	}
+}
+
+static void nanotime_step_fine_sleep(const nanotime_step_data* const stepper, const uint64_t nsec_count) {
+	if (stepper->fine_sleep != NULL) {
+		stepper->fine_sleep(nsec_count);
+	}
+	else {
+		stepper->fine_sleep_user(stepper->user, nsec_count);
+	}
+}
+
+static void nanotime_step_yield(const nanotime_step_data* const stepper) {
+	if (stepper->yield != NULL) {
+		stepper->yield();
+	}
+	else {
+		stepper->yield_user(stepper->user);
+	}
+}
+
+/*
+ * The parts of initialization common to all the ways of initializing, done
+ * after the clock and sleep functions are set.
+ */
+static void nanotime_step_init_common(nanotime_step_data* const stepper, const uint64_t sleep_duration, const uint64_t now_max) {
+	assert(sleep_duration > UINT64_C(0));
+	assert(now_max > UINT64_C(0));
+
+	/*
+	 * The stepper compares the current time against the previous sleep
+	 * point, that can be up to a step plus the reset threshold old, so that
+	 * has to be well within one wrap period of the timestamps.
+	 */
+	assert(sleep_duration + NANOTIME_NSEC_PER_SEC / UINT64_C(10) < now_max / UINT64_C(2));
+
+	stepper->sleep_duration = sleep_duration;
+	stepper->now_max = now_max;
+
+	stepper->jitter_target = UINT64_C(0);
+	stepper->coarse_duration = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	stepper->shift = UINT64_C(4);
+	stepper->zero_sleeps = true;
+	stepper->adapt_steps = UINT64_C(0);
+	stepper->adapt_deviation = UINT64_C(0);
+
+	stepper->catch_up = NANOTIME_STEP_CATCH_UP_RESET;
+	stepper->catch_up_limit = UINT64_C(0);
+	stepper->spread_debt = UINT64_C(0);
+	stepper->spread_slice = UINT64_C(0);
+
+	stepper->spin_budget = UINT64_MAX;
+	stepper->poll = NULL;
+	stepper->poll_user = NULL;
+	stepper->poll_interval = UINT64_C(0);
+	stepper->poll_elapsed = UINT64_C(0);
+
+	stepper->coarse_wait = NULL;
+	stepper->coarse_wait_user = NULL;
+
+	stepper->registration = NULL;
+
+	stepper->stats.steps = UINT64_C(0);
+	stepper->stats.skips = UINT64_C(0);
+	stepper->stats.resets = UINT64_C(0);
+	stepper->stats.wakeups = UINT64_C(0);
+	stepper->stats.elapsed_duration = UINT64_C(0);
+	stepper->stats.spin_duration = UINT64_C(0);
+	stepper->stats.yields = UINT64_C(0);
+	stepper->stats.deviation = UINT64_C(0);
+	stepper->stats.dropped_ticks = UINT64_C(0);
+	stepper->stats.owed_ticks = UINT64_C(0);
+	stepper->stats.clock_reads = UINT64_C(0);
+	stepper->stats.step_clock_reads = UINT64_C(0);
+	stepper->stats.throttle_events = UINT64_C(0);
+
+	const uint64_t start = nanotime_step_now(stepper);
+	nanotime_step_fine_sleep(stepper, UINT64_C(0));
+	stepper->zero_sleep_duration = nanotime_interval(start, nanotime_step_now(stepper), now_max);
+	stepper->yield_duration = UINT64_C(0);
+	stepper->accumulator = UINT64_C(0);
+
+	/*
+	 * This should be last here, so the sleep point is close to what it
+	 * should be.
+	 */
+	stepper->sleep_point = nanotime_step_now(stepper);
+}
+
+void nanotime_step_init(
+	nanotime_step_data* const stepper,
+	const uint64_t sleep_duration,
+	const uint64_t now_max,
+	uint64_t (* const now)(),
+	void (* const sleep)(uint64_t nsec_count)
+) {
+	assert(stepper != NULL);
+	assert(now != NULL);
+	assert(sleep != NULL);
+
+	stepper->now = now;
+	stepper->sleep = sleep;
+	stepper->fine_sleep = sleep;
+	stepper->yield = NULL;
+	stepper->user = NULL;
+	stepper->now_user = NULL;
+	stepper->sleep_user = NULL;
+	stepper->fine_sleep_user = NULL;
+	stepper->yield_user = NULL;
+
+	nanotime_step_init_common(stepper, sleep_duration, now_max);
+}
+
+void nanotime_step_init_user(
+	nanotime_step_data* const stepper,
+	const uint64_t sleep_duration,
+	const uint64_t now_max,
+	void* const user,
+	uint64_t (* const now)(void* user),
+	void (* const sleep)(void* user, uint64_t nsec_count)
+) {
+	assert(stepper != NULL);
+	assert(now != NULL);
+	assert(sleep != NULL);
+
+	stepper->now = NULL;
+	stepper->sleep = NULL;
+	stepper->fine_sleep = NULL;
+	stepper->yield = NULL;
+	stepper->user = user;
+	stepper->now_user = now;
+	stepper->sleep_user = sleep;
+	stepper->fine_sleep_user = sleep;
+	stepper->yield_user = NULL;
+
+	nanotime_step_init_common(stepper, sleep_duration, now_max);
+}
+
+void nanotime_step_set_adaptive(nanotime_step_data* const stepper, const uint64_t jitter_target) {
+	assert(stepper != NULL);
+
+	stepper->jitter_target = jitter_target;
+	stepper->coarse_duration = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	stepper->shift = UINT64_C(4);
+	stepper->zero_sleeps = true;
+	stepper->adapt_steps = UINT64_C(0);
+	stepper->adapt_deviation = UINT64_C(0);
+}
+
+void nanotime_step_set_catch_up(nanotime_step_data* const stepper, const nanotime_step_catch_up catch_up, const uint64_t limit) {
+	assert(stepper != NULL);
+	assert(catch_up != NANOTIME_STEP_CATCH_UP_SPREAD || limit > UINT64_C(0));
+
+	stepper->catch_up = catch_up;
+	stepper->catch_up_limit = limit;
+	stepper->spread_debt = UINT64_C(0);
+	stepper->spread_slice = UINT64_C(0);
+}
+
+/*
+ * Measures the yield function just set, if any.
+ */
+static void nanotime_step_measure_yield(nanotime_step_data* const stepper) {
+	if (stepper->yield == NULL && stepper->yield_user == NULL) {
+		stepper->yield_duration = UINT64_C(0);
+		return;
+	}
+	const uint64_t start = nanotime_step_now(stepper);
+	nanotime_step_yield(stepper);
+	stepper->yield_duration = nanotime_interval(start, nanotime_step_now(stepper), stepper->now_max);
+}
+
+void nanotime_step_set_yield(nanotime_step_data* const stepper, void (* const yield)()) {
+	assert(stepper != NULL);
+
+	stepper->yield = yield;
+	stepper->yield_user = NULL;
+	nanotime_step_measure_yield(stepper);
+}
+
+void nanotime_step_set_yield_user(nanotime_step_data* const stepper, void (* const yield)(void* user)) {
+	assert(stepper != NULL);
+
+	stepper->yield = NULL;
+	stepper->yield_user = yield;
+	nanotime_step_measure_yield(stepper);
+}
+
+void nanotime_step_set_fine_sleep(nanotime_step_data* const stepper, void (* const fine_sleep)(uint64_t nsec_count)) {
+	assert(stepper != NULL);
+	assert(fine_sleep != NULL);
+
+	stepper->fine_sleep = fine_sleep;
+	stepper->fine_sleep_user = NULL;
+
+	const uint64_t start = nanotime_step_now(stepper);
+	fine_sleep(UINT64_C(0));
+	stepper->zero_sleep_duration = nanotime_interval(start, nanotime_step_now(stepper), stepper->now_max);
+}
+
+/*
+ * Count of sleeping steps over which the worst deviation is collected before
+ * the adaptive mode retunes the stepper.
+ */
+#define NANOTIME_STEP_ADAPT_WINDOW UINT64_C(64)
+
+static void nanotime_step_adapt(nanotime_step_data* const stepper, const uint64_t deviation) {
+	if (deviation > stepper->adapt_deviation) {
+		stepper->adapt_deviation = deviation;
+	}
+	if (++stepper->adapt_steps < NANOTIME_STEP_ADAPT_WINDOW) {
+		return;
+	}
+
+	/*
+	 * The tuning is a ladder, from most precise to fewest wakeups: the
+	 * zero-duration sleeps are dropped first, then the shift divisor is
+	 * lowered, so the Zeno loop takes fewer and larger steps, then the
+	 * coarse sleep duration is grown. One rung is moved per window, down
+	 * when the worst deviation seen is comfortably within the target, up
+	 * when it exceeded the target.
+	 */
+	const uint64_t min_coarse_duration = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
+	uint64_t max_coarse_duration = stepper->sleep_duration / UINT64_C(4);
+	if (max_coarse_duration < min_coarse_duration) {
+		max_coarse_duration = min_coarse_duration;
+	}
+	if (stepper->adapt_deviation > stepper->jitter_target) {
+		if (stepper->coarse_duration > min_coarse_duration) {
+			stepper->coarse_duration /= UINT64_C(2);
+			if (stepper->coarse_duration < min_coarse_duration) {
+				stepper->coarse_duration = min_coarse_duration;
+			}
+		}
+		else if (stepper->shift < UINT64_C(4)) {
+			stepper->shift++;
+		}
+		else {
+			stepper->zero_sleeps = true;
+		}
+	}
+	else if (stepper->adapt_deviation <= stepper->jitter_target / UINT64_C(2)) {
+		if (stepper->zero_sleeps) {
+			stepper->zero_sleeps = false;
+		}
+		else if (stepper->shift > UINT64_C(1)) {
+			stepper->shift--;
+		}
+		else if (stepper->coarse_duration < max_coarse_duration) {
+			stepper->coarse_duration *= UINT64_C(2);
+			if (stepper->coarse_duration > max_coarse_duration) {
+				stepper->coarse_duration = max_coarse_duration;
+			}
+		}
+	}
+
+	stepper->adapt_steps = UINT64_C(0);
+	stepper->adapt_deviation = UINT64_C(0);
+}
+
+/*
+ * Applies the catch-up policy to the steps owed in the accumulator, at the end
+ * of a step.
+ */
+static void nanotime_step_catch_up_owed(nanotime_step_data* const stepper) {
+	const uint64_t owed = stepper->accumulator / stepper->sleep_duration;
+	uint64_t dropped = UINT64_C(0);
+	switch (stepper->catch_up) {
+	default:
+	case NANOTIME_STEP_CATCH_UP_RESET:
+		break;
+
+	case NANOTIME_STEP_CATCH_UP_BURST:
+		if (owed > stepper->catch_up_limit) {
+			dropped = owed - stepper->catch_up_limit;
+		}
+		break;
+
+	case NANOTIME_STEP_CATCH_UP_SPREAD:
+		/*
+		 * All the steps owed are moved out of the accumulator, so no
+		 * sleeps are skipped, and are instead fed back into it a slice
+		 * at a time over the following steps, shortening their sleeps.
+		 */
+		if (owed > UINT64_C(0)) {
+			stepper->accumulator -= owed * stepper->sleep_duration;
+			stepper->spread_debt += owed * stepper->sleep_duration;
+			const uint64_t limit = stepper->catch_up_limit * stepper->sleep_duration;
+			if (stepper->spread_debt > limit) {
+				stepper->stats.dropped_ticks += (stepper->spread_debt - limit) / stepper->sleep_duration;
+				stepper->spread_debt = limit;
+			}
+			stepper->spread_slice = (stepper->spread_debt + stepper->catch_up_limit - UINT64_C(1)) / stepper->catch_up_limit;
+		}
+		break;
+
+	case NANOTIME_STEP_CATCH_UP_DROP:
+		dropped = owed;
+		break;
+	}
+	stepper->accumulator -= dropped * stepper->sleep_duration;
+	stepper->stats.dropped_ticks += dropped;
+	stepper->stats.owed_ticks = (stepper->accumulator + stepper->spread_debt) / stepper->sleep_duration;
+}
+
+/*
+ * Returns the timestamp duration nanoseconds after point, wrapping around past
+ * max.
+ */
+static uint64_t nanotime_step_after(const uint64_t point, const uint64_t duration, const uint64_t max) {
+	if (duration <= max - point) {
+		return point + duration;
+	}
+	else {
+		return duration - (max - point) - UINT64_C(1);
+	}
+}
+
+/*
+ * Finishes a wait begun with nanotime_step_wait, or any other way, by spinning
+ * from current_time until total_sleep_duration nanoseconds past point,
+ * returning the time read at the end.
+ */
+static uint64_t nanotime_step_spin(nanotime_step_data* const stepper, const uint64_t point, const uint64_t total_sleep_duration, uint64_t current_time) {
+	/*
+	 * Finally, do a busyloop to precisely sleep up to the
+	 * deadline. The sleeping phases before this attempt to
+	 * reduce the remaining time to sleep to a minimum via
+	 * process-yielding sleeps, so the amount of time spent
+	 * spinning here is hopefully quite low.
+	 *
+	 * In testing on an M1 Mac mini running macOS,
+	 * busylooping here produces the absolute greatest
+	 * precision possible on the hardware, down to the
+	 * sub-10ns-off-per-update range for longish stretches
+	 * during 60 Hz updates, but in the
+	 * hundreds-to-thousands of nanoseconds off when using
+	 * nanotime_yield() or zero-duration sleeps. And,
+	 * because the sleeping algorithm above does such a
+	 * good job of stopping very close to the deadline,
+	 * busylooping here has basically negligible difference
+	 * in power usage vs. yields/zero-duration sleeps.
+	 *
+	 * But on oversubscribed hosts, spinning starves other
+	 * threads wanting the core, so with a yield function
+	 * set, yields are made while more time remains than
+	 * the longest yield seen this wait, keeping the
+	 * precision of pure spinning for the rest. And when
+	 * CPU time is limited, more time remaining than the
+	 * spin budget is slept instead.
+	 */
+	const uint64_t spin_start = current_time;
+	const bool yields = stepper->yield != NULL || stepper->yield_user != NULL;
+	uint64_t max = stepper->yield_duration;
+	uint64_t accumulated;
+	while ((accumulated = nanotime_interval(point, current_time, stepper->now_max)) < total_sleep_duration) {
+		if (total_sleep_duration - accumulated > stepper->spin_budget) {
+			nanotime_step_fine_sleep(stepper, total_sleep_duration - accumulated - stepper->spin_budget);
+			stepper->stats.wakeups++;
+			current_time = nanotime_step_now(stepper);
+		}
+		else if (yields && total_sleep_duration - accumulated > max) {
+			const uint64_t start = current_time;
+			nanotime_step_yield(stepper);
+			stepper->stats.yields++;
+			current_time = nanotime_step_now(stepper);
+			if ((stepper->yield_duration = nanotime_interval(start, current_time, stepper->now_max)) > max) {
+				max = stepper->yield_duration;
+			}
+		}
+		else {
+			current_time = nanotime_step_now(stepper);
+		}
+	}
+
+	stepper->stats.spin_duration += nanotime_interval(spin_start, current_time, stepper->now_max);
+	return current_time;
+}
+
+/*
+ * Waits until total_sleep_duration nanoseconds past point, with the stepper's
+ * sleeping phases, where current_time is the time at the start of the wait,
+ * returning the time read at the end of the wait, at or past the deadline.
+ * Updates the stepper's sleep calibration and its wakeups, yields and spin
+ * stats, but not its timeline.
+ */
+static uint64_t nanotime_step_wait(nanotime_step_data* const stepper, const uint64_t point, const uint64_t total_sleep_duration, uint64_t current_time) {
+	uint64_t current_sleep_duration = total_sleep_duration;
+	const uint64_t shift = stepper->shift;
+
+	/*
+	 * In adaptive mode, a sleep is allowed to wake up as late as the
+	 * jitter target past the deadline, rather than only being
+	 * allowed when it's expected to wake up before the deadline.
+	 * When zero, this is the same as the precision-first behavior.
+	 */
+	const uint64_t slack = stepper->jitter_target;
+
+	/*
+	 * None of the sleeping phases below sleep unless more than the
+	 * shortest of their sleeps remains, plus the slack, so when
+	 * the wait starts later than that, such as after an update
+	 * that ran long, go straight to finishing the wait, reusing
+	 * the start time rather than reading the clock again.
+	 */
+	const uint64_t start_point = current_time;
+	{
+		const uint64_t shortest = stepper->zero_sleep_duration < stepper->coarse_duration ? stepper->zero_sleep_duration : stepper->coarse_duration;
+		if (nanotime_interval(point, start_point, stepper->now_max) + shortest >= total_sleep_duration + slack) {
+			goto wait_spin;
+		}
+	}
+
+	/*
+	 * The algorithm implemented here takes the assumption that a
+	 * sequence of repeated sleep requests of the same requested
+	 * duration end up being approximately of equal actual sleep
+	 * duration, even if they're all well above the requested
+	 * duration. In practice, such an assumption proves out to be
+	 * true on various platforms.
+	 */
+
+	/*
+	 * A big initial sleep lowers power usage on any platform, as
+	 * more small sleep requests use more power than fewer bigger,
+	 * equivalent sleep requests. In practice, operating systems
+	 * "actually sleep" when 1ms or more is requested, and 1ms is
+	 * the minimum request duration you can make on some platforms
+	 * (like older versions of Windows). Additionally, power usage
+	 * is nice and low when doing the number of 1ms sleeps that's
+	 * (hopefully) short of the target duration.
+	 *
+	 * But, the loop here maintains a maximum of the actual slept
+	 * durations, breaking out when the time remaining is greater
+	 * than or equal to the maximum found. By breaking out on the
+	 * maximum found rather than just 1ms-or-less remaining,
+	 * sleeping beyond the target deadline is reduced.
+	 *
+	 * The adaptive mode may grow the requested duration beyond
+	 * 1ms, trading more remaining time for the loops below for
+	 * fewer wakeups here.
+	 */
+	{
+		uint64_t max = stepper->coarse_duration;
+		uint64_t start = start_point;
+		uint64_t elapsed;
+		while ((elapsed = nanotime_interval(point, start, stepper->now_max)) < total_sleep_duration && elapsed + max < total_sleep_duration + slack) {
+			nanotime_step_sleep(stepper, stepper->coarse_duration);
+			stepper->stats.wakeups++;
+			const uint64_t next = nanotime_step_now(stepper);
+			const uint64_t current_interval = nanotime_interval(start, next, stepper->now_max);
+			if (current_interval > max) {
+				max = current_interval;
+			}
+			start = next;
+		}
+		const uint64_t initial_duration = nanotime_interval(start_point, start, stepper->now_max);
+		if (initial_duration < current_sleep_duration) {
+			current_sleep_duration -= initial_duration;
+		}
+		else {
+			current_time = start;
+			goto wait_spin;
+		}
+	}
+
+	/*
+	 * This has the flavor of Zeno's dichotomous paradox of motion,
+	 * as it successively divides the time remaining to sleep, but
+	 * attempts to stop short of the deadline to hopefully be able
+	 * to precisely sleep up to the deadline below this loop. The
+	 * divisor is larger than two though, as it produces better
+	 * behavior, and seems to work fine in testing on real
+	 * hardware. The same method of keeping track of the max
+	 * duration per loop of same sleep request durations above is
+	 * used here. The overshoot possible in the loop below this one
+	 * won't overshoot much, or in the best case won't overshoot,
+	 * so the busyloop can finish up the sleep precisely.
+	 */
+	current_sleep_duration >>= shift;
+	for (
+		uint64_t max = stepper->zero_sleep_duration, elapsed;
+		(elapsed = nanotime_interval(point, nanotime_step_now(stepper), stepper->now_max)) < total_sleep_duration && elapsed + max < total_sleep_duration + slack && current_sleep_duration > UINT64_C(0);
+		current_sleep_duration >>= shift
+	) {
+		max = stepper->zero_sleep_duration;
+		uint64_t start;
+		while (max < total_sleep_duration && (elapsed = nanotime_interval(point, start = nanotime_step_now(stepper), stepper->now_max)) < total_sleep_duration && elapsed + max < total_sleep_duration + slack) {
+			nanotime_step_fine_sleep(stepper, current_sleep_duration);
+			stepper->stats.wakeups++;
+			uint64_t slept_duration;
+			if ((slept_duration = nanotime_interval(start, nanotime_step_now(stepper), stepper->now_max)) > max) {
+				max = slept_duration;
+			}
+		}
+	}
+	current_time = nanotime_step_now(stepper);
+	if (!stepper->zero_sleeps || nanotime_interval(point, current_time, stepper->now_max) >= total_sleep_duration) {
+		goto wait_spin;
+	}
+
+	{
+		/*
+		 * After (hopefully) stopping short of the deadline by
+		 * a small amount, do small sleeps here to get closer
+		 * to the deadline, but again attempting to stop short
+		 * by an even smaller amount. It's best to do larger
+		 * sleeps as done in the above loops, to reduce
+		 * CPU/power usage, as each sleep iteration has a
+		 * more-or-less fixed overhead of CPU/power usage.
+		 *
+		 * In testing on an M1 Mac mini running macOS, power
+		 * usage is lower using zero-duration sleeps vs.
+		 * nanotime_yield(), with no loss of timing precision.
+		 * The same might be true for other hardwares/operating
+		 * systems.
+		 */
+		uint64_t max = stepper->zero_sleep_duration;
+		uint64_t start;
+		uint64_t elapsed;
+		while ((elapsed = nanotime_interval(point, start = nanotime_step_now(stepper), stepper->now_max)) < total_sleep_duration && elapsed + max < total_sleep_duration + slack) {
+			nanotime_step_fine_sleep(stepper, UINT64_C(0));
+			stepper->stats.wakeups++;
+			if ((stepper->zero_sleep_duration = nanotime_interval(start, nanotime_step_now(stepper), stepper->now_max)) > max) {
+				max = stepper->zero_sleep_duration;
+			}
+		}
+	}
+
+	current_time = nanotime_step_now(stepper);
+
+	wait_spin:
+	return nanotime_step_spin(stepper, point, total_sleep_duration, current_time);
+}
+
+/*
+ * Starts a step at start_point, applying the catch-up policy to the stepper's
+ * timeline ahead of the step's wait.
+ */
+static void nanotime_step_begin(nanotime_step_data* const stepper, const uint64_t start_point) {
+	stepper->stats.steps++;
+
+	if (stepper->catch_up == NANOTIME_STEP_CATCH_UP_RESET) {
+		const uint64_t behind = nanotime_interval(stepper->sleep_point, start_point, stepper->now_max);
+		if (behind >= stepper->sleep_duration + NANOTIME_NSEC_PER_SEC / UINT64_C(10)) {
+			stepper->stats.dropped_ticks += (stepper->accumulator + behind) / stepper->sleep_duration;
+			stepper->sleep_point = start_point;
+			stepper->accumulator = UINT64_C(0);
+			stepper->stats.resets++;
+		}
+	}
+	else if (stepper->spread_debt > UINT64_C(0) && stepper->accumulator + UINT64_C(1) < stepper->sleep_duration) {
+		/*
+		 * Shorten this step's sleep by a slice of the time owed, but
+		 * never so much that the sleep would be skipped.
+		 */
+		uint64_t slice = stepper->spread_slice;
+		if (slice > stepper->spread_debt) {
+			slice = stepper->spread_debt;
+		}
+		if (slice > stepper->sleep_duration - stepper->accumulator - UINT64_C(1)) {
+			slice = stepper->sleep_duration - stepper->accumulator - UINT64_C(1);
+		}
+		stepper->accumulator += slice;
+		stepper->spread_debt -= slice;
+	}
+}
+
+/*
+ * Registry entries are free, claimed by a thread registering or unregistering
+ * a stepper, or active and reported on. Only the thread that claimed an entry
+ * writes it, changing its report and state while the sequence is odd, like
+ * the publisher.
+ */
+enum {
+	NANOTIME_STEP_REGISTRATION_FREE,
+	NANOTIME_STEP_REGISTRATION_CLAIMED,
+	NANOTIME_STEP_REGISTRATION_ACTIVE
+};
+
+struct nanotime_step_registration {
+	uint64_t state;
+	uint64_t sequence;
+	nanotime_step_report report;
+
+	unsigned char padding[NANOTIME_CACHE_LINE_SIZE];
+};
+
+static struct nanotime_step_registration nanotime_step_registry[NANOTIME_STEP_REGISTRY_SIZE];
+
+/* How many times a query tries to copy an entry before leaving it out. */
+#define NANOTIME_STEP_REGISTRY_ATTEMPTS 4
+
+static const uint64_t nanotime_step_deviation_bounds[NANOTIME_STEP_DEVIATION_BUCKETS] = {
+	UINT64_C(1000), UINT64_C(2000), UINT64_C(5000),
+	UINT64_C(10000), UINT64_C(20000), UINT64_C(50000),
+	UINT64_C(100000), UINT64_C(200000), UINT64_C(500000),
+	UINT64_C(1000000), UINT64_C(2000000), UINT64_C(5000000),
+	UINT64_C(10000000), UINT64_C(20000000), UINT64_C(50000000),
+	UINT64_C(100000000), UINT64_C(200000000), UINT64_C(500000000),
+	UINT64_C(1000000000), UINT64_MAX
+};
+
+/*
+ * Copies the stepper's statistics into its registry entry, adding the step's
+ * deviation to the histogram if it slept.
+ */
+static void nanotime_step_registration_update(nanotime_step_data* const stepper, const bool slept) {
+	struct nanotime_step_registration* const registration = stepper->registration;
+	nanotime_step_report* const report = &registration->report;
+
+	const uint64_t sequence = registration->sequence;
+	NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(1));
+	NANOTIME_ATOMIC_FENCE();
+	report->sleep_duration = stepper->sleep_duration;
+	report->deviation = stepper->stats.deviation;
+	report->steps = stepper->stats.steps;
+	report->skips = stepper->stats.skips;
+	report->resets = stepper->stats.resets;
+	report->wakeups = stepper->stats.wakeups;
+	report->spin_duration = stepper->stats.spin_duration;
+	report->accumulator = stepper->accumulator;
+	if (slept) {
+		const uint64_t deviation = stepper->stats.deviation;
+		size_t bucket = 0u;
+		while (deviation > nanotime_step_deviation_bounds[bucket]) {
+			bucket++;
+		}
+		report->deviations[bucket]++;
+		report->deviation_count++;
+		report->deviation_sum += deviation;
+		if (deviation > report->max_deviation) {
+			report->max_deviation = deviation;
+		}
+	}
+	NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(2));
+}
+
+/*
+ * Finishes a step begun with nanotime_step_begin, whose wait ended at
+ * current_time, unless the step is skipped, where clock_reads is the count of
+ * clock reads before the step; returns whether the step slept.
+ */
+static bool nanotime_step_finish(nanotime_step_data* const stepper, const uint64_t clock_reads, const uint64_t current_time) {
+	bool slept;
+	if (stepper->accumulator < stepper->sleep_duration) {
+		const uint64_t total_sleep_duration = stepper->sleep_duration - stepper->accumulator;
+		const uint64_t accumulated = nanotime_interval(stepper->sleep_point, current_time, stepper->now_max);
+		stepper->stats.elapsed_duration += accumulated;
+		stepper->stats.deviation = accumulated - total_sleep_duration;
+		if (stepper->jitter_target > UINT64_C(0)) {
+			nanotime_step_adapt(stepper, stepper->stats.deviation);
+		}
+
+		stepper->accumulator += accumulated;
+		stepper->sleep_point = current_time;
+		slept = true;
+	}
+	else {
+		stepper->stats.skips++;
+		slept = false;
+	}
+	stepper->accumulator -= stepper->sleep_duration;
+	nanotime_step_catch_up_owed(stepper);
+	stepper->stats.step_clock_reads = stepper->stats.clock_reads - clock_reads;
+	if (stepper->poll != NULL && stepper->stats.elapsed_duration - stepper->poll_elapsed >= stepper->poll_interval) {
+		stepper->poll_elapsed = stepper->stats.elapsed_duration;
+		stepper->poll(stepper);
+	}
+	if (stepper->registration != NULL) {
+		nanotime_step_registration_update(stepper, slept);
+	}
+	return slept;
+}
+
+bool nanotime_step(nanotime_step_data* const stepper) {
+	assert(stepper != NULL);
+
+	const uint64_t clock_reads = stepper->stats.clock_reads;
+	const uint64_t start_point = nanotime_step_now(stepper);
+	nanotime_step_begin(stepper, start_point);
+
+	uint64_t current_time = start_point;
+	if (stepper->accumulator < stepper->sleep_duration) {
+		const uint64_t total_sleep_duration = stepper->sleep_duration - stepper->accumulator;
+		if (stepper->coarse_wait != NULL && nanotime_interval(stepper->sleep_point, start_point, stepper->now_max) + stepper->coarse_duration < total_sleep_duration) {
+			stepper->coarse_wait(stepper, nanotime_step_after(stepper->sleep_point, total_sleep_duration, stepper->now_max));
+			stepper->stats.wakeups++;
+			current_time = nanotime_step_now(stepper);
+		}
+		current_time = nanotime_step_wait(stepper, stepper->sleep_point, total_sleep_duration, current_time);
+	}
+	return nanotime_step_finish(stepper, clock_reads, current_time);
+}
+
+double nanotime_step_wakeups_per_second(const nanotime_step_stats* const stats) {
+	assert(stats != NULL);
+
+	if (stats->elapsed_duration == UINT64_C(0)) {
+		return 0.0;
+	}
+	return (double)stats->wakeups * (double)NANOTIME_NSEC_PER_SEC / (double)stats->elapsed_duration;
+}
+
+double nanotime_step_spin_per_step(const nanotime_step_stats* const stats) {
+	assert(stats != NULL);
+
+	if (stats->steps == UINT64_C(0)) {
+		return 0.0;
+	}
+	return (double)stats->spin_duration / (double)stats->steps;
+}
+
+uint64_t nanotime_step_deviation_bound(const size_t bucket) {
+	assert(bucket < NANOTIME_STEP_DEVIATION_BUCKETS);
+
+	return nanotime_step_deviation_bounds[bucket];
+}
+
+bool nanotime_step_register(nanotime_step_data* const stepper, const char* const name) {
+	assert(stepper != NULL);
+	assert(stepper->registration == NULL);
+	assert(name != NULL);
+
+	for (size_t i = 0u; i < NANOTIME_STEP_REGISTRY_SIZE; i++) {
+		struct nanotime_step_registration* const registration = &nanotime_step_registry[i];
+		uint64_t state = NANOTIME_STEP_REGISTRATION_FREE;
+		if (!NANOTIME_ATOMIC_CAS(&registration->state, &state, (uint64_t)NANOTIME_STEP_REGISTRATION_CLAIMED)) {
+			continue;
+		}
+
+		const uint64_t sequence = registration->sequence;
+		NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(1));
+		NANOTIME_ATOMIC_FENCE();
+		nanotime_step_report* const report = &registration->report;
+		size_t length = 0u;
+		while (length < NANOTIME_STEP_NAME_SIZE - 1u && name[length] != '\0') {
+			report->name[length] = name[length];
+			length++;
+		}
+		report->name[length] = '\0';
+		report->max_deviation = UINT64_C(0);
+		report->deviation_count = UINT64_C(0);
+		report->deviation_sum = UINT64_C(0);
+		for (size_t bucket = 0u; bucket < NANOTIME_STEP_DEVIATION_BUCKETS; bucket++) {
+			report->deviations[bucket] = UINT64_C(0);
+		}
+		stepper->registration = registration;
+		NANOTIME_ATOMIC_STORE(&registration->state, (uint64_t)NANOTIME_STEP_REGISTRATION_ACTIVE);
+		NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(2));
+
+		nanotime_step_registration_update(stepper, false);
+		return true;
+	}
+	return false;
+}
+
+void nanotime_step_unregister(nanotime_step_data* const stepper) {
+	assert(stepper != NULL);
+
+	struct nanotime_step_registration* const registration = stepper->registration;
+	if (registration == NULL) {
+		return;
+	}
+
+	/*
+	 * The entry is only freed once no reader can see it as active, so it
+	 * can't be claimed by another stepper while this one is still writing
+	 * its sequence.
+	 */
+	const uint64_t sequence = registration->sequence;
+	NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(1));
+	NANOTIME_ATOMIC_FENCE();
+	NANOTIME_ATOMIC_STORE(&registration->state, (uint64_t)NANOTIME_STEP_REGISTRATION_CLAIMED);
+	NANOTIME_ATOMIC_STORE(&registration->sequence, sequence + UINT64_C(2));
+	NANOTIME_ATOMIC_STORE(&registration->state, (uint64_t)NANOTIME_STEP_REGISTRATION_FREE);
+	stepper->registration = NULL;
+}
+
+/*
+ * Estimates the 99th percentile of the report's deviations, interpolating
+ * linearly within the bucket it falls in, that's bounded by the greatest
+ * deviation.
+ */
+static uint64_t nanotime_step_report_p99(const nanotime_step_report* const report) {
+	if (report->deviation_count == UINT64_C(0)) {
+		return UINT64_C(0);
+	}
+
+	const uint64_t rank = (report->deviation_count * UINT64_C(99) + UINT64_C(99)) / UINT64_C(100);
+	uint64_t below = UINT64_C(0);
+	for (size_t bucket = 0u; bucket < NANOTIME_STEP_DEVIATION_BUCKETS; bucket++) {
+		const uint64_t count = report->deviations[bucket];
+		if (below + count >= rank) {
+			const uint64_t lower = bucket > 0u ? nanotime_step_deviation_bounds[bucket - 1u] : UINT64_C(0);
+			uint64_t upper = nanotime_step_deviation_bounds[bucket];
+			if (upper > report->max_deviation) {
+				upper = report->max_deviation;
+			}
+			if (upper <= lower) {
+				return upper;
+			}
+			return lower + (uint64_t)((double)(upper - lower) * (double)(rank - below) / (double)count);
 		}
+		below += count;
 	}
-	return now_max;
+	return report->max_deviation;
 }
-#define NANOTIME_NOW_MAX_IMPLEMENTED
-#endif
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-void nanotime_sleep(uint64_t nsec_count) {
-	LARGE_INTEGER dueTime;
+size_t nanotime_step_registry_query(nanotime_step_report* const reports, const size_t max_reports) {
+	assert(reports != NULL || max_reports == 0u);
 
-	if (nsec_count < UINT64_C(100)) {
-		/*
-		 * Allows the OS to schedule another process for a single time
-		 * slice. Better than a delay of 0, which immediately returns
-		 * with no actual non-CPU-hogging delay. The time-slice-yield
-		 * behavior is specified in Microsoft's Windows documentation.
-		 */
-		SleepEx(0UL, FALSE);
-	}
-	else {
-		HANDLE timer = NULL;
-		if (
-			#ifdef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
-			/*
-			 * Requesting a high resolution timer can make quite the
-			 * difference, so always request high resolution if available. It's
-			 * available in Windows 10 1803 and above. This arrangement of
-			 * building it if the build system supports it will allow the
-			 * executable to use high resolution if available on a user's
-			 * system, but revert to low resolution if the user's system
-			 * doesn't support high resolution.
-			 */
-			(timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS)) == NULL &&
-			#endif
-			(timer = CreateWaitableTimer(NULL, TRUE, NULL)) == NULL
-		) {
-			return;
+	size_t count = 0u;
+	for (size_t i = 0u; i < NANOTIME_STEP_REGISTRY_SIZE && count < max_reports; i++) {
+		struct nanotime_step_registration* const registration = &nanotime_step_registry[i];
+		for (int attempt = 0; attempt < NANOTIME_STEP_REGISTRY_ATTEMPTS; attempt++) {
+			const uint64_t sequence = NANOTIME_ATOMIC_LOAD(&registration->sequence);
+			if (sequence & UINT64_C(1)) {
+				continue;
+			}
+			if (NANOTIME_ATOMIC_LOAD(&registration->state) != NANOTIME_STEP_REGISTRATION_ACTIVE) {
+				break;
+			}
+			memcpy(&reports[count], &registration->report, sizeof(nanotime_step_report));
+			NANOTIME_ATOMIC_FENCE();
+			if (NANOTIME_ATOMIC_LOAD(&registration->sequence) == sequence) {
+				nanotime_step_report* const report = &reports[count];
+				report->rate = (double)NANOTIME_NSEC_PER_SEC / (double)report->sleep_duration;
+				report->p99_deviation = nanotime_step_report_p99(report);
+				count++;
+				break;
+			}
 		}
+	}
+	return count;
+}
 
-		dueTime.QuadPart = -(LONGLONG)(nsec_count / UINT64_C(100));
-
-		SetWaitableTimer(timer, &dueTime, 0L, NULL, NULL, FALSE);
-		WaitForSingleObject(timer, INFINITE);
+/*
+ * Text being written into a buffer of size bytes, that keeps counting the
+ * length past the end of the buffer.
+ */
+typedef struct nanotime_openmetrics_writer {
+	char* buffer;
+	size_t size;
+	size_t length;
+} nanotime_openmetrics_writer;
 
-		CloseHandle(timer);
+static void nanotime_openmetrics_char(nanotime_openmetrics_writer* const writer, const char c) {
+	if (writer->length + 1u < writer->size) {
+		writer->buffer[writer->length] = c;
 	}
+	writer->length++;
 }
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#ifndef WIN32_LEAN_AND_MEAN
-#define WIN32_LEAN_AND_MEAN
-#endif
-#ifndef NOMINMAX
-#define NOMINMAX
-#endif
-#include <Windows.h>
-void nanotime_yield() {
-	YieldProcessor();
+static void nanotime_openmetrics_string(nanotime_openmetrics_writer* const writer, const char* string) {
+	while (*string != '\0') {
+		nanotime_openmetrics_char(writer, *string++);
+	}
 }
-#define NANOTIME_YIELD_IMPLEMENTED
-#endif
-
-#endif
 
-/*
- * To avoid using standard UNIX APIs on UNIX-like platforms, the
- * platform-specific implementations must be first. That way, the
- * lower-overhead kernel APIs can be used, that aren't UNIX-like.
- */
+static void nanotime_openmetrics_uint(nanotime_openmetrics_writer* const writer, uint64_t value) {
+	char digits[20];
+	int count = 0;
+	do {
+		digits[count++] = (char)('0' + (int)(value % UINT64_C(10)));
+		value /= UINT64_C(10);
+	} while (value > UINT64_C(0));
+	while (count > 0) {
+		nanotime_openmetrics_char(writer, digits[--count]);
+	}
+}
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#if defined(__APPLE__) || defined(__MACH__)
 /*
- * The current platform is some Apple operating system, or at least uses some
- * Mach kernel. The POSIX implementation below using clock_gettime works on at
- * least Apple platforms, though this version using Mach functions has lower
- * overhead.
+ * Durations are written as exact decimal seconds, rather than with the
+ * standard library's floating point formatting, which depends on the locale.
  */
-#include <mach/mach_time.h>
-uint64_t nanotime_now() {
-	static mach_timebase_info_data_t info = { 0 };
-	if (info.denom == UINT32_C(0)) {
-		const kern_return_t status = mach_timebase_info(&info);
-		assert(status == KERN_SUCCESS);
-		if (status != KERN_SUCCESS) {
-			return UINT64_C(0);
+static void nanotime_openmetrics_seconds(nanotime_openmetrics_writer* const writer, const uint64_t nsec_count) {
+	nanotime_openmetrics_uint(writer, nsec_count / NANOTIME_NSEC_PER_SEC);
+	uint64_t fraction = nsec_count % NANOTIME_NSEC_PER_SEC;
+	if (fraction > UINT64_C(0)) {
+		nanotime_openmetrics_char(writer, '.');
+		for (uint64_t place = NANOTIME_NSEC_PER_SEC / UINT64_C(10); fraction > UINT64_C(0); place /= UINT64_C(10)) {
+			nanotime_openmetrics_char(writer, (char)('0' + (int)(fraction / place)));
+			fraction %= place;
 		}
 	}
-	return (mach_absolute_time() * info.numer) / info.denom;
 }
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_NOW_MAX_IMPLEMENTED
-#if defined(__APPLE__) || defined(__MACH__)
-#include <mach/mach_time.h>
-uint64_t nanotime_now_max() {
-	static uint64_t now_max = UINT64_C(0);
-	if (now_max == UINT64_C(0)) {
-		mach_timebase_info_data_t info;
-		const kern_return_t status = mach_timebase_info(&info);
-		assert(status == KERN_SUCCESS);
-		if (status != KERN_SUCCESS) {
-			return UINT64_C(0);
+/*
+ * Opens a sample's labels with the stepper label, escaping the name, leaving
+ * the caller to add any other labels and close them.
+ */
+static void nanotime_openmetrics_label(nanotime_openmetrics_writer* const writer, const char* const name) {
+	nanotime_openmetrics_string(writer, "{stepper=\"");
+	for (const char* c = name; *c != '\0'; c++) {
+		if (*c == '\\' || *c == '"') {
+			nanotime_openmetrics_char(writer, '\\');
+			nanotime_openmetrics_char(writer, *c);
+		}
+		else if (*c == '\n') {
+			nanotime_openmetrics_string(writer, "\\n");
 		}
 		else {
-			now_max = UINT64_MAX / info.denom;
+			nanotime_openmetrics_char(writer, *c);
 		}
 	}
-	return now_max;
+	nanotime_openmetrics_char(writer, '"');
+}
+
+static void nanotime_openmetrics_metadata(nanotime_openmetrics_writer* const writer, const char* const name, const char* const type, const bool seconds, const char* const help) {
+	nanotime_openmetrics_string(writer, "# TYPE ");
+	nanotime_openmetrics_string(writer, name);
+	nanotime_openmetrics_char(writer, ' ');
+	nanotime_openmetrics_string(writer, type);
+	nanotime_openmetrics_char(writer, '\n');
+	if (seconds) {
+		nanotime_openmetrics_string(writer, "# UNIT ");
+		nanotime_openmetrics_string(writer, name);
+		nanotime_openmetrics_string(writer, " seconds\n");
+	}
+	nanotime_openmetrics_string(writer, "# HELP ");
+	nanotime_openmetrics_string(writer, name);
+	nanotime_openmetrics_char(writer, ' ');
+	nanotime_openmetrics_string(writer, help);
+	nanotime_openmetrics_char(writer, '\n');
 }
-#define NANOTIME_NOW_MAX_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#if defined(__unix__) && defined(_POSIX_VERSION) && (_POSIX_VERSION >= 199309L) && !defined(NANOTIME_NOW_IMPLEMENTED)
 /*
- * Current platform is some version of POSIX, that might have clock_gettime.
+ * The metric families of the reports' counts and durations, other than the
+ * deviation histogram.
  */
-#include <unistd.h>
-#include <time.h>
-#include <errno.h>
-uint64_t nanotime_now() {
-	struct timespec now;
-	const int status = clock_gettime(
-		#if defined(CLOCK_MONOTONIC_RAW)
-		/*
-		 * Monotonic raw is more precise, but not always available. For
-		 * the sorts of applications this code is intended for, mainly
-		 * soft real time applications such as game programming, the
-		 * subtle inconsistencies of it vs. monotonic aren't an issue.
-		 */
-		CLOCK_MONOTONIC_RAW
-		#elif defined(CLOCK_MONOTONIC)
-		/*
-		 * Monotonic is quite good, and widely available, but not as
-		 * precise as monotonic raw, so it's only used if required.
-		 */
-		CLOCK_MONOTONIC
-		#else
-		/*
-		 * Realtime isn't fully correct, as it's calendar time, but is
-		 * even more widely available than monotonic. Monotonic is only
-		 * unavailable on very old platforms though, so old they're
-		 * likely unused now (as of last editing this, 2023).
-		 */
-		CLOCK_REALTIME
-		#endif
-	, &now);
-	assert(status == 0 || (status == -1 && errno != EOVERFLOW));
-	if (status == 0 || (status == -1 && errno != EOVERFLOW)) {
-		return (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+static const struct {
+	const char* name;
+	const char* type;
+	const char* help;
+	size_t offset;
+	bool seconds;
+} nanotime_openmetrics_families[] = {
+	{ "nanotime_step_steps", "counter", "Steps taken.", offsetof(nanotime_step_report, steps), false },
+	{ "nanotime_step_skips", "counter", "Steps that skipped sleeping, to catch up.", offsetof(nanotime_step_report, skips), false },
+	{ "nanotime_step_resets", "counter", "Steps that reset the stepper, having fallen too far behind.", offsetof(nanotime_step_report, resets), false },
+	{ "nanotime_step_wakeups", "counter", "Sleep requests made by steps.", offsetof(nanotime_step_report, wakeups), false },
+	{ "nanotime_step_spin_seconds", "counter", "Time spent busylooping.", offsetof(nanotime_step_report, spin_duration), true },
+	{ "nanotime_step_accumulator_seconds", "gauge", "Time accumulated toward the next step.", offsetof(nanotime_step_report, accumulator), true },
+	{ "nanotime_step_duration_seconds", "gauge", "Duration of each step.", offsetof(nanotime_step_report, sleep_duration), true }
+};
+
+size_t nanotime_step_openmetrics(const nanotime_step_report* const reports, const size_t count, char* const buffer, const size_t size) {
+	assert(reports != NULL || count == 0u);
+	assert(buffer != NULL || size == 0u);
+
+	nanotime_openmetrics_writer writer;
+	writer.buffer = buffer;
+	writer.size = size;
+	writer.length = 0u;
+
+	const char* const histogram = "nanotime_step_deviation_seconds";
+	nanotime_openmetrics_metadata(&writer, histogram, "histogram", true, "How far past their deadlines sleeping steps ended.");
+	for (size_t i = 0u; i < count; i++) {
+		uint64_t cumulative = UINT64_C(0);
+		for (size_t bucket = 0u; bucket < NANOTIME_STEP_DEVIATION_BUCKETS; bucket++) {
+			cumulative += reports[i].deviations[bucket];
+			nanotime_openmetrics_string(&writer, histogram);
+			nanotime_openmetrics_string(&writer, "_bucket");
+			nanotime_openmetrics_label(&writer, reports[i].name);
+			nanotime_openmetrics_string(&writer, ",le=\"");
+			if (bucket + 1u < NANOTIME_STEP_DEVIATION_BUCKETS) {
+				nanotime_openmetrics_seconds(&writer, nanotime_step_deviation_bounds[bucket]);
+			}
+			else {
+				nanotime_openmetrics_string(&writer, "+Inf");
+			}
+			nanotime_openmetrics_string(&writer, "\"} ");
+			nanotime_openmetrics_uint(&writer, cumulative);
+			nanotime_openmetrics_char(&writer, '\n');
+		}
+		nanotime_openmetrics_string(&writer, histogram);
+		nanotime_openmetrics_string(&writer, "_count");
+		nanotime_openmetrics_label(&writer, reports[i].name);
+		nanotime_openmetrics_string(&writer, "} ");
+		nanotime_openmetrics_uint(&writer, reports[i].deviation_count);
+		nanotime_openmetrics_char(&writer, '\n');
+		nanotime_openmetrics_string(&writer, histogram);
+		nanotime_openmetrics_string(&writer, "_sum");
+		nanotime_openmetrics_label(&writer, reports[i].name);
+		nanotime_openmetrics_string(&writer, "} ");
+		nanotime_openmetrics_seconds(&writer, reports[i].deviation_sum);
+		nanotime_openmetrics_char(&writer, '\n');
 	}
-	else {
-		return UINT64_C(0);
+
+	for (size_t family = 0u; family < sizeof(nanotime_openmetrics_families) / sizeof(nanotime_openmetrics_families[0]); family++) {
+		const bool counter = strcmp(nanotime_openmetrics_families[family].type, "counter") == 0;
+		nanotime_openmetrics_metadata(&writer, nanotime_openmetrics_families[family].name, nanotime_openmetrics_families[family].type, nanotime_openmetrics_families[family].seconds, nanotime_openmetrics_families[family].help);
+		for (size_t i = 0u; i < count; i++) {
+			uint64_t value;
+			memcpy(&value, (const unsigned char*)&reports[i] + nanotime_openmetrics_families[family].offset, sizeof(value));
+			nanotime_openmetrics_string(&writer, nanotime_openmetrics_families[family].name);
+			if (counter) {
+				nanotime_openmetrics_string(&writer, "_total");
+			}
+			nanotime_openmetrics_label(&writer, reports[i].name);
+			nanotime_openmetrics_string(&writer, "} ");
+			if (nanotime_openmetrics_families[family].seconds) {
+				nanotime_openmetrics_seconds(&writer, value);
+			}
+			else {
+				nanotime_openmetrics_uint(&writer, value);
+			}
+			nanotime_openmetrics_char(&writer, '\n');
+		}
 	}
-}
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
+	nanotime_openmetrics_string(&writer, "# EOF\n");
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__)) || defined(__MINGW32__) || defined(__MINGW64__)
-#include <unistd.h>
-#include <time.h>
-#include <errno.h>
-void nanotime_sleep(uint64_t nsec_count) {
-	const struct timespec req = {
-		.tv_sec = (time_t)(nsec_count / NANOTIME_NSEC_PER_SEC),
-		.tv_nsec = (long)(nsec_count % NANOTIME_NSEC_PER_SEC)
-	};
-	#ifndef NDEBUG
-	const int status =
-	#endif
-	nanosleep(&req, NULL);
-	assert(status == 0 || (status == -1 && errno != EINVAL));
+	if (size > 0u) {
+		buffer[writer.length < size ? writer.length : size - 1u] = '\0';
+	}
+	return writer.length;
 }
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#if (defined(__unix__) || defined(__APPLE__)) && defined(_POSIX_VERSION) && (_POSIX_VERSION >= 200112L)
-#include <sched.h>
-void nanotime_yield() {
-	(void)sched_yield();
-}
-#define NANOTIME_YIELD_IMPLEMENTED
-#endif
-#endif
+bool nanotime_wait_until(nanotime_step_data* const stepper, const uint64_t deadline, nanotime_wait_result* const result) {
+	assert(stepper != NULL);
+	assert(deadline <= stepper->now_max);
 
+	const uint64_t spin_duration = stepper->stats.spin_duration;
+	const uint64_t wakeups = stepper->stats.wakeups;
+	const uint64_t yields = stepper->stats.yields;
+	const uint64_t start = nanotime_step_now(stepper);
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#if defined(__vita__)
-#include <psp2/kernel/processmgr.h>
-uint64_t nanotime_now() {
-	return sceKernelGetProcessTimeWide() * UINT64_C(1000);
-}
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
+	/*
+	 * A deadline more than half the clock's range ahead is taken to be in
+	 * the past, as it would be when it was passed just before the call.
+	 */
+	const uint64_t duration = nanotime_interval(start, deadline, stepper->now_max);
+	bool waited;
+	uint64_t deviation;
+	if (duration == UINT64_C(0) || duration > stepper->now_max / UINT64_C(2)) {
+		deviation = nanotime_interval(deadline, start, stepper->now_max);
+		waited = false;
+	}
+	else {
+		const uint64_t end = nanotime_step_wait(stepper, start, duration, start);
+		deviation = nanotime_interval(start, end, stepper->now_max) - duration;
+		if (stepper->jitter_target > UINT64_C(0)) {
+			nanotime_step_adapt(stepper, deviation);
+		}
+		waited = true;
+	}
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#if defined(__vita__)
-#include <psp2/kernel/processmgr.h>
-void nanotime_sleep(uint64_t nsec_count) {
-	sceKernelDelayThreadCB(nsec_count / UINT64_C(1000));
+	if (result != NULL) {
+		result->deviation = deviation;
+		result->spin_duration = stepper->stats.spin_duration - spin_duration;
+		result->wakeups = stepper->stats.wakeups - wakeups;
+		result->yields = stepper->stats.yields - yields;
+	}
+	return waited;
 }
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
 
+void nanotime_virtual_clock_init(nanotime_virtual_clock* const clock, const uint64_t start, const uint64_t now_max, const uint64_t seed) {
+	assert(clock != NULL);
+	assert(now_max > UINT64_C(0));
+	assert(start <= now_max);
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#ifdef __EMSCRIPTEN__
-#include <emscripten.h>
-/*
- * NOTE: You *must* have asyncify enabled in the Emscripten build (pass
- * -sASYNCIFY to the compiler/linker) or sleeping won't work.
- */
-void nanotime_sleep(uint64_t nsec_count) {
-	emscripten_sleep(nsec_count / UINT64_C(1000000));
-}
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
+	clock->now = start;
+	clock->now_max = now_max;
+	clock->read_cost = UINT64_C(0);
+	clock->overshoot_min = UINT64_C(0);
+	clock->overshoot_max = UINT64_C(0);
+	clock->zero_sleep_min = UINT64_C(0);
+	clock->zero_sleep_max = UINT64_C(0);
+	clock->overshoots = NULL;
+	clock->overshoots_count = 0u;
+	clock->samples = NULL;
+	clock->samples_count = 0u;
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#ifdef __EMSCRIPTEN__
-#include <emscripten.h>
-uint64_t nanotime_now() {
-	const double now = emscripten_get_now();
-	return (uint64_t)now * UINT64_C(1000000);
+	/* The xorshift generator's state must never be zero. */
+	clock->random_state = seed != UINT64_C(0) ? seed : UINT64_C(0x9E3779B97F4A7C15);
+
+	clock->yield_cost = UINT64_C(0);
+	clock->reads = UINT64_C(0);
+	clock->sleeps = UINT64_C(0);
+	clock->yields = UINT64_C(0);
+	clock->slept_duration = UINT64_C(0);
 }
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
 
+void nanotime_virtual_advance(nanotime_virtual_clock* const clock, const uint64_t nsec_count) {
+	assert(clock != NULL);
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#ifdef __SWITCH__
-#include <switch.h>
-void nanotime_sleep(uint64_t nsec_count) {
-	if (nsec_count > INT64_MAX) {
-		svcSleepThread(INT64_MAX);
+	if (nsec_count <= clock->now_max - clock->now) {
+		clock->now += nsec_count;
 	}
 	else {
-		svcSleepThread((s64)nsec_count);
+		clock->now = nsec_count - (clock->now_max - clock->now) - UINT64_C(1);
 	}
 }
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#ifdef __SWITCH__
-#include <switch.h>
-uint64_t nanotime_now() {
-	return armTicksToNs(armGetSystemTick());
-}
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
+static uint64_t nanotime_virtual_random(nanotime_virtual_clock* const clock, const uint64_t min, const uint64_t max) {
+	assert(min <= max);
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#if defined(__SWITCH__)
-#include <switch.h>
-void nanotime_yield() {
-	svcSleepThread(YieldType_ToAnyThread);
+	uint64_t x = clock->random_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	clock->random_state = x;
+	if (max - min == UINT64_MAX) {
+		return x;
+	}
+	return min + x % (max - min + UINT64_C(1));
 }
-#define NANOTIME_YIELD_IMPLEMENTED
-#endif
-#endif
 
+/*
+ * Replays a sample from those with the requested duration nearest to
+ * nsec_count, applying the sample's overshoot (or undershoot) to nsec_count.
+ */
+static uint64_t nanotime_virtual_sample(nanotime_virtual_clock* const clock, const uint64_t nsec_count) {
+	const nanotime_sleep_sample* const samples = clock->samples;
+	const size_t count = clock->samples_count;
+
+	/* Find the first sample not requesting less than nsec_count. */
+	size_t low = 0u;
+	size_t high = count;
+	while (low < high) {
+		const size_t middle = low + (high - low) / 2u;
+		if (samples[middle].requested < nsec_count) {
+			low = middle + 1u;
+		}
+		else {
+			high = middle;
+		}
+	}
+	if (low == count || (low > 0u && nsec_count - samples[low - 1u].requested < samples[low].requested - nsec_count)) {
+		low--;
+	}
+
+	/* Draw from all the samples with the same requested duration. */
+	const uint64_t requested = samples[low].requested;
+	size_t first = low;
+	size_t last = low;
+	while (first > 0u && samples[first - 1u].requested == requested) {
+		first--;
+	}
+	while (last + 1u < count && samples[last + 1u].requested == requested) {
+		last++;
+	}
+	const nanotime_sleep_sample* const sample = &samples[first + (size_t)nanotime_virtual_random(clock, UINT64_C(0), (uint64_t)(last - first))];
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
-#include <time.h>
-uint64_t nanotime_now() {
-	struct timespec now;
-	const int status = timespec_get(&now, TIME_UTC);
-	assert(status == TIME_UTC);
-	if (status == TIME_UTC) {
-		return (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec;
+	if (sample->slept >= sample->requested) {
+		return nsec_count + (sample->slept - sample->requested);
+	}
+	else if (sample->requested - sample->slept < nsec_count) {
+		return nsec_count - (sample->requested - sample->slept);
 	}
 	else {
 		return UINT64_C(0);
 	}
 }
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
-#include <threads.h>
-void nanotime_sleep(uint64_t nsec_count) {
-	const struct timespec req = {
-		.tv_sec = (time_t)(nsec_count / NANOTIME_NSEC_PER_SEC),
-		.tv_nsec = (long)(nsec_count % NANOTIME_NSEC_PER_SEC)
-	};
-	const int status = thrd_sleep(&req, NULL);
-	assert(status == 0 || status == -1);
-}
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
+uint64_t nanotime_virtual_now(void* user) {
+	nanotime_virtual_clock* const clock = (nanotime_virtual_clock*)user;
+	assert(clock != NULL);
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
-#include <threads.h>
-void nanotime_yield() {
-	thrd_yield();
+	clock->reads++;
+	nanotime_virtual_advance(clock, clock->read_cost);
+	return clock->now;
 }
-#define NANOTIME_YIELD_IMPLEMENTED
-#endif
-#endif
 
+void nanotime_virtual_sleep(void* user, uint64_t nsec_count) {
+	nanotime_virtual_clock* const clock = (nanotime_virtual_clock*)user;
+	assert(clock != NULL);
 
-#ifdef __cplusplus
+	uint64_t slept;
+	if (clock->samples != NULL && clock->samples_count > 0u) {
+		slept = nanotime_virtual_sample(clock, nsec_count);
+	}
+	else if (nsec_count == UINT64_C(0)) {
+		slept = nanotime_virtual_random(clock, clock->zero_sleep_min, clock->zero_sleep_max);
+	}
+	else if (clock->overshoots != NULL && clock->overshoots_count > 0u) {
+		slept = nsec_count + clock->overshoots[nanotime_virtual_random(clock, UINT64_C(0), (uint64_t)clock->overshoots_count - UINT64_C(1))];
+	}
+	else {
+		slept = nsec_count + nanotime_virtual_random(clock, clock->overshoot_min, clock->overshoot_max);
+	}
+	clock->sleeps++;
+	clock->slept_duration += slept;
+	nanotime_virtual_advance(clock, slept);
 }
-#endif
 
-/*
- * C++ implementations follow here, but defined with C linkage.
- */
+void nanotime_virtual_yield(void* user) {
+	nanotime_virtual_clock* const clock = (nanotime_virtual_clock*)user;
+	assert(clock != NULL);
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#ifdef __cplusplus
-#include <cstdint>
-#include <chrono>
-extern "C" uint64_t nanotime_now() {
-	return static_cast<uint64_t>(
-		std::chrono::time_point_cast<std::chrono::nanoseconds>(
-			std::chrono::steady_clock::now()
-		).time_since_epoch().count()
-	);
+	clock->yields++;
+	nanotime_virtual_advance(clock, clock->yield_cost);
 }
-#define NANOTIME_NOW_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#ifdef __cplusplus
-#include <cstdint>
-#include <thread>
-#include <exception>
-extern "C" void nanotime_sleep(uint64_t nsec_count) {
-	try {
-		std::this_thread::sleep_for(std::chrono::nanoseconds(nsec_count));
-	}
-	catch (std::exception e) {
+void nanotime_step_publisher_init(
+	nanotime_step_publisher* const publisher,
+	const nanotime_step_data* const stepper,
+	void* const states,
+	const size_t state_size,
+	const void* const initial_state
+) {
+	assert(publisher != NULL);
+	assert(stepper != NULL);
+	assert(states != NULL);
+	assert(state_size > 0u);
+	assert(initial_state != NULL);
+
+	publisher->sequence = UINT64_C(0);
+	publisher->count = UINT64_C(1);
+	publisher->sleep_point = stepper->sleep_point;
+	publisher->sleep_duration = stepper->sleep_duration;
+	publisher->now_max = stepper->now_max;
+	publisher->states = (unsigned char*)states;
+	publisher->state_size = state_size;
+	for (size_t i = 0u; i < 3u; i++) {
+		memcpy(publisher->states + i * state_size, initial_state, state_size);
 	}
 }
-#define NANOTIME_SLEEP_IMPLEMENTED
-#endif
-#endif
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#ifdef __cplusplus
-#include <thread>
-extern "C" void nanotime_yield() {
-	std::this_thread::yield();
+void nanotime_step_publish(nanotime_step_publisher* const publisher, const nanotime_step_data* const stepper, const void* const state) {
+	assert(publisher != NULL);
+	assert(stepper != NULL);
+	assert(state != NULL);
+
+	/*
+	 * Readers of the current pair only read the slots of the current and
+	 * previous counts, so the slot of the next count can be written before
+	 * the sequence goes odd.
+	 */
+	const uint64_t count = publisher->count + UINT64_C(1);
+	memcpy(publisher->states + (size_t)(count % UINT64_C(3)) * publisher->state_size, state, publisher->state_size);
+
+	const uint64_t sequence = publisher->sequence;
+	NANOTIME_ATOMIC_STORE(&publisher->sequence, sequence + UINT64_C(1));
+	NANOTIME_ATOMIC_FENCE();
+	NANOTIME_ATOMIC_STORE(&publisher->count, count);
+	NANOTIME_ATOMIC_STORE(&publisher->sleep_point, stepper->sleep_point);
+	NANOTIME_ATOMIC_STORE(&publisher->sequence, sequence + UINT64_C(2));
 }
-#define NANOTIME_YIELD_IMPLEMENTED
-#endif
-#endif
 
+double nanotime_step_snapshot(nanotime_step_publisher* const publisher, const uint64_t now, void* const previous, void* const current) {
+	assert(publisher != NULL);
 
-#ifndef NANOTIME_NOW_IMPLEMENTED
-#error "Failed to implement nanotime_now (try using C11 with C11 threads support or C++11)."
-#endif
+	uint64_t sequence;
+	uint64_t sleep_point;
+	do {
+		while ((sequence = NANOTIME_ATOMIC_LOAD(&publisher->sequence)) & UINT64_C(1));
+		const uint64_t count = NANOTIME_ATOMIC_LOAD(&publisher->count);
+		sleep_point = NANOTIME_ATOMIC_LOAD(&publisher->sleep_point);
+		if (previous != NULL) {
+			memcpy(previous, publisher->states + (size_t)((count - UINT64_C(1)) % UINT64_C(3)) * publisher->state_size, publisher->state_size);
+		}
+		if (current != NULL) {
+			memcpy(current, publisher->states + (size_t)(count % UINT64_C(3)) * publisher->state_size, publisher->state_size);
+		}
+		NANOTIME_ATOMIC_FENCE();
+	} while (NANOTIME_ATOMIC_LOAD(&publisher->sequence) != sequence);
 
-#ifndef NANOTIME_SLEEP_IMPLEMENTED
-#error "Failed to implement nanotime_sleep (try using C11 with C11 threads support or C++11)."
-#endif
+	/*
+	 * A now from before the latest publish, such as one read just before
+	 * calling this, is far behind the sleep point in modular arithmetic,
+	 * and is treated as the start of the step.
+	 */
+	const uint64_t elapsed = nanotime_interval(sleep_point, now, publisher->now_max);
+	if (elapsed > publisher->now_max / UINT64_C(2)) {
+		return 0.0;
+	}
+	else if (elapsed >= publisher->sleep_duration) {
+		return 1.0;
+	}
+	else {
+		return (double)elapsed / (double)publisher->sleep_duration;
+	}
+}
+
+double nanotime_step_alpha(nanotime_step_publisher* const publisher, const uint64_t now) {
+	return nanotime_step_snapshot(publisher, now, NULL, NULL);
+}
 
-#ifndef NANOTIME_YIELD_IMPLEMENTED
-#ifdef __cplusplus
-extern "C" {
-#endif
 /*
- * As a last resort, make a zero-duration sleep request to implement yield.
- * Such sleep requests often have the desired yielding behavior on many
- * platforms.
+ * The tick most recently consumed by the stepper was due accumulator
+ * nanoseconds before its sleep point, whether the step slept or was skipped.
  */
-void nanotime_yield() {
-	nanotime_sleep(0u);
-}
-#define NANOTIME_YIELD_IMPLEMENTED
-#ifdef __cplusplus
+static uint64_t nanotime_step_tick_point(const nanotime_step_data* const stepper) {
+	if (stepper->accumulator <= stepper->sleep_point) {
+		return stepper->sleep_point - stepper->accumulator;
+	}
+	else {
+		return stepper->now_max - (stepper->accumulator - stepper->sleep_point - UINT64_C(1));
+	}
 }
-#endif
-#endif
 
+void nanotime_step_clock_init(nanotime_step_clock* const clock, const nanotime_step_data* const stepper) {
+	assert(clock != NULL);
+	assert(stepper != NULL);
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#ifndef NANOTIME_NOW_MAX_IMPLEMENTED
-/*
- * Might not be correct on some platforms, but it's the best we can do as a last
- * resort.
- */
-uint64_t nanotime_now_max() {
-	return UINT64_MAX;
+	NANOTIME_ATOMIC_STORE(&clock->sequence, UINT64_C(1));
+	NANOTIME_ATOMIC_FENCE();
+	NANOTIME_ATOMIC_STORE(&clock->tick, UINT64_C(0));
+	NANOTIME_ATOMIC_STORE(&clock->tick_point, nanotime_step_tick_point(stepper));
+	NANOTIME_ATOMIC_STORE(&clock->sleep_duration, stepper->sleep_duration);
+	NANOTIME_ATOMIC_STORE(&clock->now_max, stepper->now_max);
+	NANOTIME_ATOMIC_STORE(&clock->magic, NANOTIME_STEP_CLOCK_MAGIC);
+	NANOTIME_ATOMIC_STORE(&clock->sequence, UINT64_C(2));
 }
-#define NANOTIME_NOW_MAX_IMPLEMENTED
-#endif
 
-#endif
+void nanotime_step_clock_publish(nanotime_step_clock* const clock, const nanotime_step_data* const stepper) {
+	assert(clock != NULL);
+	assert(stepper != NULL);
 
+	const uint64_t sequence = clock->sequence;
+	NANOTIME_ATOMIC_STORE(&clock->sequence, sequence + UINT64_C(1));
+	NANOTIME_ATOMIC_FENCE();
+	NANOTIME_ATOMIC_STORE(&clock->tick, clock->tick + UINT64_C(1));
+	NANOTIME_ATOMIC_STORE(&clock->tick_point, nanotime_step_tick_point(stepper));
+	NANOTIME_ATOMIC_STORE(&clock->sleep_duration, stepper->sleep_duration);
+	NANOTIME_ATOMIC_STORE(&clock->sequence, sequence + UINT64_C(2));
+}
 
-#ifdef NANOTIME_IMPLEMENTATION
+bool nanotime_step_clock_read(nanotime_step_clock* const clock, nanotime_step_clock_time* const time) {
+	assert(clock != NULL);
+	assert(time != NULL);
 
-uint64_t nanotime_interval(const uint64_t start, const uint64_t end, const uint64_t max) {
-	assert(max > UINT64_C(0));
-	assert(start <= max);
-	assert(end <= max);
+	if (NANOTIME_ATOMIC_LOAD(&clock->magic) != NANOTIME_STEP_CLOCK_MAGIC) {
+		return false;
+	}
+	for (int attempt = 0; attempt < 16; attempt++) {
+		const uint64_t sequence = NANOTIME_ATOMIC_LOAD(&clock->sequence);
+		if (sequence & UINT64_C(1)) {
+			continue;
+		}
+		time->tick = NANOTIME_ATOMIC_LOAD(&clock->tick);
+		time->tick_point = NANOTIME_ATOMIC_LOAD(&clock->tick_point);
+		time->sleep_duration = NANOTIME_ATOMIC_LOAD(&clock->sleep_duration);
+		time->now_max = NANOTIME_ATOMIC_LOAD(&clock->now_max);
+		NANOTIME_ATOMIC_FENCE();
+		if (NANOTIME_ATOMIC_LOAD(&clock->sequence) == sequence) {
+			return true;
+		}
+	}
+	return false;
+}
 
-	if (end >= start) {
-		return end - start;
+uint64_t nanotime_step_align(nanotime_step_data* const stepper, const nanotime_step_clock_time* const time, const uint64_t now) {
+	assert(stepper != NULL);
+	assert(time != NULL);
+	assert(time->sleep_duration > UINT64_C(0));
+	assert(stepper->now_max == time->now_max);
+
+	/*
+	 * A now from before the published tick, such as one read just before
+	 * reading the clock, is far behind the tick point in modular
+	 * arithmetic, and is counted back from the tick point instead.
+	 */
+	const uint64_t elapsed = nanotime_interval(time->tick_point, now, time->now_max);
+	uint64_t tick;
+	if (elapsed > time->now_max / UINT64_C(2)) {
+		const uint64_t behind = nanotime_interval(now, time->tick_point, time->now_max);
+		stepper->accumulator = (stepper->sleep_duration - behind % stepper->sleep_duration) % stepper->sleep_duration;
+		tick = time->tick - (behind + time->sleep_duration - UINT64_C(1)) / time->sleep_duration;
 	}
 	else {
-		return end + (max - start) + UINT64_C(1);
+		stepper->accumulator = elapsed % stepper->sleep_duration;
+		tick = time->tick + elapsed / time->sleep_duration;
 	}
+	stepper->sleep_point = now;
+	stepper->spread_debt = UINT64_C(0);
+	return tick;
 }
 
-void nanotime_step_init(
-	nanotime_step_data* const stepper,
-	const uint64_t sleep_duration,
-	const uint64_t now_max,
-	uint64_t (* const now)(),
-	void (* const sleep)(uint64_t nsec_count)
-) {
+void nanotime_step_export(const nanotime_step_data* const stepper, nanotime_step_state* const state) {
 	assert(stepper != NULL);
-	assert(sleep_duration > UINT64_C(0));
-	assert(now_max > UINT64_C(0));
-	assert(now != NULL);
-	assert(sleep != NULL);
+	assert(state != NULL);
 
-	stepper->sleep_duration = sleep_duration;
-	stepper->now_max = now_max;
-	stepper->now = now;
-	stepper->sleep = sleep;
+	state->version = NANOTIME_STEP_STATE_VERSION;
+	state->size = (uint64_t)sizeof(nanotime_step_state);
+	state->now_max = stepper->now_max;
+	state->sleep_duration = stepper->sleep_duration;
+	state->sleep_point = stepper->sleep_point;
+	state->accumulator = stepper->accumulator;
+	state->catch_up = (uint64_t)stepper->catch_up;
+	state->catch_up_limit = stepper->catch_up_limit;
+	state->spread_debt = stepper->spread_debt;
+	state->spread_slice = stepper->spread_slice;
+}
 
-	const uint64_t start = now();
-	sleep(UINT64_C(0));
-	stepper->zero_sleep_duration = nanotime_interval(start, now(), now_max);
-	stepper->accumulator = UINT64_C(0);
+bool nanotime_step_import(nanotime_step_data* const stepper, const nanotime_step_state* const state) {
+	assert(stepper != NULL);
+	assert(state != NULL);
 
 	/*
-	 * This should be last here, so the sleep point is close to what it
-	 * should be.
+	 * The state might have been read from outside the program, so it's
+	 * checked against everything the stepper asserts of its timeline,
+	 * without arithmetic that hostile values could overflow. The stepper's
+	 * initialization asserted its now_max is over twice the reset
+	 * threshold, so once the state's matches it, subtracting the threshold
+	 * from half of it can't wrap around.
 	 */
-	stepper->sleep_point = now();
+	if (
+		state->version != NANOTIME_STEP_STATE_VERSION ||
+		state->size != (uint64_t)sizeof(nanotime_step_state) ||
+		state->now_max != stepper->now_max ||
+		state->sleep_duration == UINT64_C(0) ||
+		state->sleep_duration >= state->now_max / UINT64_C(2) - NANOTIME_NSEC_PER_SEC / UINT64_C(10) ||
+		state->sleep_point > state->now_max ||
+		state->accumulator > state->now_max / UINT64_C(2) ||
+		state->catch_up > (uint64_t)NANOTIME_STEP_CATCH_UP_DROP ||
+		(state->catch_up == (uint64_t)NANOTIME_STEP_CATCH_UP_SPREAD && state->catch_up_limit == UINT64_C(0))
+	) {
+		return false;
+	}
+
+	stepper->sleep_duration = state->sleep_duration;
+	stepper->sleep_point = state->sleep_point;
+	stepper->accumulator = state->accumulator;
+	stepper->catch_up = (nanotime_step_catch_up)state->catch_up;
+	stepper->catch_up_limit = state->catch_up_limit;
+	stepper->spread_debt = state->spread_debt;
+	stepper->spread_slice = state->spread_slice;
+	return true;
 }
 
-bool nanotime_step(nanotime_step_data* const stepper) {
+void nanotime_rate_limiter_init(nanotime_rate_limiter* const limiter, const uint64_t interval, const uint64_t burst, const uint64_t now, const uint64_t now_max) {
+	assert(limiter != NULL);
+	assert(interval > UINT64_C(0));
+	assert(burst > UINT64_C(0));
+	assert(now <= now_max);
+	assert(burst <= now_max / UINT64_C(2) / interval);
+
+	limiter->arrival_time = now;
+	limiter->interval = interval;
+	limiter->burst = burst;
+	limiter->now_max = now_max;
+}
+
+/*
+ * The arrival time at or before now is in the past, when the bucket has refilled
+ * since, so tokens are counted from now; otherwise, the arrival time is ahead
+ * of now by less than half the clock's range.
+ */
+static uint64_t nanotime_rate_ahead(const nanotime_rate_limiter* const limiter, const uint64_t arrival_time, const uint64_t now) {
+	const uint64_t ahead = nanotime_interval(now, arrival_time, limiter->now_max);
+	return ahead <= limiter->now_max / UINT64_C(2) ? ahead : UINT64_C(0);
+}
+
+bool nanotime_rate_try_acquire(nanotime_rate_limiter* const limiter, const uint64_t tokens, const uint64_t now, uint64_t* const wait) {
+	assert(limiter != NULL);
+	assert(tokens > UINT64_C(0));
+
+	const uint64_t allowed = limiter->burst * limiter->interval;
+	uint64_t arrival_time = NANOTIME_ATOMIC_LOAD(&limiter->arrival_time);
+	for (;;) {
+		const uint64_t ahead = nanotime_rate_ahead(limiter, arrival_time, now) + tokens * limiter->interval;
+		if (ahead > allowed) {
+			if (wait != NULL) {
+				*wait = ahead - allowed;
+			}
+			return false;
+		}
+		if (NANOTIME_ATOMIC_CAS(&limiter->arrival_time, &arrival_time, nanotime_step_after(now, ahead, limiter->now_max))) {
+			return true;
+		}
+	}
+}
+
+uint64_t nanotime_rate_acquire_or_wait(nanotime_rate_limiter* const limiter, const uint64_t tokens, nanotime_step_data* const stepper) {
+	assert(limiter != NULL);
+	assert(tokens > UINT64_C(0));
 	assert(stepper != NULL);
+	assert(stepper->now_max == limiter->now_max);
+
+	/*
+	 * The reservation always succeeds, pushing the arrival time ahead, and
+	 * the tokens are available once the arrival time is within a burst of
+	 * the current time.
+	 */
+	const uint64_t allowed = limiter->burst * limiter->interval;
+	const uint64_t now = nanotime_step_now(stepper);
+	uint64_t arrival_time = NANOTIME_ATOMIC_LOAD(&limiter->arrival_time);
+	uint64_t ahead;
+	do {
+		ahead = nanotime_rate_ahead(limiter, arrival_time, now) + tokens * limiter->interval;
+	} while (!NANOTIME_ATOMIC_CAS(&limiter->arrival_time, &arrival_time, nanotime_step_after(now, ahead, limiter->now_max)));
+	if (ahead <= allowed) {
+		return UINT64_C(0);
+	}
+
+	const uint64_t wait = ahead - allowed;
+	const uint64_t end = nanotime_step_wait(stepper, now, wait, now);
+	return nanotime_interval(now, end, limiter->now_max) - wait;
+}
+
+#if defined(NANOTIME_IO_URING) && !defined(NANOTIME_ONLY_STEP)
+#include <errno.h>
+#include <time.h>
+
+void nanotime_step_ring_init(nanotime_step_ring* const ring, struct io_uring* const io_uring, const uint64_t user_data, const uint64_t lead) {
+	assert(ring != NULL);
+	assert(io_uring != NULL);
+
+	ring->ring = io_uring;
+	ring->user_data = user_data;
+	ring->lead = lead;
+	ring->timeout.tv_sec = 0;
+	ring->timeout.tv_nsec = 0;
+	ring->clock_reads = UINT64_C(0);
+	ring->start_point = UINT64_C(0);
+	ring->stepping = false;
+	ring->pending = false;
+	ring->fallback = false;
+	ring->timeouts = UINT64_C(0);
+	ring->completions = UINT64_C(0);
+}
 
-	const uint64_t start_point = stepper->now();
+/*
+ * Submits a timeout expiring duration nanoseconds after now, a timestamp of
+ * nanotime_now. Absolute timeouts are of CLOCK_MONOTONIC, so the expiration is
+ * converted to it, which nanotime_now's clock doesn't drift from measurably
+ * over a step.
+ */
+static bool nanotime_step_ring_submit(nanotime_step_ring* const ring, const uint64_t duration) {
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+		return false;
+	}
+	const uint64_t expiration = (uint64_t)now.tv_sec * NANOTIME_NSEC_PER_SEC + (uint64_t)now.tv_nsec + duration;
+	ring->timeout.tv_sec = (long long)(expiration / NANOTIME_NSEC_PER_SEC);
+	ring->timeout.tv_nsec = (long long)(expiration % NANOTIME_NSEC_PER_SEC);
 
-	if (nanotime_interval(stepper->sleep_point, start_point, stepper->now_max) >= stepper->sleep_duration + NANOTIME_NSEC_PER_SEC / UINT64_C(10)) {
-		stepper->sleep_point = start_point;
-		stepper->accumulator = UINT64_C(0);
+	struct io_uring_sqe* sqe = io_uring_get_sqe(ring->ring);
+	if (sqe == NULL) {
+		io_uring_submit(ring->ring);
+		if ((sqe = io_uring_get_sqe(ring->ring)) == NULL) {
+			return false;
+		}
+	}
+	io_uring_prep_timeout(sqe, &ring->timeout, 0u, IORING_TIMEOUT_ABS);
+	sqe->user_data = ring->user_data;
+	if (io_uring_submit(ring->ring) < 0) {
+		return false;
 	}
+	ring->pending = true;
+	ring->timeouts++;
+	return true;
+}
 
-	bool slept;
-	if (stepper->accumulator < stepper->sleep_duration) {
-		const uint64_t total_sleep_duration = stepper->sleep_duration - stepper->accumulator;
-		uint64_t current_sleep_duration = total_sleep_duration;
-		const uint64_t shift = UINT64_C(4);
+nanotime_step_ring_event nanotime_step_ring_wait(nanotime_step_data* const stepper, nanotime_step_ring* const ring, struct io_uring_cqe** const cqe) {
+	assert(stepper != NULL);
+	assert(ring != NULL);
+	assert(cqe != NULL);
 
-		/*
-		 * The algorithm implemented here takes the assumption that a
-		 * sequence of repeated sleep requests of the same requested
-		 * duration end up being approximately of equal actual sleep
-		 * duration, even if they're all well above the requested
-		 * duration. In practice, such an assumption proves out to be
-		 * true on various platforms.
-		 */
+	if (!ring->stepping) {
+		ring->clock_reads = stepper->stats.clock_reads;
+		ring->start_point = nanotime_step_now(stepper);
+		nanotime_step_begin(stepper, ring->start_point);
+		ring->stepping = true;
+		ring->fallback = false;
 
-		/*
-		 * A big initial sleep lowers power usage on any platform, as
-		 * more small sleep requests use more power than fewer bigger,
-		 * equivalent sleep requests. In practice, operating systems
-		 * "actually sleep" when 1ms or more is requested, and 1ms is
-		 * the minimum request duration you can make on some platforms
-		 * (like older versions of Windows). Additionally, power usage
-		 * is nice and low when doing the number of 1ms sleeps that's
-		 * (hopefully) short of the target duration.
-		 *
-		 * But, the loop here maintains a maximum of the actual slept
-		 * durations, breaking out when the time remaining is greater
-		 * than or equal to the maximum found. By breaking out on the
-		 * maximum found rather than just 1ms-or-less remaining,
-		 * sleeping beyond the target deadline is reduced.
-		 */
-		{
-			uint64_t max = NANOTIME_NSEC_PER_SEC / UINT64_C(1000);
-			uint64_t start = stepper->now();
-			while (nanotime_interval(stepper->sleep_point, start, stepper->now_max) + max < total_sleep_duration) {
-				stepper->sleep(NANOTIME_NSEC_PER_SEC / UINT64_C(1000));
-				const uint64_t next = stepper->now();
-				const uint64_t current_interval = nanotime_interval(start, next, stepper->now_max);
-				if (current_interval > max) {
-					max = current_interval;
+		if (stepper->accumulator < stepper->sleep_duration) {
+			const uint64_t total_sleep_duration = stepper->sleep_duration - stepper->accumulator;
+			const uint64_t elapsed = nanotime_interval(stepper->sleep_point, ring->start_point, stepper->now_max);
+			if (elapsed + ring->lead < total_sleep_duration) {
+				if (nanotime_step_ring_submit(ring, total_sleep_duration - ring->lead - elapsed)) {
+					stepper->stats.wakeups++;
+				}
+				else {
+					ring->fallback = true;
 				}
-				start = next;
-			}
-			const uint64_t initial_duration = nanotime_interval(start_point, stepper->now(), stepper->now_max);
-			if (initial_duration < current_sleep_duration) {
-				current_sleep_duration -= initial_duration;
-			}
-			else {
-				goto step_end;
 			}
 		}
+	}
 
-		/*
-		 * This has the flavor of Zeno's dichotomous paradox of motion,
-		 * as it successively divides the time remaining to sleep, but
-		 * attempts to stop short of the deadline to hopefully be able
-		 * to precisely sleep up to the deadline below this loop. The
-		 * divisor is larger than two though, as it produces better
-		 * behavior, and seems to work fine in testing on real
-		 * hardware. The same method of keeping track of the max
-		 * duration per loop of same sleep request durations above is
-		 * used here. The overshoot possible in the loop below this one
-		 * won't overshoot much, or in the best case won't overshoot,
-		 * so the busyloop can finish up the sleep precisely.
-		 */
-		current_sleep_duration >>= shift;
-		for (
-			uint64_t max = stepper->zero_sleep_duration;
-			nanotime_interval(stepper->sleep_point, stepper->now(), stepper->now_max) + max < total_sleep_duration && current_sleep_duration > UINT64_C(0);
-			current_sleep_duration >>= shift
-		) {
-			max = stepper->zero_sleep_duration;
-			uint64_t start;
-			while (max < stepper->sleep_duration && nanotime_interval(stepper->sleep_point, start = stepper->now(), stepper->now_max) + max < total_sleep_duration) {
-				stepper->sleep(current_sleep_duration);
-				uint64_t slept_duration;
-				if ((slept_duration = nanotime_interval(start, stepper->now(), stepper->now_max)) > max) {
-					max = slept_duration;
-				}
-			}
+	while (ring->pending) {
+		struct io_uring_cqe* completion;
+		const int status = io_uring_wait_cqe(ring->ring, &completion);
+		if (status == -EINTR) {
+			continue;
 		}
-		if (nanotime_interval(stepper->sleep_point, stepper->now(), stepper->now_max) >= total_sleep_duration) {
-			goto step_end;
-		}
-
-		{
-			/*
-			 * After (hopefully) stopping short of the deadline by
-			 * a small amount, do small sleeps here to get closer
-			 * to the deadline, but again attempting to stop short
-			 * by an even smaller amount. It's best to do larger
-			 * sleeps as done in the above loops, to reduce
-			 * CPU/power usage, as each sleep iteration has a
-			 * more-or-less fixed overhead of CPU/power usage.
-			 *
-			 * In testing on an M1 Mac mini running macOS, power
-			 * usage is lower using zero-duration sleeps vs.
-			 * nanotime_yield(), with no loss of timing precision.
-			 * The same might be true for other hardwares/operating
-			 * systems.
-			 */
-			uint64_t max = stepper->zero_sleep_duration;
-			uint64_t start;
-			while (nanotime_interval(stepper->sleep_point, start = stepper->now(), stepper->now_max) + max < total_sleep_duration) {
-				stepper->sleep(UINT64_C(0));
-				if ((stepper->zero_sleep_duration = nanotime_interval(start, stepper->now(), stepper->now_max)) > max) {
-					max = stepper->zero_sleep_duration;
-				}
-			}
+		else if (status < 0) {
+			ring->fallback = true;
+			break;
+		}
+		if (!nanotime_step_ring_complete(ring, completion)) {
+			ring->completions++;
+			*cqe = completion;
+			return NANOTIME_STEP_RING_IO;
 		}
+		io_uring_cqe_seen(ring->ring, completion);
+	}
 
-		step_end:
-		{
-			/*
-			 * Finally, do a busyloop to precisely sleep up to the
-			 * deadline. The code above this loop attempts to
-			 * reduce the remaining time to sleep to a minimum via
-			 * process-yielding sleeps, so the amount of time spent
-			 * spinning here is hopefully quite low.
-			 *
-			 * In testing on an M1 Mac mini running macOS,
-			 * busylooping here produces the absolute greatest
-			 * precision possible on the hardware, down to the
-			 * sub-10ns-off-per-update range for longish stretches
-			 * during 60 Hz updates, but in the
-			 * hundreds-to-thousands of nanoseconds off when using
-			 * nanotime_yield() or zero-duration sleeps. And,
-			 * because the sleeping algorithm above does such a
-			 * good job of stopping very close to the deadline,
-			 * busylooping here has basically negligible difference
-			 * in power usage vs. yields/zero-duration sleeps.
-			 */
-			uint64_t current_time;
-			uint64_t accumulated;
-			while ((accumulated = nanotime_interval(stepper->sleep_point, current_time = stepper->now(), stepper->now_max)) < total_sleep_duration);
-
-			stepper->accumulator += accumulated;
-			stepper->sleep_point = current_time;
-			slept = true;
+	/*
+	 * The timeout woke up within the lead of the deadline, where the step
+	 * is finished by spinning, to not hold up the ring with blocking sleeps;
+	 * without the timeout, the step sleeps as usual.
+	 */
+	ring->stepping = false;
+	uint64_t current_time = ring->start_point;
+	if (stepper->accumulator < stepper->sleep_duration) {
+		const uint64_t total_sleep_duration = stepper->sleep_duration - stepper->accumulator;
+		current_time = nanotime_step_now(stepper);
+		if (ring->fallback) {
+			current_time = nanotime_step_wait(stepper, stepper->sleep_point, total_sleep_duration, current_time);
+		}
+		else {
+			current_time = nanotime_step_spin(stepper, stepper->sleep_point, total_sleep_duration, current_time);
 		}
 	}
-	else {
-		slept = false;
+	return nanotime_step_finish(stepper, ring->clock_reads, current_time) ? NANOTIME_STEP_RING_TICK : NANOTIME_STEP_RING_SKIP;
+}
+
+bool nanotime_step_ring_complete(nanotime_step_ring* const ring, const struct io_uring_cqe* const cqe) {
+	assert(ring != NULL);
+	assert(cqe != NULL);
+
+	if (cqe->user_data != ring->user_data) {
+		return false;
 	}
-	stepper->accumulator -= stepper->sleep_duration;
-	return slept;
+
+	/*
+	 * A timeout that didn't expire, such as where absolute timeouts aren't
+	 * supported, has the step sleep as usual.
+	 */
+	if (ring->pending) {
+		ring->pending = false;
+		if (cqe->res != -ETIME) {
+			ring->fallback = true;
+		}
+	}
+	return true;
 }
+#endif
 
 #endif
 
@@ -95,7 +95,21 @@
 // the render thread, in which case the main thread would have to signal to the
 // render thread to do the window operations, and window state would have to be
 // read in the render thread then communicated to the main thread.
+//
+// The logic thread (the main thread) hands each tick's state to the render
+// thread through a bounded lock-free ring, and the render thread renders the
+// newest state each display refresh, so the pipeline behaves like a game's.
+// Each frame is stamped at its tick, at the start of its rendering, and at its
+// present, and the program reports the distribution of the latencies between
+// the stamps, along with the frames dropped, when ticks were never rendered,
+// and duplicated, when a refresh came with no new tick to render.
+//
+// Built with the HEADLESS CMake option, no window is created; instead, the
+// render thread waits out a simulated GPU cost per frame, then a simulated
+// display refresh, so the pipeline can be measured where there's no display,
+// such as on CI.
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -107,57 +121,190 @@
 
 #define TICK_RATE 60.0
 
+// The number of tick states the ring holds; a power of two, so the ring's
+// indices can wrap around the range of int.
+#define RING_SIZE 8
+
+// The most frames reported on at once; the render thread reports once a
+// second, or after this many frames, whichever comes first.
+#define REPORT_FRAMES 1024
+
+// The latency histograms have buckets 10 us wide, up to 100 ms.
+#define LATENCY_BUCKET_WIDTH UINT64_C(10000)
+#define LATENCY_BUCKETS 10000
+
+// The state of a tick, with everything needed to render it.
+typedef struct tick_state {
+	uint64_t tick;
+	uint64_t tick_time;
+} tick_state;
+
+// The stages of a frame's latency, between the stamps taken at the tick, at the
+// start of rendering, and at the present.
+enum {
+	STAGE_QUEUE,
+	STAGE_RENDER,
+	STAGE_TOTAL,
+	NUM_STAGES
+};
+
+static const char* const stage_names[NUM_STAGES] = {
+	"tick to render",
+	"render to present",
+	"tick to present"
+};
+
+// The render thread's measurements, that the main thread reads after waiting
+// on the render thread.
+typedef struct render_data {
+	uint64_t latencies[NUM_STAGES][REPORT_FRAMES];
+	size_t report_frames;
+	uint64_t report_start;
+
+	uint64_t buckets[NUM_STAGES][LATENCY_BUCKETS];
+	uint64_t max[NUM_STAGES];
+	uint64_t frames;
+	uint64_t dropped;
+	uint64_t duplicated;
+} render_data;
+
 static SDL_atomic_t quit_now = { 0 };
-static SDL_atomic_t ticks = { 0 };
+
+// The ring is written at the head by the logic thread, and read up to the head
+// from the tail by the render thread; each thread only writes one of the
+// indices, and the release and acquire around the indices' accesses order the
+// tick states' accesses.
+static tick_state ring[RING_SIZE];
+static SDL_atomic_t ring_head = { 0 };
+static SDL_atomic_t ring_tail = { 0 };
 
 // We rely on thread create and wait being full memory barriers between a
 // spawning thread and spawned thread, so no sync is required for these. And,
 // since all writes of them are only done in the spawning thread (the main
 // thread), all reads in the spawned thread (the render thread) are guaranteed
-// valid.
+// valid. The render thread's measurements are likewise only read by the main
+// thread after the render thread closes.
+#ifdef HEADLESS
+static uint64_t frame_rate = 60;
+static uint64_t gpu_cost = 4000;
+#else
 static SDL_Window* window = NULL;
 static SDL_Renderer* renderer = NULL;
 static SDL_GLContext context = NULL;
-static SDL_sem* render_wake = NULL;
+#endif
+static render_data render_stats;
+
+// Adds a tick state for the render thread, returning false if the ring is full,
+// as when the render thread has stalled.
+static bool ring_put(const tick_state* const state) {
+	const int head = SDL_AtomicGet(&ring_head);
+	const int tail = SDL_AtomicGet(&ring_tail);
+	SDL_MemoryBarrierAcquire();
+	if ((unsigned)head - (unsigned)tail == RING_SIZE) {
+		return false;
+	}
+
+	ring[(unsigned)head % RING_SIZE] = *state;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&ring_head, (int)((unsigned)head + 1u));
+	return true;
+}
+
+// Takes the newest tick state added since the last take, returning false if
+// there's none. Older states are skipped, as rendering them would only add
+// latency, and counted as dropped.
+static bool ring_take(tick_state* const state, uint64_t* const dropped) {
+	const int tail = SDL_AtomicGet(&ring_tail);
+	const int head = SDL_AtomicGet(&ring_head);
+	SDL_MemoryBarrierAcquire();
+	const unsigned available = (unsigned)head - (unsigned)tail;
+	if (available == 0u) {
+		return false;
+	}
+
+	*state = ring[((unsigned)head - 1u) % RING_SIZE];
+	*dropped += available - 1u;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&ring_tail, head);
+	return true;
+}
+
+// Returns the latency below which the fraction of the histogram's latencies
+// fall, to the bucket width.
+static uint64_t latency_percentile(const uint64_t* const buckets, const uint64_t count, const double fraction) {
+	const uint64_t rank = (uint64_t)(fraction * (double)count);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen > rank) {
+			return (i + 1) * LATENCY_BUCKET_WIDTH;
+		}
+	}
+	return LATENCY_BUCKETS * LATENCY_BUCKET_WIDTH;
+}
+
+// Adds the frames measured since the last report to the histograms, logging
+// them if enabled.
+static void report(const uint64_t now) {
+	for (int stage = 0; stage < NUM_STAGES; stage++) {
+		nanotime_interval_stats stats;
+		nanotime_intervals_stats(render_stats.latencies[stage], render_stats.report_frames, &stats);
+		nanotime_intervals_histogram(render_stats.latencies[stage], render_stats.report_frames, LATENCY_BUCKET_WIDTH, render_stats.buckets[stage], LATENCY_BUCKETS);
+		if (stats.max > render_stats.max[stage]) {
+			render_stats.max[stage] = stats.max;
+		}
+#ifdef SHOW_LOG
+		SDL_Log("%s: %.0f ns mean, %" PRIu64 " ns max\n", stage_names[stage], stats.mean, stats.max);
+#endif
+	}
+#ifdef SHOW_LOG
+	SDL_Log("%" PRIu64 " frames, %" PRIu64 " dropped, %" PRIu64 " duplicated\n", render_stats.frames, render_stats.dropped, render_stats.duplicated);
+#endif
+	render_stats.report_frames = 0;
+	render_stats.report_start = now;
+}
 
 static int SDLCALL render(void* data) {
+#ifdef HEADLESS
+	// The simulated display refreshes at the frame rate, independent of the
+	// tick rate, as a real display does.
+	nanotime_step_data refresh;
+	nanotime_step_init(&refresh, NANOTIME_NSEC_PER_SEC / frame_rate, nanotime_now_max(), nanotime_now, nanotime_sleep);
+#else
 	SDL_assert(window != NULL);
 	SDL_assert(renderer != NULL);
 	SDL_assert(context != NULL);
-	SDL_assert(render_wake != NULL);
 
 	if (SDL_GL_MakeCurrent(window, context) < 0) {
 		SDL_MemoryBarrierRelease();
 		SDL_AtomicSet(&quit_now, 1);
 		return -1;
 	}
+#endif
 
+	tick_state state;
+	bool rendered = false;
+	render_stats.report_start = nanotime_now();
 	while (true) {
-		if (SDL_SemWait(render_wake) < 0) {
-			SDL_GL_MakeCurrent(window, NULL);
-			SDL_MemoryBarrierRelease();
-			SDL_AtomicSet(&quit_now, 1);
-			return -2;
-		}
-
-		// quit_now is set true before waking this thread by the main
-		// thread when the main thread determines it's time to quit, so
-		// we always have to acquire to be sure we get the correct
-		// value each wakeup that the main thread expects this thread
-		// to observe.
+		// quit_now is set true by the main thread when the main thread
+		// determines it's time to quit, so we always have to acquire to
+		// be sure we get the correct value each frame.
 		const int current_quit_now = SDL_AtomicGet(&quit_now);
 		SDL_MemoryBarrierAcquire();
 		if (current_quit_now) {
 			break;
 		}
 
-		// We want to be sure the ticks count monotonically proceeds
-		// through its range, not observing old values before new
-		// values, so we have to acquire here.
-		const int current_ticks = SDL_AtomicGet(&ticks);
-		SDL_MemoryBarrierAcquire();
-
-		const Uint8 shade = (Uint8)(((SDL_sin(2.0 * M_PI * (current_ticks / TICK_RATE)) + 1.0) / 2.0) * 255.0);
+		const bool fresh = ring_take(&state, &render_stats.dropped);
+		const uint64_t render_start = nanotime_now();
+#ifdef HEADLESS
+		nanotime_precise_sleep(gpu_cost);
+		nanotime_step(&refresh);
+#else
+		// Before the first tick, the window is cleared to black.
+		const Uint8 shade = rendered || fresh ?
+			(Uint8)(((SDL_sin(2.0 * M_PI * ((double)(state.tick % (uint64_t)TICK_RATE) / TICK_RATE)) + 1.0) / 2.0) * 255.0) :
+			0;
 		if (
 			SDL_SetRenderDrawColor(renderer, shade, shade, shade, SDL_ALPHA_OPAQUE) < 0 ||
 			SDL_RenderClear(renderer) < 0
@@ -165,16 +312,61 @@ static int SDLCALL render(void* data) {
 			SDL_GL_MakeCurrent(window, NULL);
 			SDL_MemoryBarrierRelease();
 			SDL_AtomicSet(&quit_now, 1);
-			return -3;
+			return -2;
 		}
+
+		// The renderer presents with vsync, so this waits for the
+		// display's refresh.
 		SDL_RenderPresent(renderer);
+#endif
+		const uint64_t present = nanotime_now();
+
+		if (fresh) {
+			const size_t frame = render_stats.report_frames++;
+			render_stats.latencies[STAGE_QUEUE][frame] = nanotime_interval(state.tick_time, render_start, nanotime_now_max());
+			render_stats.latencies[STAGE_RENDER][frame] = nanotime_interval(render_start, present, nanotime_now_max());
+			render_stats.latencies[STAGE_TOTAL][frame] = nanotime_interval(state.tick_time, present, nanotime_now_max());
+			render_stats.frames++;
+			rendered = true;
+		}
+		else if (rendered) {
+			render_stats.duplicated++;
+			render_stats.frames++;
+		}
+		if (render_stats.report_frames == REPORT_FRAMES || nanotime_interval(render_stats.report_start, present, nanotime_now_max()) >= NANOTIME_NSEC_PER_SEC) {
+			report(present);
+		}
 	}
+	report(nanotime_now());
 
+#ifndef HEADLESS
 	SDL_GL_MakeCurrent(window, NULL);
+#endif
 	return 0;
 }
 
 int main(int argc, char** argv) {
+#ifdef HEADLESS
+	uint64_t seconds = 10;
+	if (
+		argc > 4 ||
+		(argc >= 2 && sscanf(argv[1], "%" SCNu64, &seconds) != 1) ||
+		(argc >= 3 && (sscanf(argv[2], "%" SCNu64, &frame_rate) != 1 || frame_rate == 0)) ||
+		(argc >= 4 && sscanf(argv[3], "%" SCNu64, &gpu_cost) != 1)
+	) {
+		fprintf(stderr, "Usage: render_thread_test_nanotime_step [seconds] [frame rate] [GPU cost]\n");
+		fprintf(stderr, "[seconds] is how long to run for, or 0 to run until interrupted; the default is 10.\n");
+		fprintf(stderr, "[frame rate] is the simulated display's refresh rate in Hz; the default is 60.\n");
+		fprintf(stderr, "[GPU cost] is the simulated time to render a frame in microseconds; the default is 4000.\n");
+		return EXIT_FAILURE;
+	}
+	gpu_cost *= UINT64_C(1000);
+
+	if (SDL_Init(SDL_INIT_EVENTS) < 0) {
+		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+#else
 	if (SDL_Init(SDL_INIT_EVENTS | SDL_INIT_VIDEO) < 0) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SDL_Init failed\n");
 		return EXIT_FAILURE;
@@ -204,12 +396,12 @@ int main(int argc, char** argv) {
 		SDL_Quit();
 		return EXIT_FAILURE;
 	}
+#endif
 
 	SDL_MemoryBarrierRelease();
 	SDL_AtomicSet(&quit_now, 0);
-	SDL_MemoryBarrierRelease();
-	SDL_AtomicSet(&ticks, 0);
 
+#ifndef HEADLESS
 	window = SDL_CreateWindow("render_thread_test_nanotime_step", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 480, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
 	if (!window) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SDL_CreateWindow failed\n");
@@ -217,7 +409,7 @@ int main(int argc, char** argv) {
 		return EXIT_FAILURE;
 	}
 
-	renderer = SDL_CreateRenderer(window, render_driver, SDL_RENDERER_ACCELERATED);
+	renderer = SDL_CreateRenderer(window, render_driver, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (!renderer) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "SDL_CreateRenderer failed\n");
 		SDL_DestroyWindow(window);
@@ -233,20 +425,12 @@ int main(int argc, char** argv) {
 		SDL_Quit();
 		return EXIT_FAILURE;
 	}
-
-	render_wake = SDL_CreateSemaphore(0);
-	if (!render_wake) {
-		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to create render_wake semaphore\n");
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
-		SDL_Quit();
-		return EXIT_FAILURE;
-	}
+#endif
 
 	SDL_Thread* const render_thread = SDL_CreateThread(render, "render_thread", NULL);
 	if (!render_thread) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to create the render thread\n");
-		SDL_DestroySemaphore(render_wake);
+#ifndef HEADLESS
 		if (SDL_GL_MakeCurrent(window, context) >= 0) {
 			SDL_DestroyRenderer(renderer);
 			SDL_DestroyWindow(window);
@@ -254,6 +438,7 @@ int main(int argc, char** argv) {
 		else {
 			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Failed to make context current in main thread\n");
 		}
+#endif
 		SDL_Quit();
 		return EXIT_FAILURE;
 	}
@@ -269,6 +454,8 @@ int main(int argc, char** argv) {
 	uint64_t last_point = stepper.sleep_point;
 	uint64_t sleep_total = 0;
 	uint64_t num_ticks = 0;
+	uint64_t tick = 0;
+	uint64_t overflowed = 0;
 
 	int status = 0;
 	while (true) {
@@ -295,18 +482,19 @@ int main(int argc, char** argv) {
 			goto end;
 		}
 
-		if (SDL_AtomicGet(&ticks) == (int)TICK_RATE - 1) {
-			SDL_MemoryBarrierRelease();
-			SDL_AtomicSet(&ticks, 0);
-		}
-		else {
-			SDL_MemoryBarrierRelease();
-			SDL_AtomicIncRef(&ticks);
+#ifdef HEADLESS
+		if (seconds > 0 && tick == seconds * (uint64_t)TICK_RATE) {
+			goto end;
 		}
+#endif
 
-		if (SDL_SemPost(render_wake) < 0) {
-			SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error waking render thread during main thread ticks\n");
-			abort();
+		// The tick's state is stamped as it's handed off, when an input
+		// read this tick would have taken effect.
+		tick_state state;
+		state.tick = tick++;
+		state.tick_time = nanotime_now();
+		if (!ring_put(&state)) {
+			overflowed++;
 		}
 
 		nanotime_step(&stepper);
@@ -329,10 +517,6 @@ end:
 	SDL_MemoryBarrierRelease();
 	SDL_AtomicSet(&quit_now, 1);
 
-	if (SDL_SemPost(render_wake) < 0) {
-		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error waking render thread at quit\n");
-		abort();
-	}
 	SDL_WaitThread(render_thread, &status);
 	switch (status) {
 	default:
@@ -347,21 +531,38 @@ end:
 		break;
 
 	case -2:
-		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error waiting on semaphore in render thread\n");
-		abort();
-
-	case -3:
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error rendering in render thread\n");
 		break;
 	}
 
+	// Ticks that didn't fit in the ring were never rendered, so they're
+	// dropped frames too.
+	SDL_Log("%" PRIu64 " ticks, %" PRIu64 " frames, %" PRIu64 " dropped (%" PRIu64 " with the ring full), %" PRIu64 " duplicated\n",
+		tick,
+		render_stats.frames,
+		render_stats.dropped + overflowed,
+		overflowed,
+		render_stats.duplicated
+	);
+	const uint64_t fresh_frames = render_stats.frames - render_stats.duplicated;
+	for (int stage = 0; stage < NUM_STAGES; stage++) {
+		SDL_Log("%s latency: %" PRIu64 " ns p50, %" PRIu64 " ns p90, %" PRIu64 " ns p99, %" PRIu64 " ns max\n",
+			stage_names[stage],
+			latency_percentile(render_stats.buckets[stage], fresh_frames, 0.50),
+			latency_percentile(render_stats.buckets[stage], fresh_frames, 0.90),
+			latency_percentile(render_stats.buckets[stage], fresh_frames, 0.99),
+			render_stats.max[stage]
+		);
+	}
+
+#ifndef HEADLESS
 	if (SDL_GL_MakeCurrent(window, context) < 0) {
 		SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Error making context current at quit\n");
 		abort();
 	}
-	SDL_DestroySemaphore(render_wake);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
+#endif
 	SDL_Quit();
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,286 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Checks nanotime_now for monotonicity across all cores, to find hosts whose
+// clocks go backwards when threads migrate between cores, as happens on some
+// virtual machines. Such hosts cause giant intervals and stepper resets,
+// unless nanotime_now_monotonic is used.
+//
+// One thread is run per core, pinned to its core where supported (Linux and
+// Windows). The threads take turns reading the clock under a spinlock, so each
+// read happens-after the previous read on whichever core made it; any
+// timestamp less than the previous one is a regression, and the largest
+// regression seen between a pair of cores is a lower bound on the clock skew
+// between them. The same is done for nanotime_now_monotonic, which should never
+// regress.
+//
+// Then the cost of nanotime_now_monotonic is measured against nanotime_now, by
+// calling each in a loop on one thread, then on all the threads at once, where
+// nanotime_now_monotonic's high-water mark is contended between the cores.
+//
+// Exits with failure status if any regression was found.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+#include "SDL.h"
+
+#define MAX_CORES 256
+
+static SDL_atomic_t quit_now;
+static SDL_SpinLock clock_lock;
+
+// All of these are protected by clock_lock.
+static uint64_t last_time;
+static int last_core = -1;
+static uint64_t last_guarded_time;
+static uint64_t num_samples;
+static uint64_t num_regressions;
+static uint64_t num_guarded_regressions;
+static uint64_t max_regression[MAX_CORES][MAX_CORES];
+
+static bool pin_thread(const int core) {
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	return core < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#else
+	(void)core;
+	return false;
+#endif
+}
+
+static int SDLCALL check_thread_function(void* data) {
+	const int core = (int)(intptr_t)data;
+	pin_thread(core);
+
+	const uint64_t now_max = nanotime_now_max();
+	while (!SDL_AtomicGet(&quit_now)) {
+		SDL_AtomicLock(&clock_lock);
+		const uint64_t now = nanotime_now();
+		const uint64_t guarded_now = nanotime_now_monotonic();
+		if (last_core >= 0) {
+			// A timestamp more than half the wrap period behind is
+			// past a wraparound, not a regression.
+			const uint64_t behind = nanotime_interval(now, last_time, now_max);
+			if (behind > 0 && behind <= now_max / 2) {
+				num_regressions++;
+				if (behind > max_regression[last_core][core]) {
+					max_regression[last_core][core] = behind;
+				}
+			}
+			const uint64_t guarded_behind = nanotime_interval(guarded_now, last_guarded_time, now_max);
+			if (guarded_behind > 0 && guarded_behind <= now_max / 2) {
+				num_guarded_regressions++;
+			}
+		}
+		last_time = now;
+		last_guarded_time = guarded_now;
+		last_core = core;
+		num_samples++;
+		SDL_AtomicUnlock(&clock_lock);
+	}
+
+	return 0;
+}
+
+typedef struct cost_data {
+	int core;
+	uint64_t (* now)();
+	uint64_t calls;
+	uint64_t duration;
+} cost_data;
+
+static SDL_atomic_t start_cost;
+
+static int SDLCALL cost_thread_function(void* data) {
+	cost_data* const cost = (cost_data*)data;
+	pin_thread(cost->core);
+
+	uint64_t (* const now)() = cost->now;
+	while (!SDL_AtomicGet(&start_cost));
+	const uint64_t start = nanotime_now();
+	uint64_t calls = 0;
+	while (!SDL_AtomicGet(&quit_now)) {
+		for (int i = 0; i < 1000; i++) {
+			now();
+		}
+		calls += 1000;
+	}
+	cost->duration = nanotime_interval(start, nanotime_now(), nanotime_now_max());
+	cost->calls = calls;
+	return 0;
+}
+
+// Returns the mean nanoseconds per call of now, calling it on num_threads
+// threads at once for the duration, or a negative value if the threads couldn't
+// be run.
+static double measure_cost(uint64_t (* const now)(), const int num_threads, const double seconds) {
+	static cost_data costs[MAX_CORES];
+	SDL_Thread* threads[MAX_CORES];
+
+	SDL_AtomicSet(&start_cost, 0);
+	SDL_AtomicSet(&quit_now, 0);
+	int num_started = 0;
+	for (; num_started < num_threads; num_started++) {
+		costs[num_started].core = num_started;
+		costs[num_started].now = now;
+		costs[num_started].calls = 0;
+		costs[num_started].duration = 0;
+		threads[num_started] = SDL_CreateThread(cost_thread_function, "cost_thread", &costs[num_started]);
+		if (!threads[num_started]) {
+			break;
+		}
+	}
+	SDL_AtomicSet(&start_cost, 1);
+	if (num_started == num_threads) {
+		nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+	}
+	SDL_AtomicSet(&quit_now, 1);
+	for (int i = 0; i < num_started; i++) {
+		SDL_WaitThread(threads[i], NULL);
+	}
+	if (num_started < num_threads) {
+		return -1.0;
+	}
+
+	// Each thread's time per call, averaged over the threads.
+	double total = 0.0;
+	for (int i = 0; i < num_threads; i++) {
+		if (costs[i].calls > 0) {
+			total += (double)costs[i].duration / (double)costs[i].calls;
+		}
+	}
+	return total / num_threads;
+}
+
+int main(int argc, char** argv) {
+	double seconds = 1.0;
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "%lf", &seconds) != 1 || seconds <= 0.0))) {
+		fprintf(stderr, "Usage: test_nanotime_monotonic [seconds]\n");
+		fprintf(stderr, "[seconds] is the duration to check for, and must be greater than 0.0; the default is 1.0.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (SDL_Init(0) < 0) {
+		fprintf(stderr, "SDL_Init failed\n");
+		return EXIT_FAILURE;
+	}
+
+	int num_cores = SDL_GetCPUCount();
+	if (num_cores > MAX_CORES) {
+		num_cores = MAX_CORES;
+	}
+	printf("Checking nanotime_now on %d cores for %.3f seconds\n", num_cores, seconds);
+
+	SDL_AtomicSet(&quit_now, 0);
+	SDL_Thread* threads[MAX_CORES];
+	for (int core = 0; core < num_cores; core++) {
+		threads[core] = SDL_CreateThread(check_thread_function, "check_thread", (void*)(intptr_t)core);
+		if (!threads[core]) {
+			fprintf(stderr, "Failed to create the thread for core %d\n", core);
+			SDL_AtomicSet(&quit_now, 1);
+			for (int i = 0; i < core; i++) {
+				SDL_WaitThread(threads[i], NULL);
+			}
+			SDL_Quit();
+			return EXIT_FAILURE;
+		}
+	}
+
+	nanotime_sleep((uint64_t)(seconds * NANOTIME_NSEC_PER_SEC));
+	SDL_AtomicSet(&quit_now, 1);
+	for (int core = 0; core < num_cores; core++) {
+		SDL_WaitThread(threads[core], NULL);
+	}
+
+	printf("Samples: %" PRIu64 "\n", num_samples);
+	printf("nanotime_now regressions: %" PRIu64 "\n", num_regressions);
+	for (int from = 0; from < num_cores; from++) {
+		for (int to = 0; to < num_cores; to++) {
+			if (max_regression[from][to] > 0) {
+				printf("    core %d -> core %d: up to %" PRIu64 " ns backwards\n", from, to, max_regression[from][to]);
+			}
+		}
+	}
+	printf("nanotime_now_monotonic regressions: %" PRIu64 " (%" PRIu64 " clamped)\n", num_guarded_regressions, nanotime_now_monotonic_regressions());
+
+	const double cost_seconds = seconds < 0.5 ? seconds : 0.5;
+	printf("Cost per call, on 1 thread, then on %d threads at once:\n", num_cores);
+	printf("    nanotime_now: %.1f ns, %.1f ns\n", measure_cost(nanotime_now, 1, cost_seconds), measure_cost(nanotime_now, num_cores, cost_seconds));
+	printf("    nanotime_now_monotonic: %.1f ns, %.1f ns\n", measure_cost(nanotime_now_monotonic, 1, cost_seconds), measure_cost(nanotime_now_monotonic, num_cores, cost_seconds));
+
+	SDL_Quit();
+	if (num_regressions > 0 || num_guarded_regressions > 0) {
+		printf("FAIL: the clock went backwards on this host\n");
+		return EXIT_FAILURE;
+	}
+	else {
+		printf("PASS: no clock regressions found\n");
+		return EXIT_SUCCESS;
+	}
+}
@@ -89,5 +89,10 @@ int main(int argc, char** argv) {
 		printf("No remaining suspension time.\n");
 	}
 
+	if (req <= nanotime_now_max() / 2) {
+		const uint64_t deviation = nanotime_precise_sleep(req);
+		printf("Precise suspension overshoot (seconds): %.9f\n", (double)deviation / NANOTIME_NSEC_PER_SEC);
+	}
+
 	return EXIT_SUCCESS;
 }
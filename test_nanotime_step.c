@@ -65,53 +65,73 @@
 
 #define FRAME_RATE 120.0
 
+// The speed of the square, in window widths per second.
+#define SQUARE_SPEED 0.5
+
+#define SQUARE_SIZE 32
+
 static SDL_atomic_t quit_now;
 static SDL_atomic_t reset_average;
 
-static SDL_mutex* logic_mutex;
-
-/*
- * logic_data[0] is owned by the logic thread and doesn't need locking,
- * logic_data[1] is shared so must be locked, but try-lock is used for
- * logic_data[1] to avoid ever blocking the logic thread, since it's acceptable
- * for the logic data accessed in the main thread to be slightly outdated.
- */
-struct {
+// The logic data is cache-line aligned, so the logic thread writing the next
+// published state never invalidates the cache lines of the states the main
+// thread is reading.
+typedef struct NANOTIME_CACHE_ALIGNED logic_data {
 	uint64_t update_measured;
 	uint64_t update_sleep_total;
 	uint64_t accumulator;
 	uint64_t num_updates;
-} logic_data[2] = {0};
+
+	// The square's position across the window, from 0.0 to 1.0, and its
+	// direction of motion.
+	double square_position;
+	double square_direction;
+} logic_data;
+
+// The logic data is owned by the logic thread and doesn't need locking; it's
+// published to the main thread with a step publisher after every update, so
+// the main thread can read the latest two updates' data without ever blocking
+// the logic thread, and can interpolate the square between them.
+static logic_data logic;
+static logic_data logic_states[3];
+static nanotime_step_publisher logic_publisher;
 
 static void update_logic(const uint64_t last_sleep_point, nanotime_step_data* const stepper) {
-	logic_data[0].update_measured = nanotime_interval(last_sleep_point, stepper->sleep_point, nanotime_now_max());
+	logic.update_measured = nanotime_interval(last_sleep_point, stepper->sleep_point, nanotime_now_max());
 	if (SDL_AtomicCAS(&reset_average, 1, 0)) {
-		logic_data[0].update_sleep_total = 0;
-		logic_data[0].num_updates = 0;
+		logic.update_sleep_total = 0;
+		logic.num_updates = 0;
 	}
-	logic_data[0].update_sleep_total += logic_data[0].update_measured;
-	logic_data[0].accumulator = stepper->accumulator;
-	logic_data[0].num_updates++;
+	logic.update_sleep_total += logic.update_measured;
+	logic.accumulator = stepper->accumulator;
+	logic.num_updates++;
 
-	if (SDL_TryLockMutex(logic_mutex) == 0) {
-		logic_data[1] = logic_data[0];
-		SDL_UnlockMutex(logic_mutex);
+	logic.square_position += logic.square_direction * SQUARE_SPEED / LOGIC_RATE;
+	if (logic.square_position >= 1.0) {
+		logic.square_position = 2.0 - logic.square_position;
+		logic.square_direction = -1.0;
+	}
+	else if (logic.square_position <= 0.0) {
+		logic.square_position = -logic.square_position;
+		logic.square_direction = 1.0;
 	}
+
+	nanotime_step_publish(&logic_publisher, stepper, &logic);
 }
 
 #ifdef MULTITHREADED
+static nanotime_step_data logic_stepper;
+
 static int SDLCALL update_logic_thread_function(void* data) {
 #ifdef REALTIME
 	SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
 	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
 #endif
 
-	nanotime_step_data stepper;
-	nanotime_step_init(&stepper, (uint64_t)(NANOTIME_NSEC_PER_SEC / LOGIC_RATE), nanotime_now_max(), nanotime_now, nanotime_sleep);
 	while (!SDL_AtomicGet(&quit_now)) {
-		const uint64_t last_sleep_point = stepper.sleep_point;
-		nanotime_step(&stepper);
-		update_logic(last_sleep_point, &stepper);
+		const uint64_t last_sleep_point = logic_stepper.sleep_point;
+		nanotime_step(&logic_stepper);
+		update_logic(last_sleep_point, &logic_stepper);
 	}
 
 	return 0;
@@ -138,18 +158,19 @@ int main(int argc, char** argv) {
 	SDL_AtomicSet(&quit_now, 0);
 	SDL_AtomicSet(&reset_average, 0);
 
-	logic_mutex = SDL_CreateMutex();
-	if (!logic_mutex) {
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
-		SDL_Quit();
-		return EXIT_FAILURE;
-	}
+	logic.square_direction = 1.0;
+
+	nanotime_step_data stepper;
 
 #ifdef MULTITHREADED
+	// The logic stepper and publisher are initialized before the logic
+	// thread is created, so the publisher is ready for the main thread
+	// as soon as the logic thread is running.
+	nanotime_step_init(&logic_stepper, (uint64_t)(NANOTIME_NSEC_PER_SEC / LOGIC_RATE), nanotime_now_max(), nanotime_now, nanotime_sleep);
+	nanotime_step_publisher_init(&logic_publisher, &logic_stepper, logic_states, sizeof(logic), &logic);
+
 	SDL_Thread* const logic_thread = SDL_CreateThread(update_logic_thread_function, "logic_thread", NULL);
 	if (!logic_thread) {
-		SDL_DestroyMutex(logic_mutex);
 		SDL_DestroyRenderer(renderer);
 		SDL_DestroyWindow(window);
 		SDL_Quit();
@@ -157,8 +178,6 @@ int main(int argc, char** argv) {
 	}
 #endif
 
-	nanotime_step_data stepper;
-
 #ifdef REALTIME
 	SDL_SetHint(SDL_HINT_THREAD_FORCE_REALTIME_TIME_CRITICAL, "1");
 	SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
@@ -168,6 +187,7 @@ int main(int argc, char** argv) {
 	nanotime_step_init(&stepper, (uint64_t)(NANOTIME_NSEC_PER_SEC / FRAME_RATE), nanotime_now_max(), nanotime_now, nanotime_sleep);
 #else
 	nanotime_step_init(&stepper, (uint64_t)(NANOTIME_NSEC_PER_SEC / LOGIC_RATE), nanotime_now_max(), nanotime_now, nanotime_sleep);
+	nanotime_step_publisher_init(&logic_publisher, &stepper, logic_states, sizeof(logic), &logic);
 #endif
 
 	// The SDL2 documentation says that for maximally-portable code, video
@@ -193,51 +213,53 @@ int main(int argc, char** argv) {
 #ifdef MULTITHREADED
 			SDL_WaitThread(logic_thread, NULL);
 #endif
-			SDL_DestroyMutex(logic_mutex);
 			SDL_DestroyRenderer(renderer);
 			SDL_DestroyWindow(window);
 			SDL_Quit();
 			return EXIT_FAILURE;
 		}
 
-		// Just pretend this is rendering to the screen; it's still in
-		// the right place if it were render code.
-		status = SDL_TryLockMutex(logic_mutex);
-		if (status == 0) {
-			if (logic_data[1].num_updates > UINT64_C(0)) {
-#ifdef SHOW_LOG
-				SDL_Log("%" PRIu64 " ns/frame current, %" PRIu64 " ns/frame average, %" PRId64 " ns off, accumulated %" PRIu64 " ns\n",
-					logic_data[1].update_measured,
-					logic_data[1].update_sleep_total / logic_data[1].num_updates,
-					(int64_t)logic_data[1].update_measured - (int64_t)(NANOTIME_NSEC_PER_SEC / LOGIC_RATE),
-					logic_data[1].accumulator
-				);
-#endif
-			}
-			if (SDL_UnlockMutex(logic_mutex) == -1) {
-				SDL_AtomicSet(&quit_now, 1);
-#ifdef MULTITHREADED
-				SDL_WaitThread(logic_thread, NULL);
-#endif
-				SDL_DestroyMutex(logic_mutex);
-				SDL_DestroyRenderer(renderer);
-				SDL_DestroyWindow(window);
-				SDL_Quit();
-				return EXIT_FAILURE;
-			}
-		}
-		else if (status == -1) {
+		// The square is interpolated between the latest two logic
+		// updates, so it moves smoothly at the frame rate, even though
+		// the logic is updated at a different rate.
+		logic_data previous;
+		logic_data current;
+		const double alpha = nanotime_step_snapshot(&logic_publisher, nanotime_now(), &previous, &current);
+		const double square_position = previous.square_position * (1.0 - alpha) + current.square_position * alpha;
+		int width;
+		int height;
+		SDL_GetWindowSize(window, &width, &height);
+		const SDL_Rect square = {
+			(int)(square_position * (width - SQUARE_SIZE)),
+			(height - SQUARE_SIZE) / 2,
+			SQUARE_SIZE,
+			SQUARE_SIZE
+		};
+		if (
+			SDL_SetRenderDrawColor(renderer, 255 - shade, 255 - shade, 255 - shade, SDL_ALPHA_OPAQUE) < 0 ||
+			SDL_RenderFillRect(renderer, &square) < 0
+		) {
 			SDL_AtomicSet(&quit_now, 1);
 #ifdef MULTITHREADED
 			SDL_WaitThread(logic_thread, NULL);
 #endif
-			SDL_DestroyMutex(logic_mutex);
 			SDL_DestroyRenderer(renderer);
 			SDL_DestroyWindow(window);
 			SDL_Quit();
 			return EXIT_FAILURE;
 		}
 
+		if (current.num_updates > UINT64_C(0)) {
+#ifdef SHOW_LOG
+			SDL_Log("%" PRIu64 " ns/frame current, %" PRIu64 " ns/frame average, %" PRId64 " ns off, accumulated %" PRIu64 " ns\n",
+				current.update_measured,
+				current.update_sleep_total / current.num_updates,
+				(int64_t)current.update_measured - (int64_t)(NANOTIME_NSEC_PER_SEC / LOGIC_RATE),
+				current.accumulator
+			);
+#endif
+		}
+
 		SDL_RenderPresent(renderer);
 
 		// The timestep should be here, followed by input, as the
@@ -266,7 +288,6 @@ int main(int argc, char** argv) {
 			SDL_AtomicSet(&quit_now, 1);
 #ifdef MULTITHREADED
 			SDL_WaitThread(logic_thread, NULL);
-			SDL_DestroyMutex(logic_mutex);
 #endif
 			SDL_DestroyRenderer(renderer);
 			SDL_DestroyWindow(window);
@@ -275,9 +296,8 @@ int main(int argc, char** argv) {
 		}
 	}
 
-#ifdef MULTITHREDED
+#ifdef MULTITHREADED
 	SDL_WaitThread(logic_thread, NULL);
-	SDL_DestroyMutex(logic_mutex);
 #endif
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
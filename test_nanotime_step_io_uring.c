@@ -0,0 +1,248 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Runs a stepper on an io_uring shared with I/O, as a server thread driving
+// both its timed ticks and its I/O with one ring would. A second thread writes
+// timestamps into a pipe at intervals unrelated to the step rate, and the ring
+// thread reads them, reporting how precisely the ticks land and how long the
+// I/O completions wait for the ring thread while it's stepping.
+//
+// Requires building with NANOTIME_IO_URING defined and linking liburing; see
+// the NANOTIME_IO_URING CMake option. Linux only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define NANOTIME_IO_URING
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+
+#define RING_ENTRIES 64
+
+// The user data of the ring's reads of the pipe; the stepper's timeouts are
+// tagged with another.
+#define READ_USER_DATA UINT64_C(1)
+#define STEP_USER_DATA UINT64_C(2)
+
+// The writer's period, chosen to not be a multiple of common step rates.
+#define WRITE_PERIOD (NANOTIME_NSEC_PER_SEC / UINT64_C(270))
+
+typedef struct writer_data {
+	int fd;
+	volatile bool quit;
+} writer_data;
+
+static void* writer_thread(void* const arg) {
+	writer_data* const writer = (writer_data*)arg;
+	while (!writer->quit) {
+		nanotime_sleep(WRITE_PERIOD);
+		const uint64_t now = nanotime_now();
+		if (write(writer->fd, &now, sizeof(now)) != (ssize_t)sizeof(now)) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+static bool submit_read(struct io_uring* const ring, const int fd, uint64_t* const buffer) {
+	struct io_uring_sqe* const sqe = io_uring_get_sqe(ring);
+	if (sqe == NULL) {
+		return false;
+	}
+	io_uring_prep_read(sqe, fd, buffer, sizeof(*buffer), 0u);
+	sqe->user_data = READ_USER_DATA;
+	return io_uring_submit(ring) >= 0;
+}
+
+int main(int argc, char** argv) {
+	uint64_t rate = 1000;
+	uint64_t seconds = 5;
+	uint64_t lead = 100;
+	if (
+		argc > 4 ||
+		(argc >= 2 && (sscanf(argv[1], "%" SCNu64, &rate) != 1 || rate == 0)) ||
+		(argc >= 3 && sscanf(argv[2], "%" SCNu64, &seconds) != 1) ||
+		(argc >= 4 && sscanf(argv[3], "%" SCNu64, &lead) != 1)
+	) {
+		fprintf(stderr, "Usage: test_nanotime_step_io_uring [rate] [seconds] [lead]\n");
+		fprintf(stderr, "[rate] is the step rate in Hz, 1000 by default; [seconds] is how long to run for, 5 by default; [lead] is how many microseconds before each deadline the ring's timeout expires, spinning the rest, 100 by default.\n");
+		return EXIT_FAILURE;
+	}
+	const uint64_t sleep_duration = NANOTIME_NSEC_PER_SEC / rate;
+	if (lead * UINT64_C(1000) >= sleep_duration) {
+		fprintf(stderr, "The lead must be shorter than a step\n");
+		return EXIT_FAILURE;
+	}
+
+	struct io_uring ring;
+	const int status = io_uring_queue_init(RING_ENTRIES, &ring, 0u);
+	if (status < 0) {
+		fprintf(stderr, "Failed to set up an io_uring, error %d\n", -status);
+		return EXIT_FAILURE;
+	}
+	int fds[2];
+	if (pipe(fds) != 0) {
+		fprintf(stderr, "Failed to create a pipe\n");
+		io_uring_queue_exit(&ring);
+		return EXIT_FAILURE;
+	}
+	uint64_t buffer;
+	if (!submit_read(&ring, fds[0], &buffer)) {
+		fprintf(stderr, "Failed to submit a read\n");
+		io_uring_queue_exit(&ring);
+		return EXIT_FAILURE;
+	}
+
+	writer_data writer;
+	writer.fd = fds[1];
+	writer.quit = false;
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, writer_thread, &writer) != 0) {
+		fprintf(stderr, "Failed to create the writer thread\n");
+		io_uring_queue_exit(&ring);
+		return EXIT_FAILURE;
+	}
+
+	nanotime_step_data stepper;
+	nanotime_step_ring step_ring;
+	nanotime_step_ring_init(&step_ring, &ring, STEP_USER_DATA, lead * UINT64_C(1000));
+	nanotime_step_init(&stepper, sleep_duration, nanotime_now_max(), nanotime_now, nanotime_sleep);
+
+	printf("%" PRIu64 " Hz, %" PRIu64 " us lead\n", rate, lead);
+	printf("%8s | %8s %6s %12s %12s | %8s %12s %12s\n", "second", "ticks", "skips", "mean dev ns", "max dev ns", "reads", "mean lat ns", "max lat ns");
+
+	const uint64_t steps = seconds * rate;
+	uint64_t second_ticks = 0, second_skips = 0, second_deviation = 0, second_deviation_max = 0;
+	uint64_t second_reads = 0, second_latency = 0, second_latency_max = 0;
+	uint64_t total_deviation = 0, total_deviation_max = 0, total_reads = 0, total_latency = 0, total_latency_max = 0;
+	bool failed = false;
+	for (uint64_t step = 0; step < steps && !failed;) {
+		struct io_uring_cqe* cqe;
+		const nanotime_step_ring_event event = nanotime_step_ring_wait(&stepper, &step_ring, &cqe);
+		if (event == NANOTIME_STEP_RING_IO) {
+			if (cqe->res == (int)sizeof(buffer)) {
+				const uint64_t latency = nanotime_interval(buffer, nanotime_now(), nanotime_now_max());
+				second_reads++;
+				second_latency += latency;
+				if (latency > second_latency_max) {
+					second_latency_max = latency;
+				}
+			}
+			io_uring_cqe_seen(&ring, cqe);
+			failed = !submit_read(&ring, fds[0], &buffer);
+			continue;
+		}
+
+		if (event == NANOTIME_STEP_RING_TICK) {
+			second_ticks++;
+			second_deviation += stepper.stats.deviation;
+			if (stepper.stats.deviation > second_deviation_max) {
+				second_deviation_max = stepper.stats.deviation;
+			}
+		}
+		else {
+			second_skips++;
+		}
+		step++;
+
+		if (step % rate == 0) {
+			printf(
+				"%8" PRIu64 " | %8" PRIu64 " %6" PRIu64 " %12" PRIu64 " %12" PRIu64 " | %8" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n",
+				step / rate,
+				second_ticks,
+				second_skips,
+				second_ticks > 0 ? second_deviation / second_ticks : UINT64_C(0),
+				second_deviation_max,
+				second_reads,
+				second_reads > 0 ? second_latency / second_reads : UINT64_C(0),
+				second_latency_max
+			);
+			total_deviation += second_deviation;
+			if (second_deviation_max > total_deviation_max) {
+				total_deviation_max = second_deviation_max;
+			}
+			total_reads += second_reads;
+			total_latency += second_latency;
+			if (second_latency_max > total_latency_max) {
+				total_latency_max = second_latency_max;
+			}
+			second_ticks = second_skips = second_deviation = second_deviation_max = 0;
+			second_reads = second_latency = second_latency_max = 0;
+		}
+	}
+
+	writer.quit = true;
+	close(fds[1]);
+	pthread_join(thread, NULL);
+	close(fds[0]);
+	io_uring_queue_exit(&ring);
+
+	if (failed) {
+		fprintf(stderr, "Failed to resubmit a read\n");
+		return EXIT_FAILURE;
+	}
+	const uint64_t ticks = stepper.stats.steps - stepper.stats.skips;
+	printf("\n");
+	printf("Ticks: %" PRIu64 ", skips: %" PRIu64 ", resets: %" PRIu64 "\n", ticks, stepper.stats.skips, stepper.stats.resets);
+	printf("Deviation: mean %" PRIu64 " ns, max %" PRIu64 " ns\n", ticks > 0 ? total_deviation / ticks : UINT64_C(0), total_deviation_max);
+	printf("Reads: %" PRIu64 ", latency mean %" PRIu64 " ns, max %" PRIu64 " ns\n", total_reads, total_reads > 0 ? total_latency / total_reads : UINT64_C(0), total_latency_max);
+	printf("Timeouts: %" PRIu64 ", other completions: %" PRIu64 "\n", step_ring.timeouts, step_ring.completions);
+	printf("Wakeups per step: %.2f, spin per step: %.0f ns\n", (double)stepper.stats.wakeups / (double)stepper.stats.steps, nanotime_step_spin_per_step(&stepper.stats));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,973 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Runs the stepper against nanotime's virtual clock, so millions of steps are
+// simulated in seconds, rather than waiting on real time. Checks the
+// accumulator, skip and reset behavior of nanotime_step against invariants that
+// should hold no matter the sleep overshoot.
+//
+// Exits with failure status if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+
+#define STEP_RATE 240
+
+#define SLEEP_DURATION (NANOTIME_NSEC_PER_SEC / STEP_RATE)
+
+#define RESET_DURATION (SLEEP_DURATION + NANOTIME_NSEC_PER_SEC / 10)
+
+static int num_failures = 0;
+
+static void check(const bool passed, const char* const description) {
+	printf("%s: %s\n", passed ? "PASS" : "FAIL", description);
+	if (!passed) {
+		num_failures++;
+	}
+}
+
+// A clock with costs and overshoots in the range seen on typical desktop
+// operating systems.
+static void init_clock(nanotime_virtual_clock* const clock, const uint64_t start, const uint64_t now_max) {
+	nanotime_virtual_clock_init(clock, start, now_max, UINT64_C(12345));
+	clock->read_cost = UINT64_C(25);
+	clock->overshoot_min = UINT64_C(5000);
+	clock->overshoot_max = UINT64_C(80000);
+	clock->zero_sleep_min = UINT64_C(500);
+	clock->zero_sleep_max = UINT64_C(3000);
+}
+
+// Every sleeping step adds the time since the previous sleep point to the
+// accumulator, and skipped steps don't move the sleep point, so when there were
+// no resets, the time from the first sleep point to the last plus what was in
+// the accumulator at first is always the sum of the step durations plus what's
+// left in the accumulator.
+static bool accumulator_consistent(const nanotime_step_data* const stepper, const uint64_t first_sleep_point, const uint64_t first_accumulator, const uint64_t num_steps) {
+	return nanotime_interval(first_sleep_point, stepper->sleep_point, stepper->now_max) + first_accumulator == num_steps * stepper->sleep_duration + stepper->accumulator;
+}
+
+static void test_steady(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t first_sleep_point = stepper.sleep_point;
+
+	uint64_t max_deviation = 0;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+		if (stepper.stats.deviation > max_deviation) {
+			max_deviation = stepper.stats.deviation;
+		}
+	}
+
+	printf("Steady: %" PRIu64 " steps, %" PRIu64 " clock reads, %" PRIu64 " sleeps, max deviation %" PRIu64 " ns, %.1f wakeups/s\n", num_steps, clock.reads, clock.sleeps, max_deviation, nanotime_step_wakeups_per_second(&stepper.stats));
+	check(stepper.stats.skips == 0 && stepper.stats.resets == 0, "steady stepping never skips or resets");
+	check(accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "steady stepping keeps the accumulator consistent with the timeline");
+
+	// No sleep can overshoot by more than the worst overshoot, plus a few
+	// clock reads.
+	check(max_deviation <= clock.overshoot_max + clock.zero_sleep_max + 16 * clock.read_cost, "steady stepping deviation is bounded by the sleep overshoot");
+}
+
+static void test_skips(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t first_sleep_point = stepper.sleep_point;
+
+	// A long frame of work every so often, that's still short enough to
+	// not trigger a reset, should only cause skips to catch up.
+	for (uint64_t i = 0; i < num_steps; i++) {
+		if (i % 100 == 99) {
+			nanotime_virtual_advance(&clock, SLEEP_DURATION * 5 / 2);
+		}
+		nanotime_step(&stepper);
+	}
+
+	printf("Skips: %" PRIu64 " steps, %" PRIu64 " skips\n", num_steps, stepper.stats.skips);
+	check(stepper.stats.skips >= num_steps / 100 - 1 && stepper.stats.resets == 0, "long frames are caught up on with skips, without resets");
+	check(accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "skipping keeps the accumulator consistent with the timeline");
+}
+
+static void test_reset() {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	for (int i = 0; i < 100; i++) {
+		nanotime_step(&stepper);
+	}
+
+	// Just short of the reset threshold, the stepper must catch up.
+	nanotime_virtual_advance(&clock, RESET_DURATION - SLEEP_DURATION - UINT64_C(1000));
+	nanotime_step(&stepper);
+	const bool caught_up = stepper.stats.resets == 0 && stepper.accumulator > SLEEP_DURATION;
+	for (int i = 0; i < 100; i++) {
+		nanotime_step(&stepper);
+	}
+
+	// At the reset threshold, the stepper must restart its timeline.
+	nanotime_virtual_advance(&clock, RESET_DURATION);
+	const uint64_t restart = clock.now;
+	nanotime_step(&stepper);
+	const bool reset = stepper.stats.resets == 1 && nanotime_interval(restart, stepper.sleep_point, clock.now_max) < RESET_DURATION;
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	const uint64_t first_accumulator = stepper.accumulator;
+	const uint64_t skips = stepper.stats.skips;
+	for (int i = 0; i < 1000; i++) {
+		nanotime_step(&stepper);
+	}
+
+	check(caught_up, "a pause just short of the reset threshold is caught up on");
+	check(reset && stepper.stats.dropped_ticks >= RESET_DURATION / SLEEP_DURATION, "a pause of sleep_duration + NANOTIME_NSEC_PER_SEC / 10 resets the stepper, dropping the backlog");
+	check(stepper.stats.skips == skips && accumulator_consistent(&stepper, first_sleep_point, first_accumulator, 1000), "stepping after a reset is steady");
+}
+
+// Steps the stepper steadily, then pauses for 20.5 steps' worth of time, so
+// that 19 steps are owed after the next step, then steps until caught up.
+static nanotime_step_stats run_catch_up(const nanotime_step_catch_up catch_up, const uint64_t limit, uint64_t* const steps_to_catch_up) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_set_catch_up(&stepper, catch_up, limit);
+	for (int i = 0; i < 100; i++) {
+		nanotime_step(&stepper);
+	}
+
+	nanotime_virtual_advance(&clock, SLEEP_DURATION * 41 / 2);
+	const uint64_t skips = stepper.stats.skips;
+	*steps_to_catch_up = 0;
+	do {
+		nanotime_step(&stepper);
+		(*steps_to_catch_up)++;
+	} while (stepper.stats.owed_ticks > 0 && *steps_to_catch_up < 100);
+
+	nanotime_step_stats stats = stepper.stats;
+	stats.skips -= skips;
+	return stats;
+}
+
+static void test_catch_up() {
+	uint64_t steps;
+	nanotime_step_stats stats;
+
+	stats = run_catch_up(NANOTIME_STEP_CATCH_UP_RESET, 0, &steps);
+	printf("Catch-up reset: %" PRIu64 " skips, %" PRIu64 " dropped, caught up in %" PRIu64 " steps\n", stats.skips, stats.dropped_ticks, steps);
+	check(stats.skips == 19 && stats.dropped_ticks == 0, "the reset policy catches up on a short pause by skipping");
+
+	stats = run_catch_up(NANOTIME_STEP_CATCH_UP_BURST, 5, &steps);
+	printf("Catch-up burst 5: %" PRIu64 " skips, %" PRIu64 " dropped, caught up in %" PRIu64 " steps\n", stats.skips, stats.dropped_ticks, steps);
+	check(stats.skips == 5 && stats.dropped_ticks == 14, "the burst policy skips at most its limit, dropping the rest");
+
+	stats = run_catch_up(NANOTIME_STEP_CATCH_UP_SPREAD, 10, &steps);
+	printf("Catch-up spread 10: %" PRIu64 " skips, %" PRIu64 " dropped, caught up in %" PRIu64 " steps\n", stats.skips, stats.dropped_ticks, steps);
+	check(stats.skips == 0 && stats.dropped_ticks == 9 && stats.owed_ticks == 0 && steps <= 20, "the spread policy catches up without skipping, dropping beyond its limit");
+
+	stats = run_catch_up(NANOTIME_STEP_CATCH_UP_DROP, 0, &steps);
+	printf("Catch-up drop: %" PRIu64 " skips, %" PRIu64 " dropped, caught up in %" PRIu64 " steps\n", stats.skips, stats.dropped_ticks, steps);
+	check(stats.skips == 0 && stats.dropped_ticks == 19 && steps == 1, "the drop policy never catches up, dropping everything owed");
+}
+
+static void test_overload(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	// Every frame's work runs past the deadline, with nothing owed ever
+	// caught up on, so every step should finish with only the one clock
+	// read made at its start.
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_set_catch_up(&stepper, NANOTIME_STEP_CATCH_UP_DROP, 0);
+	uint64_t max_step_clock_reads = 0;
+	const uint64_t sleeps = clock.sleeps;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_virtual_advance(&clock, SLEEP_DURATION * 3 / 2);
+		nanotime_step(&stepper);
+		if (stepper.stats.step_clock_reads > max_step_clock_reads) {
+			max_step_clock_reads = stepper.stats.step_clock_reads;
+		}
+	}
+
+	printf("Overload: at most %" PRIu64 " clock reads per step, %" PRIu64 " sleeps\n", max_step_clock_reads, clock.sleeps - sleeps);
+	check(max_step_clock_reads == 1 && clock.sleeps == sleeps, "overloaded steps read the clock once and never sleep");
+}
+
+static void test_yield(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+	clock.yield_cost = UINT64_C(2000);
+
+	// Without zero-duration sleeps, the final busyloop has much more time
+	// to cover, so yielding in it matters.
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_set_yield_user(&stepper, nanotime_virtual_yield);
+	stepper.zero_sleeps = false;
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	uint64_t max_deviation = 0;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+		if (stepper.stats.deviation > max_deviation) {
+			max_deviation = stepper.stats.deviation;
+		}
+	}
+
+	printf("Yield: %.1f yields per step, %.1f ns spinning per step, max deviation %" PRIu64 " ns\n", (double)stepper.stats.yields / num_steps, nanotime_step_spin_per_step(&stepper.stats), max_deviation);
+	check(stepper.stats.yields > 0 && stepper.stats.resets == 0 && accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "yielding in the busyloop keeps the accumulator consistent");
+
+	// A yield is never started with less time remaining than the longest
+	// yield seen, so yielding adds no more deviation than a clock read.
+	check(max_deviation <= clock.overshoot_max + clock.zero_sleep_max + 16 * clock.read_cost, "yielding in the busyloop doesn't overshoot deadlines");
+}
+
+static void test_wrap() {
+	// A 32-bit clock, that wraps around about every 4.3 seconds, started
+	// shortly before it wraps around. The run has to be shorter than the
+	// wrap period, for the interval checked to be unambiguous.
+	const uint64_t now_max = UINT64_C(0xFFFFFFFF);
+	nanotime_virtual_clock clock;
+	init_clock(&clock, now_max - NANOTIME_NSEC_PER_SEC, now_max);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	const uint64_t num_steps = STEP_RATE * 3;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+	}
+
+	check(stepper.stats.skips == 0 && stepper.stats.resets == 0, "stepping across clock wraparounds never skips or resets");
+	check(accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "stepping across clock wraparounds keeps the accumulator consistent");
+}
+
+static void test_recorded(const uint64_t num_steps) {
+	// Overshoots as recorded from a host with a coarse timer, where most
+	// sleeps run to the next timer tick.
+	static const uint64_t overshoots[] = {
+		UINT64_C(50000), UINT64_C(52000), UINT64_C(61000), UINT64_C(55000),
+		UINT64_C(490000), UINT64_C(53000), UINT64_C(58000), UINT64_C(950000)
+	};
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+	clock.overshoots = overshoots;
+	clock.overshoots_count = sizeof(overshoots) / sizeof(overshoots[0]);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	uint64_t max_deviation = 0;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+		if (stepper.stats.deviation > max_deviation) {
+			max_deviation = stepper.stats.deviation;
+		}
+	}
+
+	printf("Recorded: max deviation %" PRIu64 " ns, %.1f wakeups/s, %.1f ns spinning per step\n", max_deviation, nanotime_step_wakeups_per_second(&stepper.stats), nanotime_step_spin_per_step(&stepper.stats));
+	check(stepper.stats.resets == 0 && accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "stepping with recorded overshoots keeps the accumulator consistent");
+}
+
+static void test_adaptive(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_set_adaptive(&stepper, UINT64_C(200000));
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	uint64_t max_deviation = 0;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+		if (stepper.stats.deviation > max_deviation) {
+			max_deviation = stepper.stats.deviation;
+		}
+	}
+
+	printf("Adaptive: max deviation %" PRIu64 " ns, %.1f wakeups/s, coarse duration %" PRIu64 " ns, shift %" PRIu64 "\n", max_deviation, nanotime_step_wakeups_per_second(&stepper.stats), stepper.coarse_duration, stepper.shift);
+	check(stepper.stats.resets == 0 && accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "adaptive stepping keeps the accumulator consistent");
+}
+
+static void test_migration(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	nanotime_step_data source;
+	nanotime_step_init_user(&source, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_set_catch_up(&source, NANOTIME_STEP_CATCH_UP_SPREAD, UINT64_C(4));
+	for (uint64_t i = 0; i < num_steps / 2; i++) {
+		nanotime_step(&source);
+	}
+
+	// The stepper is moved partway through a step, to a stepper calibrated
+	// differently.
+	nanotime_virtual_advance(&clock, SLEEP_DURATION / 3);
+	nanotime_step_state state;
+	nanotime_step_export(&source, &state);
+	nanotime_step_data destination;
+	nanotime_step_init_user(&destination, SLEEP_DURATION * 2, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	destination.zero_sleep_duration = UINT64_C(1234);
+	const bool imported = nanotime_step_import(&destination, &state);
+	nanotime_step_state exported;
+	nanotime_step_export(&destination, &exported);
+	check(imported && memcmp(&state, &exported, sizeof(state)) == 0 && destination.zero_sleep_duration == UINT64_C(1234) && destination.stats.steps == 0, "importing a stepper state moves the timeline, keeping the calibration");
+
+	for (uint64_t i = 0; i < num_steps / 2; i++) {
+		nanotime_step(&destination);
+	}
+	check(destination.stats.skips == 0 && destination.stats.resets == 0 && accumulator_consistent(&destination, state.sleep_point, state.accumulator, num_steps / 2), "a moved stepper resumes its phase without losing a tick");
+
+	nanotime_step_state invalid = state;
+	invalid.version++;
+	bool rejected = !nanotime_step_import(&destination, &invalid);
+	invalid = state;
+	invalid.now_max = UINT64_C(0xFFFFFFFF);
+	rejected = rejected && !nanotime_step_import(&destination, &invalid);
+	invalid = state;
+	invalid.catch_up = UINT64_C(100);
+	rejected = rejected && !nanotime_step_import(&destination, &invalid);
+	invalid = state;
+	invalid.sleep_duration = UINT64_MAX - NANOTIME_NSEC_PER_SEC / 20;
+	rejected = rejected && !nanotime_step_import(&destination, &invalid);
+	check(rejected && destination.catch_up == NANOTIME_STEP_CATCH_UP_SPREAD, "states of other versions or clocks, or invalid states, aren't imported");
+}
+
+static void test_shared_clock(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+
+	// The publisher gets behind for a while, so the published ticks aren't
+	// all at its sleep points.
+	nanotime_step_data publisher;
+	nanotime_step_init_user(&publisher, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	nanotime_step_clock shared;
+	nanotime_step_clock_init(&shared, &publisher);
+	const uint64_t first_tick_point = shared.tick_point;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		if (i == num_steps / 2) {
+			nanotime_virtual_advance(&clock, SLEEP_DURATION * 5 / 2);
+		}
+		nanotime_step(&publisher);
+		nanotime_step_clock_publish(&shared, &publisher);
+	}
+	nanotime_step_clock_time time;
+	const bool read = nanotime_step_clock_read(&shared, &time);
+	check(read && time.tick == num_steps && time.tick_point == first_tick_point + num_steps * SLEEP_DURATION, "the shared clock publishes every tick at its deadline");
+
+	// Consumers at the same and at twice the rate, starting out of phase,
+	// then aligned to the published clock mid-step.
+	static const uint64_t divisors[] = { 1, 2 };
+	for (size_t i = 0; i < sizeof(divisors) / sizeof(divisors[0]); i++) {
+		nanotime_virtual_advance(&clock, SLEEP_DURATION / 3);
+		nanotime_step_data consumer;
+		nanotime_step_init_user(&consumer, SLEEP_DURATION / divisors[i], clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+		const uint64_t now = nanotime_virtual_now(&clock);
+		const uint64_t tick = nanotime_step_align(&consumer, &time, now);
+		bool aligned = tick == time.tick + (now - time.tick_point) / SLEEP_DURATION;
+		for (int j = 0; j < STEP_RATE; j++) {
+			nanotime_step(&consumer);
+			const uint64_t phase = (consumer.sleep_point - consumer.accumulator - time.tick_point) % consumer.sleep_duration;
+			aligned = aligned && phase == 0;
+		}
+		check(aligned && consumer.stats.resets == 0, divisors[i] == 1 ? "a consumer aligns its ticks to the shared clock" : "a consumer at twice the rate aligns its ticks to the shared clock");
+	}
+
+	// A time read before the tick was published counts back from the tick.
+	nanotime_step_data consumer;
+	nanotime_step_init_user(&consumer, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t tick = nanotime_step_align(&consumer, &time, time.tick_point - SLEEP_DURATION / 4);
+	check(tick == time.tick - 1 && consumer.accumulator == SLEEP_DURATION - SLEEP_DURATION / 4, "aligning to a clock published after now counts back from its tick");
+
+	nanotime_step_clock uninitialized = { 0 };
+	check(!nanotime_step_clock_read(&uninitialized, &time), "an uninitialized shared clock can't be read");
+
+	#if defined(__linux__) || defined(__APPLE__)
+	// Mapped twice, as a publishing and a consuming process would.
+	const char* const name = "/nanotime_test_shared_clock";
+	nanotime_step_clock* const created = nanotime_step_clock_map(name, true);
+	nanotime_step_clock* const opened = nanotime_step_clock_map(name, false);
+	bool shared_read = false;
+	if (created != NULL && opened != NULL) {
+		shared_read = !nanotime_step_clock_read(opened, &time);
+		nanotime_step_clock_init(created, &publisher);
+		nanotime_step(&publisher);
+		nanotime_step_clock_publish(created, &publisher);
+		shared_read = shared_read && nanotime_step_clock_read(opened, &time) && time.tick == 1 && time.tick_point == created->tick_point;
+	}
+	if (created != NULL) {
+		nanotime_step_clock_unmap(created);
+	}
+	if (opened != NULL) {
+		nanotime_step_clock_unmap(opened);
+	}
+	check(shared_read, "a clock published in shared memory is read through another mapping");
+
+	// Created again while it exists, as a restarted publisher would.
+	nanotime_step_clock* const recreated = nanotime_step_clock_map(name, true);
+	check(recreated != NULL, "a clock left in shared memory can be created again");
+	if (recreated != NULL) {
+		nanotime_step_clock_unmap(recreated);
+	}
+	nanotime_step_clock_unlink(name);
+	#endif
+}
+
+static void test_wait_until(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	const uint64_t sleep_point = stepper.sleep_point;
+	const uint64_t accumulator = stepper.accumulator;
+
+	// Irregular deadlines, from 10 us to 20 ms apart.
+	uint64_t max_deviation = 0;
+	uint64_t spin_duration = 0;
+	bool waited = true;
+	bool accounted = true;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		const uint64_t deadline = nanotime_virtual_now(&clock) + 10000 + nanotime_virtual_now(&clock) * 7919 % 20000000;
+		nanotime_wait_result result;
+		waited = nanotime_wait_until(&stepper, deadline, &result) && waited;
+		const uint64_t end = nanotime_virtual_now(&clock);
+		accounted = accounted && end >= deadline && end - deadline <= result.deviation + 2 * clock.read_cost;
+		if (result.deviation > max_deviation) {
+			max_deviation = result.deviation;
+		}
+		spin_duration += result.spin_duration;
+	}
+	printf("Wait until: max deviation %" PRIu64 " ns, %.1f ns spinning per wait\n", max_deviation, (double)spin_duration / num_steps);
+	check(waited && accounted, "waiting until deadlines never finishes early, and reports its deviation");
+	check(max_deviation <= clock.overshoot_max + clock.zero_sleep_max + 16 * clock.read_cost, "waiting until deadlines doesn't overshoot them");
+	check(stepper.sleep_point == sleep_point && stepper.accumulator == accumulator && stepper.stats.steps == 0 && stepper.stats.spin_duration == spin_duration, "waiting until deadlines leaves the stepper's timeline alone");
+
+	nanotime_wait_result result;
+	const uint64_t now = nanotime_virtual_now(&clock);
+	check(!nanotime_wait_until(&stepper, now - 5000, &result) && result.deviation >= 5000 && result.deviation <= 5000 + 2 * clock.read_cost, "waiting until a passed deadline returns at once");
+}
+
+static int compare_uint64(const void* a, const void* b) {
+	const uint64_t value_a = *(const uint64_t*)a;
+	const uint64_t value_b = *(const uint64_t*)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+// Finds the report of the named stepper, or NULL.
+static const nanotime_step_report* find_report(const nanotime_step_report* const reports, const size_t count, const char* const name) {
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(reports[i].name, name) == 0) {
+			return &reports[i];
+		}
+	}
+	return NULL;
+}
+
+static void test_registry(const uint64_t num_steps) {
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	check(nanotime_step_register(&stepper, "a stepper with a name longer than fits"), "a stepper can be registered");
+
+	// The same long frames as the skips test, with each sleeping step's
+	// deviation put into the same buckets as the registry's.
+	uint64_t buckets[NANOTIME_STEP_DEVIATION_BUCKETS] = { 0 };
+	uint64_t deviation_sum = 0;
+	uint64_t* const deviations = (uint64_t*)malloc(num_steps * sizeof(uint64_t));
+	uint64_t num_deviations = 0;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		if (i % 100 == 99) {
+			nanotime_virtual_advance(&clock, SLEEP_DURATION * 5 / 2);
+		}
+		if (nanotime_step(&stepper)) {
+			size_t bucket = 0;
+			while (stepper.stats.deviation > nanotime_step_deviation_bound(bucket)) {
+				bucket++;
+			}
+			buckets[bucket]++;
+			deviation_sum += stepper.stats.deviation;
+			if (deviations) {
+				deviations[num_deviations++] = stepper.stats.deviation;
+			}
+		}
+	}
+
+	nanotime_step_report reports[NANOTIME_STEP_REGISTRY_SIZE];
+	size_t count = nanotime_step_registry_query(reports, NANOTIME_STEP_REGISTRY_SIZE);
+	const nanotime_step_report* const report = find_report(reports, count, "a stepper with a name longer th");
+	check(count == 1 && report != NULL, "a registered stepper is reported, under its truncated name");
+	if (report != NULL) {
+		bool same_buckets = true;
+		for (size_t i = 0; i < NANOTIME_STEP_DEVIATION_BUCKETS; i++) {
+			same_buckets = same_buckets && report->deviations[i] == buckets[i];
+		}
+		check(
+			report->steps == stepper.stats.steps && report->skips == stepper.stats.skips && report->skips > 0 && report->resets == stepper.stats.resets &&
+			report->spin_duration == stepper.stats.spin_duration && report->deviation == stepper.stats.deviation && report->sleep_duration == SLEEP_DURATION &&
+			report->wakeups == stepper.stats.wakeups && report->accumulator == stepper.accumulator &&
+			report->rate == (double)NANOTIME_NSEC_PER_SEC / SLEEP_DURATION,
+			"a stepper's report matches its statistics"
+		);
+		check(same_buckets && report->deviation_count == stepper.stats.steps - stepper.stats.skips && report->deviation_sum == deviation_sum, "a stepper's report has a histogram of its sleeping steps' deviations");
+
+		// The estimated 99th percentile is in the same bucket as the
+		// exact one.
+		if (deviations && num_deviations > 0) {
+			qsort(deviations, num_deviations, sizeof(uint64_t), compare_uint64);
+			const uint64_t p99 = deviations[(num_deviations * 99 + 99) / 100 - 1];
+			size_t bucket = 0;
+			while (p99 > nanotime_step_deviation_bound(bucket)) {
+				bucket++;
+			}
+			const uint64_t lower = bucket > 0 ? nanotime_step_deviation_bound(bucket - 1) : 0;
+			printf("Registry: p99 deviation %" PRIu64 " ns, estimated %" PRIu64 " ns; max %" PRIu64 " ns\n", p99, report->p99_deviation, report->max_deviation);
+			check(report->p99_deviation >= lower && report->p99_deviation <= nanotime_step_deviation_bound(bucket) && report->max_deviation == deviations[num_deviations - 1], "the estimated 99th percentile deviation is within the exact one's bucket");
+		}
+	}
+	free(deviations);
+
+	// Filling the registry.
+	static nanotime_step_data others[NANOTIME_STEP_REGISTRY_SIZE];
+	int registered = 0;
+	for (int i = 0; i < NANOTIME_STEP_REGISTRY_SIZE; i++) {
+		nanotime_step_init_user(&others[i], SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+		char name[NANOTIME_STEP_NAME_SIZE];
+		snprintf(name, sizeof(name), "other %d", i);
+		registered += nanotime_step_register(&others[i], name);
+	}
+	check(registered == NANOTIME_STEP_REGISTRY_SIZE - 1 && nanotime_step_registry_query(reports, NANOTIME_STEP_REGISTRY_SIZE) == NANOTIME_STEP_REGISTRY_SIZE, "registering fails once the registry is full");
+	check(nanotime_step_registry_query(reports, 3) == 3, "queries copy at most as many reports as asked for");
+
+	nanotime_step_unregister(&stepper);
+	nanotime_step_unregister(&stepper);
+	count = nanotime_step_registry_query(reports, NANOTIME_STEP_REGISTRY_SIZE);
+	check(count == NANOTIME_STEP_REGISTRY_SIZE - 1 && find_report(reports, count, "a stepper with a name longer th") == NULL, "an unregistered stepper isn't reported");
+	check(nanotime_step_register(&others[NANOTIME_STEP_REGISTRY_SIZE - 1], "last"), "an unregistered stepper's entry can be reused");
+	for (int i = 0; i < NANOTIME_STEP_REGISTRY_SIZE; i++) {
+		nanotime_step_unregister(&others[i]);
+	}
+	check(nanotime_step_registry_query(reports, NANOTIME_STEP_REGISTRY_SIZE) == 0, "the registry is empty once all steppers are unregistered");
+}
+
+// Scrapes the rendered OpenMetrics text as a scraper would, checking each line
+// is metadata or a sample of the family of the latest metadata, that each
+// stepper's histogram buckets are cumulative and end with its count, and that
+// the text ends with "# EOF"; returns false on the first bad line.
+static bool scrape_openmetrics(const char* const text) {
+	char family[64] = "";
+	char stepper[NANOTIME_STEP_NAME_SIZE * 2] = "";
+	uint64_t bucket_count = 0;
+	bool eof = false;
+	for (const char* line = text; *line != '\0'; ) {
+		const char* const end = strchr(line, '\n');
+		if (end == NULL || eof) {
+			return false;
+		}
+		const size_t length = (size_t)(end - line);
+		if (length == 5 && strncmp(line, "# EOF", 5) == 0) {
+			eof = true;
+		}
+		else if (strncmp(line, "# TYPE ", 7) == 0) {
+			if (sscanf(line + 7, "%63s", family) != 1) {
+				return false;
+			}
+		}
+		else if (strncmp(line, "# UNIT ", 7) == 0 || strncmp(line, "# HELP ", 7) == 0) {
+			if (strncmp(line + 7, family, strlen(family)) != 0) {
+				return false;
+			}
+		}
+		else {
+			// A sample of the family, with a stepper label and an
+			// unsigned value.
+			const size_t family_length = strlen(family);
+			const char* const labels = strchr(line, '{');
+			const char* const value = strstr(line, "} ");
+			if (family_length == 0 || strncmp(line, family, family_length) != 0 || labels == NULL || value == NULL || value > end || strncmp(labels, "{stepper=\"", 10) != 0) {
+				return false;
+			}
+			char* value_end;
+			const double number = strtod(value + 2, &value_end);
+			if (value_end != end || number < 0.0) {
+				return false;
+			}
+			const char* const suffix = line + family_length;
+			if (strncmp(suffix, "_bucket{", 8) == 0) {
+				// A new stepper's buckets start over from zero.
+				const char* const le = strstr(labels, "\",le=");
+				if (le == NULL || le > end || (size_t)(le - labels) >= sizeof(stepper)) {
+					return false;
+				}
+				const size_t stepper_length = (size_t)(le - labels);
+				if (strlen(stepper) != stepper_length || strncmp(labels, stepper, stepper_length) != 0) {
+					memcpy(stepper, labels, stepper_length);
+					stepper[stepper_length] = '\0';
+					bucket_count = 0;
+				}
+				if ((uint64_t)number < bucket_count) {
+					return false;
+				}
+				bucket_count = (uint64_t)number;
+			}
+			else if (strncmp(suffix, "_count{", 7) == 0 && (uint64_t)number != bucket_count) {
+				return false;
+			}
+		}
+		line = end + 1;
+	}
+	return eof;
+}
+
+static void test_openmetrics() {
+	nanotime_step_report reports[2];
+	memset(reports, 0, sizeof(reports));
+	snprintf(reports[0].name, sizeof(reports[0].name), "physics");
+	reports[0].sleep_duration = NANOTIME_NSEC_PER_SEC / 120;
+	reports[0].steps = 1000;
+	reports[0].skips = 7;
+	reports[0].resets = 1;
+	reports[0].wakeups = 5000;
+	reports[0].spin_duration = 1500000000;
+	reports[0].accumulator = 250;
+	reports[0].deviations[0] = 900;
+	reports[0].deviations[3] = 90;
+	reports[0].deviations[NANOTIME_STEP_DEVIATION_BUCKETS - 1] = 3;
+	reports[0].deviation_count = 993;
+	reports[0].deviation_sum = 4000123456;
+	snprintf(reports[1].name, sizeof(reports[1].name), "say \"hi\"\\\n");
+	reports[1].sleep_duration = NANOTIME_NSEC_PER_SEC;
+
+	static char text[16384];
+	const size_t length = nanotime_step_openmetrics(reports, 2, text, sizeof(text));
+	check(length == strlen(text) && scrape_openmetrics(text), "rendered OpenMetrics text scrapes as well-formed");
+	check(
+		strstr(text, "nanotime_step_deviation_seconds_bucket{stepper=\"physics\",le=\"0.000001\"} 900\n") != NULL &&
+		strstr(text, "nanotime_step_deviation_seconds_bucket{stepper=\"physics\",le=\"0.00001\"} 990\n") != NULL &&
+		strstr(text, "nanotime_step_deviation_seconds_bucket{stepper=\"physics\",le=\"+Inf\"} 993\n") != NULL &&
+		strstr(text, "nanotime_step_deviation_seconds_sum{stepper=\"physics\"} 4.000123456\n") != NULL &&
+		strstr(text, "nanotime_step_skips_total{stepper=\"physics\"} 7\n") != NULL &&
+		strstr(text, "nanotime_step_resets_total{stepper=\"physics\"} 1\n") != NULL &&
+		strstr(text, "nanotime_step_wakeups_total{stepper=\"physics\"} 5000\n") != NULL &&
+		strstr(text, "nanotime_step_spin_seconds_total{stepper=\"physics\"} 1.5\n") != NULL &&
+		strstr(text, "nanotime_step_accumulator_seconds{stepper=\"physics\"} 0.00000025\n") != NULL &&
+		strstr(text, "nanotime_step_duration_seconds{stepper=\"physics\"} 0.008333333\n") != NULL,
+		"rendered OpenMetrics text has the reports' values, in seconds"
+	);
+	check(strstr(text, "{stepper=\"say \\\"hi\\\"\\\\\\n\"} 1\n") != NULL, "stepper names are escaped in OpenMetrics labels");
+
+	char small[64];
+	check(nanotime_step_openmetrics(reports, 2, small, sizeof(small)) == length && strlen(small) == sizeof(small) - 1 && strncmp(small, text, sizeof(small) - 1) == 0, "OpenMetrics text is truncated to the buffer");
+	check(nanotime_step_openmetrics(reports, 2, NULL, 0) == length, "OpenMetrics text can be measured without a buffer");
+	check(nanotime_step_openmetrics(NULL, 0, text, sizeof(text)) > 0 && scrape_openmetrics(text), "OpenMetrics text without reports is well-formed");
+}
+
+// Fake timers for the timer cache, sleeping on a virtual clock, that can be made
+// to fail creation or waits.
+typedef struct fake_timers {
+	nanotime_virtual_clock clock;
+	int timer;
+	uint64_t opened;
+	uint64_t waits;
+	bool fail_create;
+	uint64_t fail_waits;
+} fake_timers;
+
+static void* fake_timer_create(void* user) {
+	fake_timers* const timers = (fake_timers*)user;
+	if (timers->fail_create) {
+		return NULL;
+	}
+	timers->opened++;
+	return &timers->timer;
+}
+
+static bool fake_timer_wait(void* user, void* timer, uint64_t nsec_count) {
+	fake_timers* const timers = (fake_timers*)user;
+	if (timer != &timers->timer || timers->opened == 0) {
+		return false;
+	}
+	if (timers->fail_waits > 0) {
+		timers->fail_waits--;
+		return false;
+	}
+	timers->waits++;
+	nanotime_virtual_sleep(&timers->clock, nsec_count);
+	return true;
+}
+
+static void fake_timer_close(void* user, void* timer) {
+	fake_timers* const timers = (fake_timers*)user;
+	if (timer == &timers->timer) {
+		timers->opened--;
+	}
+}
+
+static void test_timer_cache(const uint64_t num_steps) {
+	fake_timers timers;
+	init_clock(&timers.clock, UINT64_C(0), UINT64_MAX);
+	timers.opened = 0;
+	timers.waits = 0;
+	timers.fail_create = false;
+	timers.fail_waits = 0;
+	nanotime_timer_cache cache;
+	nanotime_timer_cache_init(&cache, &timers, fake_timer_create, fake_timer_wait, fake_timer_close);
+
+	bool slept = true;
+	bool long_enough = true;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		const uint64_t start = nanotime_virtual_now(&timers.clock);
+		slept = nanotime_timer_cache_sleep(&cache, 1000000) && slept;
+		long_enough = long_enough && nanotime_virtual_now(&timers.clock) - start >= 1000000;
+	}
+	check(slept && long_enough && timers.waits == num_steps, "sleeping on a cached timer sleeps for the duration");
+	check(cache.creates == 1 && timers.opened == 1, "one cached timer serves every sleep");
+
+	timers.fail_waits = 1;
+	check(nanotime_timer_cache_sleep(&cache, 1000000) && cache.creates == 2 && timers.opened == 1, "a cached timer that fails to wait is replaced");
+
+	timers.fail_waits = 2;
+	const uint64_t waits = timers.waits;
+	check(!nanotime_timer_cache_sleep(&cache, 1000000) && timers.waits == waits && timers.opened == 0 && cache.timer == NULL, "a replaced timer that fails to wait isn't retried");
+
+	timers.fail_create = true;
+	check(!nanotime_timer_cache_sleep(&cache, 1000000) && timers.opened == 0, "failing to create a timer fails the sleep");
+
+	timers.fail_create = false;
+	check(nanotime_timer_cache_sleep(&cache, 1000000) && timers.opened == 1, "a timer is created again after creation failed");
+	nanotime_timer_cache_close(&cache);
+	nanotime_timer_cache_close(&cache);
+	check(timers.opened == 0 && cache.timer == NULL, "closing the cache closes its timer once");
+	check(nanotime_timer_cache_sleep(&cache, 1000000) && timers.opened == 1, "sleeping after closing the cache creates a new timer");
+	nanotime_timer_cache_close(&cache);
+
+	// nanotime_sleep's own caches, where there are any, are released and
+	// recreated as needed.
+	nanotime_sleep(1000);
+	nanotime_sleep_cleanup();
+	nanotime_sleep_cleanup();
+	nanotime_sleep(1000);
+	nanotime_sleep_cleanup();
+
+	// After shutting down, sleeps still work, with a timer each.
+	nanotime_sleep_shutdown();
+	nanotime_sleep(1000);
+}
+
+static void test_rate_limiter(const uint64_t num_steps) {
+	// A 32-bit clock, so the pacing crosses a few wraparounds.
+	const uint64_t now_max = UINT64_C(0xFFFFFFFF);
+	const uint64_t interval = UINT64_C(10000);
+	const uint64_t burst = UINT64_C(8);
+	nanotime_virtual_clock clock;
+	init_clock(&clock, now_max - NANOTIME_NSEC_PER_SEC / 10, now_max);
+
+	nanotime_rate_limiter limiter;
+	uint64_t now = nanotime_virtual_now(&clock);
+	nanotime_rate_limiter_init(&limiter, interval, burst, now, now_max);
+	bool bursts = true;
+	for (uint64_t i = 0; i < burst; i++) {
+		bursts = bursts && nanotime_rate_try_acquire(&limiter, 1, now, NULL);
+	}
+	uint64_t wait = 0;
+	bursts = bursts && !nanotime_rate_try_acquire(&limiter, 1, now, &wait) && wait == interval;
+	bursts = bursts && !nanotime_rate_try_acquire(&limiter, 1, now + interval - 1, NULL) && nanotime_rate_try_acquire(&limiter, 1, now + interval, NULL);
+	check(bursts, "a full rate limiter allows a burst, then one token per interval");
+
+	// After idling, only a burst's worth of tokens has accumulated.
+	now += 100 * interval;
+	uint64_t acquired = 0;
+	while (nanotime_rate_try_acquire(&limiter, 1, now, NULL)) {
+		acquired++;
+	}
+	check(acquired == burst, "an idle rate limiter refills to a burst of tokens");
+
+	// Paced waits over several wraparounds of the clock, starting empty.
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	clock.now = now;
+	const uint64_t start = nanotime_virtual_now(&clock);
+	nanotime_timeline timeline;
+	nanotime_timeline_init(&timeline, start, now_max);
+	const uint64_t num_events = num_steps * 10;
+	uint64_t max_lateness = 0;
+	for (uint64_t i = 0; i < num_events; i++) {
+		const uint64_t lateness = nanotime_rate_acquire_or_wait(&limiter, 1, &stepper);
+		if (lateness > max_lateness) {
+			max_lateness = lateness;
+		}
+		nanotime_timeline_extend(&timeline, nanotime_virtual_now(&clock));
+	}
+	const uint64_t elapsed = nanotime_timeline_extend(&timeline, nanotime_virtual_now(&clock));
+	printf("Rate limiter: %" PRIu64 " events in %" PRIu64 " ns, max lateness %" PRIu64 " ns, %" PRIu64 " wraparounds\n", num_events, elapsed, max_lateness, timeline.wraps);
+	check(timeline.wraps > 0 && elapsed >= num_events * interval && elapsed <= num_events * interval + max_lateness + interval, "waiting on a rate limiter paces events at its rate, across clock wraparounds");
+}
+
+#ifdef __linux__
+static bool write_file(const char* const directory, const char* const name, const char* const contents) {
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	FILE* const file = fopen(path, "w");
+	if (file == NULL) {
+		return false;
+	}
+	const bool written = fputs(contents, file) >= 0;
+	return fclose(file) == 0 && written;
+}
+
+static void test_cpu_quota(const uint64_t num_steps) {
+	// A simulated cgroup with half a CPU of quota, rather than a real one,
+	// as creating cgroups requires privileges.
+	char directory[] = "/tmp/nanotime_cpu_quota_XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		check(false, "a directory for the simulated cgroup files could be created");
+		return;
+	}
+	const char* const stat_format = "usage_usec 1000\nuser_usec 600\nsystem_usec 400\nnr_periods 10\nnr_throttled %d\nthrottled_usec %d\n";
+	char stat[256];
+	snprintf(stat, sizeof(stat), stat_format, 0, 0);
+	if (!write_file(directory, "cpu.max", "50000 100000\n") || !write_file(directory, "cpu.stat", stat)) {
+		check(false, "the simulated cgroup files could be written");
+		return;
+	}
+
+	// Without zero-duration sleeps, the final busyloop has much more time
+	// to cover, so limiting it matters.
+	nanotime_virtual_clock clock;
+	init_clock(&clock, UINT64_C(0), UINT64_MAX);
+	nanotime_step_data stepper;
+	nanotime_step_init_user(&stepper, SLEEP_DURATION, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+	stepper.zero_sleeps = false;
+	nanotime_cpu_quota quota;
+	const bool set = nanotime_step_set_cpu_quota(&stepper, &quota, directory, NANOTIME_NSEC_PER_SEC / 10);
+	check(set && quota.quota == UINT64_C(50000) && quota.period == UINT64_C(100000) && quota.periods == UINT64_C(10), "the simulated CPU quota is read");
+	const uint64_t budget = stepper.spin_budget;
+	const uint64_t first_sleep_point = stepper.sleep_point;
+	for (uint64_t i = 0; i < num_steps; i++) {
+		nanotime_step(&stepper);
+	}
+	printf("CPU quota: spin budget %" PRIu64 " ns, %.1f ns spinning per step\n", budget, nanotime_step_spin_per_step(&stepper.stats));
+	check(budget == SLEEP_DURATION / 16 && nanotime_step_spin_per_step(&stepper.stats) <= (double)(budget + clock.overshoot_max), "spinning is limited to the spin budget");
+	check(stepper.stats.resets == 0 && accumulator_consistent(&stepper, first_sleep_point, 0, num_steps), "stepping with a spin budget keeps the accumulator consistent");
+
+	// Throttling halves the budget, and it recovers once throttling stops.
+	snprintf(stat, sizeof(stat), stat_format, 3, 20000);
+	write_file(directory, "cpu.stat", stat);
+	for (uint64_t i = 0; i < STEP_RATE && stepper.stats.throttle_events == 0; i++) {
+		nanotime_step(&stepper);
+	}
+	check(stepper.stats.throttle_events == UINT64_C(3) && stepper.spin_budget == budget / 2, "throttling is counted and shrinks the spin budget");
+	for (uint64_t i = 0; i < STEP_RATE; i++) {
+		nanotime_step(&stepper);
+	}
+	check(stepper.stats.throttle_events == UINT64_C(3) && stepper.spin_budget == budget, "the spin budget recovers once throttling stops");
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/cpu.max", directory);
+	remove(path);
+	snprintf(path, sizeof(path), "%s/cpu.stat", directory);
+	remove(path);
+	remove(directory);
+}
+#endif
+
+int main(int argc, char** argv) {
+	uint64_t num_steps = UINT64_C(1000000);
+	if (argc > 2 || (argc == 2 && (sscanf(argv[1], "%" SCNu64, &num_steps) != 1 || num_steps == 0))) {
+		fprintf(stderr, "Usage: test_nanotime_step_virtual [steps]\n");
+		fprintf(stderr, "[steps] is the number of steps to simulate per test, and must be greater than 0; the default is 1000000.\n");
+		return EXIT_FAILURE;
+	}
+
+	const uint64_t start = nanotime_now();
+	test_steady(num_steps);
+	test_skips(num_steps);
+	test_reset();
+	test_catch_up();
+	test_overload(num_steps);
+	test_yield(num_steps);
+	test_wrap();
+	test_recorded(num_steps);
+	test_adaptive(num_steps);
+	#ifdef __linux__
+	test_cpu_quota(num_steps);
+	#endif
+	test_migration(num_steps);
+	test_shared_clock(num_steps);
+	test_rate_limiter(num_steps);
+	test_wait_until(num_steps);
+	test_timer_cache(num_steps);
+	test_registry(num_steps);
+	test_openmetrics();
+	printf("Simulated in %.3f seconds\n", (double)nanotime_interval(start, nanotime_now(), nanotime_now_max()) / NANOTIME_NSEC_PER_SEC);
+
+	if (num_failures > 0) {
+		printf("%d checks failed\n", num_failures);
+		return EXIT_FAILURE;
+	}
+	printf("All checks passed\n");
+	return EXIT_SUCCESS;
+}
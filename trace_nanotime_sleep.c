@@ -0,0 +1,360 @@
+/*
+ * You can choose this license, if possible in your jurisdiction:
+ *
+ * Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute
+ * this software, either in source code form or as a compiled binary, for any
+ * purpose, commercial or non-commercial, and by any means.
+ *
+ * In jurisdictions that recognize copyright laws, the author or authors of
+ * this software dedicate any and all copyright interest in the software to the
+ * public domain. We make this dedication for the benefit of the public at
+ * large and to the detriment of our heirs and successors. We intend this
+ * dedication to be an overt act of relinquishment in perpetuity of all present
+ * and future rights to this software under copyright law.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+ * AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ *
+ *
+ * Alternative license choice, if works can't be directly submitted to the
+ * public domain in your jurisdiction:
+ *
+ * The MIT License (MIT)
+ *
+ * Copyright © 2022 Brandon McGriff <nightmareci@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+// Captures traces of real sleep behavior, and replays them against variants of
+// the stepper's parameters, to tune the stepper for a class of hosts offline.
+//
+// Capturing measures nanotime_sleep at a range of requested durations, along
+// with the cost of a nanotime_now call:
+//     trace_nanotime_sleep capture <trace file> [seconds]
+//
+// Replaying runs the stepper on nanotime's virtual clock, with every sleep's
+// duration drawn from the trace, for each combination of the shift and coarse
+// sleep duration parameters; for each, the error past the step deadlines and
+// the modelled CPU time spent spinning and sleeping are reported:
+//     trace_nanotime_sleep replay <trace file> [steps] [rate]
+//
+// Trace files are compact, starting with the 8 bytes "NANOTRC1", then the cost
+// of a clock read in nanoseconds, then a record per sleep of the requested
+// duration and the zigzag-encoded difference of the slept duration from the
+// requested duration, until the end of the file. All numbers are unsigned
+// LEB128 varints, so a typical record takes 4 to 6 bytes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define NANOTIME_IMPLEMENTATION
+#include "nanotime.h"
+
+#define TRACE_MAGIC "NANOTRC1"
+
+// The requested durations captured; the zero-duration and 1 ms sleeps are the
+// ones the stepper uses most, by default.
+static const uint64_t capture_durations[] = {
+	UINT64_C(0),
+	UINT64_C(1000),
+	UINT64_C(2000),
+	UINT64_C(5000),
+	UINT64_C(10000),
+	UINT64_C(20000),
+	UINT64_C(50000),
+	UINT64_C(100000),
+	UINT64_C(200000),
+	UINT64_C(250000),
+	UINT64_C(500000),
+	UINT64_C(1000000),
+	UINT64_C(2000000),
+	UINT64_C(4000000)
+};
+
+#define NUM_CAPTURE_DURATIONS (sizeof(capture_durations) / sizeof(capture_durations[0]))
+
+static const uint64_t variant_shifts[] = { 1, 2, 3, 4, 5 };
+
+static const uint64_t variant_coarse_durations[] = {
+	UINT64_C(250000),
+	UINT64_C(500000),
+	UINT64_C(1000000),
+	UINT64_C(2000000),
+	UINT64_C(4000000)
+};
+
+static bool write_varint(FILE* const file, uint64_t value) {
+	do {
+		uint8_t byte = (uint8_t)(value & 0x7F);
+		value >>= 7;
+		if (value != 0) {
+			byte |= 0x80;
+		}
+		if (fputc(byte, file) == EOF) {
+			return false;
+		}
+	} while (value != 0);
+	return true;
+}
+
+// Returns false at the end of the file, or if the varint is malformed.
+static bool read_varint(FILE* const file, uint64_t* const value) {
+	*value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		const int byte = fgetc(file);
+		if (byte == EOF) {
+			return false;
+		}
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static uint64_t zigzag_encode(const uint64_t slept, const uint64_t requested) {
+	return slept >= requested ? (slept - requested) << 1 : ((requested - slept) << 1) - 1;
+}
+
+static uint64_t zigzag_decode(const uint64_t encoded, const uint64_t requested) {
+	if (encoded & 1) {
+		const uint64_t under = (encoded >> 1) + 1;
+		return under < requested ? requested - under : 0;
+	}
+	return requested + (encoded >> 1);
+}
+
+static int capture(const char* const path, const double seconds) {
+	FILE* const file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "Failed to open \"%s\" for writing\n", path);
+		return EXIT_FAILURE;
+	}
+
+	// The average cost of a clock read, that the replay charges for every
+	// read the stepper makes.
+	const uint64_t num_reads = 1000000;
+	const uint64_t read_start = nanotime_now();
+	for (uint64_t i = 0; i < num_reads; i++) {
+		nanotime_now();
+	}
+	const uint64_t read_cost = nanotime_interval(read_start, nanotime_now(), nanotime_now_max()) / num_reads;
+
+	bool written = fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), file) == strlen(TRACE_MAGIC) && write_varint(file, read_cost);
+
+	// The durations are cycled through, so every duration is measured
+	// under the same conditions over the whole capture.
+	const uint64_t now_max = nanotime_now_max();
+	const uint64_t capture_duration = (uint64_t)(seconds * NANOTIME_NSEC_PER_SEC);
+	const uint64_t capture_start = nanotime_now();
+	uint64_t num_samples = 0;
+	for (size_t i = 0; written && nanotime_interval(capture_start, nanotime_now(), now_max) < capture_duration; i = (i + 1) % NUM_CAPTURE_DURATIONS) {
+		const uint64_t requested = capture_durations[i];
+		const uint64_t start = nanotime_now();
+		nanotime_sleep(requested);
+		const uint64_t slept = nanotime_interval(start, nanotime_now(), now_max);
+		written = write_varint(file, requested) && write_varint(file, zigzag_encode(slept, requested));
+		num_samples++;
+	}
+
+	if (fclose(file) != 0 || !written) {
+		fprintf(stderr, "Failed to write \"%s\"\n", path);
+		return EXIT_FAILURE;
+	}
+	printf("Captured %" PRIu64 " sleeps to \"%s\", with a clock read cost of %" PRIu64 " ns\n", num_samples, path, read_cost);
+	return EXIT_SUCCESS;
+}
+
+static int compare_samples(const void* a, const void* b) {
+	const nanotime_sleep_sample* const sample_a = (const nanotime_sleep_sample*)a;
+	const nanotime_sleep_sample* const sample_b = (const nanotime_sleep_sample*)b;
+	return (sample_a->requested > sample_b->requested) - (sample_a->requested < sample_b->requested);
+}
+
+static int compare_uint64(const void* a, const void* b) {
+	const uint64_t value_a = *(const uint64_t*)a;
+	const uint64_t value_b = *(const uint64_t*)b;
+	return (value_a > value_b) - (value_a < value_b);
+}
+
+static nanotime_sleep_sample* load(const char* const path, size_t* const count, uint64_t* const read_cost) {
+	FILE* const file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Failed to open \"%s\" for reading\n", path);
+		return NULL;
+	}
+
+	char magic[sizeof(TRACE_MAGIC) - 1];
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 || !read_varint(file, read_cost)) {
+		fprintf(stderr, "\"%s\" isn't a sleep trace file\n", path);
+		fclose(file);
+		return NULL;
+	}
+
+	size_t capacity = 4096;
+	nanotime_sleep_sample* samples = (nanotime_sleep_sample*)malloc(capacity * sizeof(*samples));
+	*count = 0;
+	uint64_t requested;
+	uint64_t encoded;
+	while (samples && read_varint(file, &requested)) {
+		if (!read_varint(file, &encoded)) {
+			fprintf(stderr, "\"%s\" is truncated\n", path);
+			break;
+		}
+		if (*count == capacity) {
+			capacity *= 2;
+			nanotime_sleep_sample* const grown = (nanotime_sleep_sample*)realloc(samples, capacity * sizeof(*samples));
+			if (!grown) {
+				free(samples);
+				samples = NULL;
+				break;
+			}
+			samples = grown;
+		}
+		samples[*count].requested = requested;
+		samples[*count].slept = zigzag_decode(encoded, requested);
+		(*count)++;
+	}
+	fclose(file);
+
+	if (!samples || *count == 0) {
+		fprintf(stderr, "No samples could be loaded from \"%s\"\n", path);
+		free(samples);
+		return NULL;
+	}
+	qsort(samples, *count, sizeof(*samples), compare_samples);
+	return samples;
+}
+
+static int replay(const char* const path, const uint64_t num_steps, const double rate) {
+	size_t num_samples;
+	uint64_t read_cost;
+	nanotime_sleep_sample* const samples = load(path, &num_samples, &read_cost);
+	if (!samples) {
+		return EXIT_FAILURE;
+	}
+	uint64_t* const deviations = (uint64_t*)malloc(num_steps * sizeof(*deviations));
+	if (!deviations) {
+		free(samples);
+		return EXIT_FAILURE;
+	}
+
+	printf("Replaying %" PRIu64 " sleeps from \"%s\", %" PRIu64 " steps at %.3f Hz, clock read cost %" PRIu64 " ns\n", (uint64_t)num_samples, path, num_steps, rate, read_cost);
+	printf("Busy is the time awake, including spinning; CPU percentages are of the elapsed time.\n");
+	printf("%5s %10s | %10s %10s %10s | %8s %8s %8s | %10s\n", "shift", "coarse ns", "mean ns", "p99 ns", "max ns", "spin %", "busy %", "sleep %", "wakeups/s");
+
+	const uint64_t sleep_duration = (uint64_t)(NANOTIME_NSEC_PER_SEC / rate);
+	for (size_t i = 0; i < sizeof(variant_shifts) / sizeof(variant_shifts[0]); i++) {
+		for (size_t j = 0; j < sizeof(variant_coarse_durations) / sizeof(variant_coarse_durations[0]); j++) {
+			nanotime_virtual_clock clock;
+			nanotime_virtual_clock_init(&clock, 0, UINT64_MAX, UINT64_C(12345));
+			clock.read_cost = read_cost;
+			clock.samples = samples;
+			clock.samples_count = num_samples;
+
+			nanotime_step_data stepper;
+			nanotime_step_init_user(&stepper, sleep_duration, clock.now_max, &clock, nanotime_virtual_now, nanotime_virtual_sleep);
+			stepper.shift = variant_shifts[i];
+			stepper.coarse_duration = variant_coarse_durations[j];
+
+			// Only time within the steps is counted, not the time
+			// initialization took.
+			const uint64_t start = clock.now;
+			const uint64_t start_slept = clock.slept_duration;
+			uint64_t total_deviation = 0;
+			for (uint64_t step = 0; step < num_steps; step++) {
+				nanotime_step(&stepper);
+				deviations[step] = stepper.stats.deviation;
+				total_deviation += stepper.stats.deviation;
+			}
+			const double elapsed = (double)(clock.now - start);
+			const double slept = (double)(clock.slept_duration - start_slept);
+
+			qsort(deviations, num_steps, sizeof(*deviations), compare_uint64);
+			printf(
+				"%5" PRIu64 " %10" PRIu64 " | %10.1f %10" PRIu64 " %10" PRIu64 " | %8.3f %8.3f %8.3f | %10.1f\n",
+				stepper.shift,
+				stepper.coarse_duration,
+				(double)total_deviation / (double)num_steps,
+				deviations[(num_steps - 1) * 99 / 100],
+				deviations[num_steps - 1],
+				100.0 * (double)stepper.stats.spin_duration / elapsed,
+				100.0 * (elapsed - slept) / elapsed,
+				100.0 * slept / elapsed,
+				nanotime_step_wakeups_per_second(&stepper.stats)
+			);
+		}
+	}
+
+	free(deviations);
+	free(samples);
+	return EXIT_SUCCESS;
+}
+
+static void usage() {
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "    trace_nanotime_sleep capture <trace file> [seconds]\n");
+	fprintf(stderr, "    trace_nanotime_sleep replay <trace file> [steps] [rate]\n");
+	fprintf(stderr, "[seconds] is the duration to capture for, and must be greater than 0.0; the default is 10.0.\n");
+	fprintf(stderr, "[steps] is the number of steps to replay per variant, and must be greater than 0; the default is 20000.\n");
+	fprintf(stderr, "[rate] is the step rate in Hz, and must be greater than 0.0; the default is 60.0.\n");
+}
+
+int main(int argc, char** argv) {
+	if (argc >= 3 && argc <= 4 && strcmp(argv[1], "capture") == 0) {
+		double seconds = 10.0;
+		if (argc == 4 && (sscanf(argv[3], "%lf", &seconds) != 1 || seconds <= 0.0)) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return capture(argv[2], seconds);
+	}
+	else if (argc >= 3 && argc <= 5 && strcmp(argv[1], "replay") == 0) {
+		uint64_t num_steps = 20000;
+		double rate = 60.0;
+		if (
+			(argc >= 4 && (sscanf(argv[3], "%" SCNu64, &num_steps) != 1 || num_steps == 0)) ||
+			(argc == 5 && (sscanf(argv[4], "%lf", &rate) != 1 || rate <= 0.0))
+		) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		return replay(argv[2], num_steps, rate);
+	}
+	else {
+		usage();
+		return EXIT_FAILURE;
+	}
+}